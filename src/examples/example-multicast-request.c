@@ -139,8 +139,8 @@ main(int argc, char ** argv)
 	 * This can help make multicast POSTs take effect more simultaneously.
 	 */
 
-	transaction = nyoci_transaction_init(
-		NULL,
+	transaction = nyoci_transaction_create(
+		instance,
 		NYOCI_TRANSACTION_ALWAYS_INVALIDATE
 		| NYOCI_TRANSACTION_NO_AUTO_END
 		| NYOCI_TRANSACTION_BURST_MULTICAST,
@@ -39,10 +39,17 @@
 **
 **	    cc btree.c -Wall -DBTREE_SELF_TEST=1 -o btree
 **
-**	## Todo ##
+**	## Balancing ##
 **
-**	 * Add some sort of automatic tree-balancing algorithm,
-**	   like <http://en.wikipedia.org/wiki/Scapegoat_tree>.
+**	`bt_insert()` and `bt_remove()` never rebalance, so the shape of
+**	the tree depends on the order the keys arrive in. `bt_avl_insert()`
+**	and `bt_avl_remove()` keep the tree AVL-balanced instead, using the
+**	`balance` field of each item, which bounds the depth to about
+**	1.44*log2(n). Both families share `bt_find()` and the traversal
+**	functions, but they must not be mixed on the same tree. The
+**	whole-tree operations (`bt_rebalance()`, `bt_splay()`, ...) don't
+**	maintain the balance factors, so they must not be used on AVL
+**	trees either.
 */
 
 #if HAVE_CONFIG_H
@@ -182,6 +189,222 @@ bt_remove(
 	return false;
 }
 
+// MARK: -
+// MARK: AVL
+
+//!	Returns the pointer that points at `item`: its parent's child pointer, or the root.
+static bt_item_t*
+bt_avl_slot_(void** bt, bt_item_t item) {
+	if(!item->parent)
+		return (bt_item_t*)bt;
+	return (item->parent->lhs == item) ? &item->parent->lhs : &item->parent->rhs;
+}
+
+static void
+bt_avl_rotate_left_(bt_item_t* slot) {
+	bt_item_t const x = *slot;
+	bt_item_t const z = x->rhs;
+
+	z->parent = x->parent;
+	x->rhs = z->lhs;
+	if(x->rhs)
+		x->rhs->parent = x;
+	z->lhs = x;
+	x->parent = z;
+	*slot = z;
+
+	x->balance = x->balance - 1 - (z->balance > 0 ? z->balance : 0);
+	z->balance = z->balance - 1 + (x->balance < 0 ? x->balance : 0);
+}
+
+static void
+bt_avl_rotate_right_(bt_item_t* slot) {
+	bt_item_t const x = *slot;
+	bt_item_t const z = x->lhs;
+
+	z->parent = x->parent;
+	x->lhs = z->rhs;
+	if(x->lhs)
+		x->lhs->parent = x;
+	z->rhs = x;
+	x->parent = z;
+	*slot = z;
+
+	x->balance = x->balance + 1 - (z->balance < 0 ? z->balance : 0);
+	z->balance = z->balance + 1 + (x->balance > 0 ? x->balance : 0);
+}
+
+//!	Restores the balance of a subtree whose root is off by two. Returns the new root.
+static bt_item_t
+bt_avl_fix_(void** bt, bt_item_t item) {
+	bt_item_t* const slot = bt_avl_slot_(bt, item);
+
+	if(item->balance > 1) {
+		if(item->rhs->balance < 0)
+			bt_avl_rotate_right_(&item->rhs);
+		bt_avl_rotate_left_(slot);
+	} else if(item->balance < -1) {
+		if(item->lhs->balance > 0)
+			bt_avl_rotate_left_(&item->lhs);
+		bt_avl_rotate_right_(slot);
+	}
+
+	return *slot;
+}
+
+int
+bt_avl_insert(
+	void** bt,
+	void* item,
+	bt_compare_func_t compare_func,
+	bt_delete_func_t delete_func,
+	void* context
+) {
+	int depth = 0;
+	bt_item_t const item_ = item;
+	bt_item_t* slot = (bt_item_t*)bt;
+	bt_item_t parent = NULL;
+	bt_item_t child;
+
+	while(*slot) {
+		bt_item_t const location_ = *slot;
+		bt_compare_result_t result =
+			(*compare_func)(location_, item_, context);
+
+		if(!result) {
+			if(item_ != location_) {
+				// Item already exists, so it takes its place.
+				item_->parent = location_->parent;
+				item_->lhs = location_->lhs;
+				item_->rhs = location_->rhs;
+				item_->balance = location_->balance;
+				if(item_->lhs)
+					item_->lhs->parent = item_;
+				if(item_->rhs)
+					item_->rhs->parent = item_;
+				*slot = item_;
+				(*delete_func)(location_, context);
+			}
+			return depth;
+		}
+
+		parent = location_;
+		slot = (result < 0) ? &location_->rhs : &location_->lhs;
+		depth++;
+	}
+
+	item_->parent = parent;
+	item_->lhs = NULL;
+	item_->rhs = NULL;
+	item_->balance = 0;
+	*slot = item_;
+
+	// Walk back up until a subtree's height stops changing.
+	for(child = item_; parent; child = parent, parent = parent->parent) {
+		parent->balance += (parent->rhs == child) ? 1 : -1;
+
+		if(parent->balance == 0)
+			break;
+
+		if((parent->balance > 1) || (parent->balance < -1)) {
+			// A rotation after an insert restores the old height.
+			bt_avl_fix_(bt, parent);
+			break;
+		}
+	}
+
+	return depth;
+}
+
+bool
+bt_avl_remove(
+	void** bt,
+	void* item,
+	bt_compare_func_t compare_func,
+	bt_delete_func_t delete_func,
+	void* context
+) {
+	bt_item_t const item_ = bt_find(bt, item, compare_func, context);
+	bt_item_t* slot;
+	bt_item_t node;
+	bool from_lhs;
+
+	if(!item_)
+		return false;
+
+	slot = bt_avl_slot_(bt, item_);
+
+	if(item_->lhs && item_->rhs) {
+		// Move the in-order successor into the place of the item.
+		bt_item_t const next = bt_first(item_->rhs);
+
+		if(next->parent == item_) {
+			node = next;
+			from_lhs = false;
+		} else {
+			node = next->parent;
+			from_lhs = true;
+			node->lhs = next->rhs;
+			if(next->rhs)
+				next->rhs->parent = node;
+			next->rhs = item_->rhs;
+			next->rhs->parent = next;
+		}
+
+		next->lhs = item_->lhs;
+		next->lhs->parent = next;
+		next->parent = item_->parent;
+		next->balance = item_->balance;
+		*slot = next;
+	} else {
+		bt_item_t const child = item_->lhs ? item_->lhs : item_->rhs;
+
+		node = item_->parent;
+		from_lhs = node && (node->lhs == item_);
+		*slot = child;
+		if(child)
+			child->parent = item_->parent;
+	}
+
+	// Walk back up while subtrees keep getting shorter.
+	while(node) {
+		bt_item_t const parent = node->parent;
+		bool const node_is_lhs = parent && (parent->lhs == node);
+
+		node->balance += from_lhs ? 1 : -1;
+
+		if((node->balance == 1) || (node->balance == -1))
+			break;
+
+		if(node->balance != 0) {
+			bt_item_t const sibling = (node->balance > 0) ? node->rhs : node->lhs;
+
+			if(sibling->balance == 0) {
+				// Single rotation, height unchanged.
+				bt_avl_fix_(bt, node);
+				break;
+			}
+
+			bt_avl_fix_(bt, node);
+		}
+
+		from_lhs = node_is_lhs;
+		node = parent;
+	}
+
+	item_->lhs = NULL;
+	item_->rhs = NULL;
+	item_->parent = NULL;
+	item_->balance = 0;
+
+	if(delete_func)
+		(*delete_func)(item_, context);
+
+	return true;
+}
+
+// MARK: -
+
 void*
 bt_first(void* item) {
 	bt_item_t item_ = item;
@@ -516,6 +739,252 @@ reverse_traversal_test(self_test_node_t root) {
 	printf("OK\n");
 }
 
+//!	Checks parent pointers and balance factors. Returns the height, or -1 on error.
+int
+avl_verify(bt_item_t item, bt_item_t parent) {
+	int lhs, rhs;
+
+	if(!item)
+		return 0;
+
+	if(item->parent != parent) {
+		printf("error: Bad parent pointer.\n");
+		return -1;
+	}
+
+	lhs = avl_verify(item->lhs, item);
+	rhs = avl_verify(item->rhs, item);
+
+	if((lhs < 0) || (rhs < 0))
+		return -1;
+
+	if((rhs - lhs != item->balance) || (item->balance > 1) || (item->balance < -1)) {
+		printf("error: Bad balance %d, heights are %d and %d.\n", item->balance, lhs, rhs);
+		return -1;
+	}
+
+	return 1 + ((lhs > rhs) ? lhs : rhs);
+}
+
+int
+avl_test(void) {
+	int ret = 0;
+	self_test_node_t root = NULL;
+	unsigned char c = 0;
+	int i;
+	int height;
+
+	printf("AVL: Inserting nodes in sequential order.\n");
+	for(i = 0; i != 255; i++) {
+		self_test_node_t new_node =
+			calloc(sizeof(struct self_test_node_s),1);
+
+		asprintf(&new_node->name, "item_%03d", i);
+
+		nodes_alive++;
+
+		bt_avl_insert(
+			(void**)&root,
+			new_node,
+			(bt_compare_func_t)&self_test_node_compare,
+			(bt_delete_func_t)&self_test_node_delete,
+			&nodes_alive
+		);
+
+		if(avl_verify(&root->item, NULL) < 0) {
+			ret++;
+			break;
+		}
+	}
+
+	height = avl_verify(&root->item, NULL);
+	printf(" * height = %d\n", height);
+
+	// An AVL tree with 255 nodes is at most 10 levels deep.
+	if(height > 10) {
+		printf("error: AVL tree is too deep.\n");
+		ret++;
+	}
+
+	forward_traversal_test(root);
+	reverse_traversal_test(root);
+
+	printf("AVL: Replacing a node.\n");
+	{
+		self_test_node_t new_node = calloc(sizeof(struct self_test_node_s),1);
+		asprintf(&new_node->name, "item_%03d", 100);
+		nodes_alive++;
+		bt_avl_insert(
+			(void**)&root,
+			new_node,
+			(bt_compare_func_t)&self_test_node_compare,
+			(bt_delete_func_t)&self_test_node_delete,
+			&nodes_alive
+		);
+		if(avl_verify(&root->item, NULL) < 0)
+			ret++;
+		if(nodes_alive != bt_count((void**)&root)) {
+			printf("error: Bad node count.\n");
+			ret++;
+		}
+	}
+
+	printf("AVL: Removing nodes in pseudo random order.\n");
+	for(c = (uint8_t)((4 * 97 + 101)&0xFF); c!=4; c = ((c * 97 + 101)&0xFF)) {
+		char* name = NULL;
+
+		asprintf(&name, "item_%03d", (c==0)?4:c);
+
+		if(!bt_avl_remove(
+			(void**)&root,
+			name,
+			(bt_compare_func_t)&self_test_node_compare_cstr,
+			(bt_delete_func_t)&self_test_node_delete,
+			&nodes_alive
+		) && (c != 255)) {
+			printf("error: REMOVE FAILED FOR %d\n",c);
+			ret++;
+		}
+		free(name);
+
+		if((root && (avl_verify(&root->item, NULL) < 0))
+			|| (nodes_alive != bt_count((void**)&root))
+		) {
+			ret++;
+			break;
+		}
+	}
+
+	printf("AVL: Inserting nodes in pseudo random order.\n");
+	for(c = ((c * 97 + 101)&0xFF); c; c = ((c * 97 + 101)&0xFF)) {
+		self_test_node_t new_node = calloc(sizeof(struct self_test_node_s),
+			1);
+
+		asprintf(&new_node->name, "item_%03d", c);
+
+		nodes_alive++;
+
+		bt_avl_insert(
+			(void**)&root,
+			new_node,
+			(bt_compare_func_t)&self_test_node_compare,
+			(bt_delete_func_t)&self_test_node_delete,
+			&nodes_alive
+		);
+	}
+
+	if(avl_verify(&root->item, NULL) < 0)
+		ret++;
+
+	forward_traversal_test(root);
+	reverse_traversal_test(root);
+
+	// Cleanup, always removing the root.
+	printf("AVL: Removing all nodes...\n");
+	while(root) {
+		bt_avl_remove(
+			(void**)&root,
+			root,
+			(bt_compare_func_t)&self_test_node_compare,
+			(bt_delete_func_t)&self_test_node_delete,
+			&nodes_alive
+		);
+
+		if(root && (avl_verify(&root->item, NULL) < 0)) {
+			ret++;
+			break;
+		}
+	}
+
+	if(nodes_alive != 0) {
+		printf("error: nodes_alive = %d, when it should be 0\n", nodes_alive);
+		ret++;
+	}
+
+	return ret;
+}
+
+//!	Looks up every node of an AVL tree the way the DTLS session
+//!	lookup does, and checks that splaying would have broken it.
+int
+avl_splay_test(void) {
+	int ret = 0;
+	self_test_node_t root = NULL;
+	self_test_node_t node;
+	int i;
+	int height;
+
+	printf("AVL: Looking up nodes without splaying.\n");
+	for(i = 0; i != 1024; i++) {
+		self_test_node_t new_node = calloc(sizeof(struct self_test_node_s),1);
+
+		asprintf(&new_node->name, "item_%04d", (i * 97 + 101) & 1023);
+
+		nodes_alive++;
+
+		bt_avl_insert(
+			(void**)&root,
+			new_node,
+			(bt_compare_func_t)&self_test_node_compare,
+			(bt_delete_func_t)&self_test_node_delete,
+			&nodes_alive
+		);
+	}
+
+	height = avl_verify(&root->item, NULL);
+
+	for(i = 0; i != 1024; i++) {
+		char* name = NULL;
+
+		asprintf(&name, "item_%04d", i);
+		node = bt_find(
+			(void**)&root,
+			name,
+			(bt_compare_func_t)&self_test_node_compare_cstr,
+			NULL
+		);
+		free(name);
+
+		if(!node) {
+			printf("error: Lookup failed for %d.\n", i);
+			ret++;
+		}
+	}
+
+	if((height < 0) || (avl_verify(&root->item, NULL) != height)) {
+		printf("error: Lookups changed the AVL tree.\n");
+		ret++;
+	}
+
+	// Splaying the leftmost node to the root leaves the root with
+	// an empty left side, which its balance factor can't describe.
+	printf("AVL: Splaying must break the balance factors, expect an error.\n");
+	bt_splay((void**)&root, bt_first(root));
+
+	if(avl_verify(&root->item, NULL) >= 0) {
+		printf("error: Splayed AVL tree still verifies.\n");
+		ret++;
+	}
+
+	// The balance factors are now wrong, so use the plain remove.
+	while(root) {
+		bt_remove(
+			(void**)&root,
+			root,
+			(bt_compare_func_t)&self_test_node_compare,
+			(bt_delete_func_t)&self_test_node_delete,
+			&nodes_alive
+		);
+	}
+
+	if(nodes_alive != 0) {
+		printf("error: nodes_alive = %d, when it should be 0\n", nodes_alive);
+		ret++;
+	}
+
+	return ret;
+}
+
 int
 main(void) {
 	int ret = 0;
@@ -809,6 +1278,9 @@ again:
 		ret++;
 	}
 
+	ret += avl_test();
+	ret += avl_splay_test();
+
 	if(ret)
 		printf("Failed with %d errors.\n",ret);
 	else {
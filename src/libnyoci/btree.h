@@ -55,6 +55,9 @@ struct bt_item_s {
 	bt_item_t	lhs;
 	bt_item_t	rhs;
 	bt_item_t	parent;
+
+	//!	Height of `rhs` minus height of `lhs`. Only used by the AVL functions.
+	signed char	balance;
 };
 
 typedef signed char bt_compare_result_t;
@@ -90,6 +93,26 @@ NYOCI_INTERNAL_EXTERN bool bt_remove(
 	void*				context
 );
 
+//! Inserts the given item into the tree, keeping the tree AVL-balanced.
+/*!	Same arguments and return value as bt_insert(). */
+NYOCI_INTERNAL_EXTERN int bt_avl_insert(
+	void**				bt,
+	void*				item,
+	bt_compare_func_t	compare_func,
+	bt_delete_func_t	delete_func,
+	void*				context
+);
+
+//! Removes the given item from the tree, if present, keeping the tree AVL-balanced.
+/*!	Same arguments and return value as bt_remove(). */
+NYOCI_INTERNAL_EXTERN bool bt_avl_remove(
+	void**				bt,
+	void*				item,
+	bt_compare_func_t	compare_func,
+	bt_delete_func_t	delete_func,
+	void*				context
+);
+
 //!	Finds the left-most node in the subtree described by item.
 NYOCI_INTERNAL_EXTERN void* bt_first(void* item);
 
@@ -0,0 +1,208 @@
+/*!	@file btreebench.c
+**	@author Robert Quattlebaum <darco@deepdarc.com>
+**	@desc Microbenchmark for the plain and AVL-balanced binary trees
+**
+**	Inserts, finds and removes N items with each flavor of the tree,
+**	with keys arriving both in random and in sequential order. Not
+**	run by `make check`; build it explicitly with `make btreebench`.
+**
+**	Usage: `btreebench [item-count ...]`
+**
+**	The plain tree degenerates into a linked list when keys arrive in
+**	order, so that case is skipped above `PLAIN_SEQUENTIAL_LIMIT`.
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "libnyoci.h"
+
+#include "btree.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define PLAIN_SEQUENTIAL_LIMIT		20000
+
+struct bench_node_s {
+	struct bt_item_s item;
+	uint32_t key;
+};
+
+typedef int (*bench_insert_func_t)(void**, void*, bt_compare_func_t, bt_delete_func_t, void*);
+typedef bool (*bench_remove_func_t)(void**, void*, bt_compare_func_t, bt_delete_func_t, void*);
+
+static bt_compare_result_t
+bench_node_compare(const void* lhs, const void* rhs, void* context)
+{
+	const struct bench_node_s* const lhs_ = lhs;
+	const struct bench_node_s* const rhs_ = rhs;
+
+	return (lhs_->key > rhs_->key) - (lhs_->key < rhs_->key);
+}
+
+static bt_compare_result_t
+bench_node_compare_key(const void* lhs, const void* rhs, void* context)
+{
+	const struct bench_node_s* const lhs_ = lhs;
+	const uint32_t key = *(const uint32_t*)rhs;
+
+	return (lhs_->key > key) - (lhs_->key < key);
+}
+
+static void
+bench_node_delete(void* item, void* context)
+{
+}
+
+static double
+now_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int
+tree_height(bt_item_t item)
+{
+	int lhs, rhs;
+
+	if (item == NULL) {
+		return 0;
+	}
+
+	lhs = tree_height(item->lhs);
+	rhs = tree_height(item->rhs);
+
+	return 1 + ((lhs > rhs) ? lhs : rhs);
+}
+
+static void
+shuffle(uint32_t* keys, int count)
+{
+	int i;
+
+	for (i = count - 1; i > 0; i--) {
+		int j = rand() % (i + 1);
+		uint32_t tmp = keys[i];
+		keys[i] = keys[j];
+		keys[j] = tmp;
+	}
+}
+
+static void
+run(
+	const char* name,
+	bench_insert_func_t insert_func,
+	bench_remove_func_t remove_func,
+	struct bench_node_s* nodes,
+	const uint32_t* lookup,
+	int count
+) {
+	void* root = NULL;
+	double start, insert_time, find_time, remove_time;
+	int height;
+	int i;
+
+	start = now_seconds();
+	for (i = 0; i < count; i++) {
+		(*insert_func)(&root, &nodes[i], &bench_node_compare, &bench_node_delete, NULL);
+	}
+	insert_time = now_seconds() - start;
+
+	height = tree_height(root);
+
+	start = now_seconds();
+	for (i = 0; i < count; i++) {
+		if (bt_find(&root, &lookup[i], &bench_node_compare_key, NULL) == NULL) {
+			fprintf(stderr, "error: key %u not found\n", lookup[i]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	find_time = now_seconds() - start;
+
+	start = now_seconds();
+	for (i = 0; i < count; i++) {
+		(*remove_func)(&root, (void*)&lookup[i], &bench_node_compare_key, NULL, NULL);
+	}
+	remove_time = now_seconds() - start;
+
+	if (root != NULL) {
+		fprintf(stderr, "error: tree not empty after removing everything\n");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("  %-6s height %4d   insert %8.1f ns   find %8.1f ns   remove %8.1f ns\n",
+		name,
+		height,
+		insert_time * 1e9 / count,
+		find_time * 1e9 / count,
+		remove_time * 1e9 / count
+	);
+}
+
+static void
+bench(int count)
+{
+	struct bench_node_s* nodes = calloc(count, sizeof(*nodes));
+	uint32_t* lookup = calloc(count, sizeof(*lookup));
+	int sequential;
+	int i;
+
+	if ((nodes == NULL) || (lookup == NULL)) {
+		fprintf(stderr, "error: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (sequential = 0; sequential <= 1; sequential++) {
+		for (i = 0; i < count; i++) {
+			lookup[i] = (uint32_t)i;
+		}
+
+		if (!sequential) {
+			shuffle(lookup, count);
+		}
+
+		for (i = 0; i < count; i++) {
+			nodes[i].key = lookup[i];
+		}
+
+		// Find and remove in a different order than we inserted.
+		shuffle(lookup, count);
+
+		printf("%d items, %s keys:\n", count, sequential ? "sequential" : "random");
+
+		if (sequential && (count > PLAIN_SEQUENTIAL_LIMIT)) {
+			printf("  %-6s skipped, degenerates into a list\n", "plain");
+		} else {
+			run("plain", &bt_insert, &bt_remove, nodes, lookup, count);
+		}
+
+		run("avl", &bt_avl_insert, &bt_avl_remove, nodes, lookup, count);
+	}
+
+	free(lookup);
+	free(nodes);
+}
+
+int
+main(int argc, char * argv[])
+{
+	int i;
+
+	srand(1);
+
+	if (argc > 1) {
+		for (i = 1; i < argc; i++) {
+			bench(atoi(argv[i]));
+		}
+	} else {
+		bench(10000);
+		bench(100000);
+		bench(1000000);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -132,6 +132,11 @@ typedef nyoci_callback_func nyoci_inbound_resend_func;
 #define nyoci_init(self)		nyoci_init()
 #define nyoci_release(self)		nyoci_release()
 #define nyoci_get_next_msg_id(self)		nyoci_get_next_msg_id()
+#define nyoci_get_dupe_stats(self,...)		nyoci_get_dupe_stats(__VA_ARGS__)
+#define nyoci_get_rtt_stats(self,...)		nyoci_get_rtt_stats(__VA_ARGS__)
+#define nyoci_set_rto_bounds(self,...)		nyoci_set_rto_bounds(__VA_ARGS__)
+#define nyoci_set_nstart(self,...)		nyoci_set_nstart(__VA_ARGS__)
+#define nyoci_get_nstart_stats(self,...)		nyoci_get_nstart_stats(__VA_ARGS__)
 #define nyoci_handle_request(self,...)		nyoci_handle_request(__VA_ARGS__)
 #define nyoci_handle_response(self,...)		nyoci_handle_response(__VA_ARGS__)
 #define nyoci_get_timeout(self)		nyoci_get_timeout()
@@ -523,6 +528,97 @@ NYOCI_API_EXTERN nyoci_status_t nyoci_outbound_quick_response(coap_code_t code,
 
 NYOCI_API_EXTERN coap_msg_id_t nyoci_get_next_msg_id(nyoci_t self);
 
+struct nyoci_dupe_stats_s {
+	//!	Inbound packets found to be duplicates.
+	uint32_t		duplicates;
+
+	//!	Remembered packets forgotten after EXCHANGE_LIFETIME.
+	uint32_t		expired;
+
+	//!	Remembered packets forgotten early because the table was full.
+	/*!	If this keeps growing, consider raising
+	**	`NYOCI_CONF_DUPE_BUFFER_SIZE`. */
+	uint32_t		evicted;
+
+	//!	Duplicate confirmable requests answered from the response cache.
+	uint32_t		replayed;
+
+	//!	Duplicate confirmable requests with no cached response, which
+	//!	were passed on to the request handler.
+	/*!	See `NYOCI_CONF_DUPE_RESPONSE_CACHE_SIZE`. */
+	uint32_t		replay_misses;
+};
+
+//!	Copies the duplicate detection counters into `stats`.
+NYOCI_API_EXTERN void nyoci_get_dupe_stats(nyoci_t self, struct nyoci_dupe_stats_s* stats);
+
+struct nyoci_rtt_stats_s {
+	//!	Retransmission timeout currently used for the peer, in ms.
+	nyoci_cms_t		rto;
+
+	//!	Smoothed RTT and its variation from exchanges that needed no
+	//!	retransmission, in microseconds.
+	uint32_t		strong_srtt_us;
+	uint32_t		strong_rttvar_us;
+	uint32_t		strong_samples;
+
+	//!	Same, from exchanges that needed one or two retransmissions.
+	uint32_t		weak_srtt_us;
+	uint32_t		weak_rttvar_us;
+	uint32_t		weak_samples;
+};
+
+//!	Copies the round-trip time estimates for `remote` into `stats`.
+/*!	Returns `NYOCI_STATUS_NOT_FOUND` if nothing is known about
+**	`remote`. */
+NYOCI_API_EXTERN nyoci_status_t nyoci_get_rtt_stats(
+	nyoci_t self,
+	const nyoci_sockaddr_t* remote,
+	struct nyoci_rtt_stats_s* stats
+);
+
+//!	Sets the range that per-peer retransmission timeouts are kept in.
+/*!	Both are in milliseconds. The defaults are `NYOCI_CONF_MIN_RTO`
+**	and `NYOCI_CONF_MAX_RTO`. */
+NYOCI_API_EXTERN void nyoci_set_rto_bounds(nyoci_t self, nyoci_cms_t min_rto, nyoci_cms_t max_rto);
+
+//!	Sets how many confirmable requests may be outstanding towards a peer.
+/*!	If `remote` is NULL this sets the default for all peers, which
+**	starts out as `NYOCI_CONF_NSTART`, and zero removes the limit.
+**	Otherwise it only applies to `remote`, for instance to allow
+**	more parallel requests to a trusted server, and zero makes it go
+**	back to the default. A peer with its own limit is kept in the
+**	peer table until the limit is reset.
+**
+**	Requests beyond the limit are held back until an earlier exchange
+**	with the same peer completes, in the order they were sent. */
+NYOCI_API_EXTERN nyoci_status_t nyoci_set_nstart(
+	nyoci_t self,
+	const nyoci_sockaddr_t* remote,
+	uint8_t nstart
+);
+
+struct nyoci_nstart_stats_s {
+	//!	Confirmable requests currently outstanding, over all peers.
+	uint32_t		outstanding;
+
+	//!	Transactions currently waiting for a peer to become available.
+	uint32_t		queued;
+
+	//!	Largest value `queued` has had.
+	uint32_t		max_queued;
+
+	//!	Transactions that had to wait before being sent.
+	uint32_t		parked;
+
+	//!	Total and longest time spent waiting, in milliseconds.
+	uint32_t		total_wait;
+	uint32_t		max_wait;
+};
+
+//!	Copies the NSTART counters into `stats`.
+NYOCI_API_EXTERN void nyoci_get_nstart_stats(nyoci_t self, struct nyoci_nstart_stats_s* stats);
+
 NYOCI_END_C_DECLS
 
 /*!	@} */
@@ -535,6 +631,7 @@ NYOCI_END_C_DECLS
 
 #include "nyoci-timer.h"
 #include "nyoci-async.h"
+#include "nyoci-command.h"
 #include "nyoci-transaction.h"
 #include "nyoci-observable.h"
 #include "nyoci-helpers.h"
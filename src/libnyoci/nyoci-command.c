@@ -0,0 +1,138 @@
+/*!	@file nyoci-command.c
+**	@author Robert Quattlebaum <darco@deepdarc.com>
+**	@brief Cross-thread command queue
+**
+**	Copyright (C) 2017 Robert Quattlebaum
+**
+**	Permission is hereby granted, free of charge, to any person
+**	obtaining a copy of this software and associated
+**	documentation files (the "Software"), to deal in the
+**	Software without restriction, including without limitation
+**	the rights to use, copy, modify, merge, publish, distribute,
+**	sublicense, and/or sell copies of the Software, and to
+**	permit persons to whom the Software is furnished to do so,
+**	subject to the following conditions:
+**
+**	The above copyright notice and this permission notice shall
+**	be included in all copies or substantial portions of the
+**	Software.
+**
+**	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+**	KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+**	WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+**	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+**	OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+**	OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+**	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+**	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifndef VERBOSE_DEBUG
+#define VERBOSE_DEBUG 0
+#endif
+
+#ifndef DEBUG
+#define DEBUG VERBOSE_DEBUG
+#endif
+
+#include "assert-macros.h"
+#include "libnyoci.h"
+#include "nyoci-internal.h"
+#include "nyoci-logging.h"
+
+// The queue is a lock-free stack that any thread can push onto. The
+// owning thread takes the whole stack at once and reverses it, so
+// commands still run in the order they were posted and there is no
+// ABA problem to worry about.
+
+#if NYOCI_THREAD_SAFE
+#define COMMAND_QUEUE_LOAD(ptr)					__atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define COMMAND_QUEUE_EXCHANGE(ptr, val)		__atomic_exchange_n(ptr, val, __ATOMIC_ACQ_REL)
+#define COMMAND_QUEUE_CAS(ptr, expected, val)	\
+	__atomic_compare_exchange_n(ptr, expected, val, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)
+#else
+#define COMMAND_QUEUE_LOAD(ptr)					(*(ptr))
+#define COMMAND_QUEUE_EXCHANGE(ptr, val)		command_queue_exchange_(ptr, val)
+#define COMMAND_QUEUE_CAS(ptr, expected, val)	(*(ptr) = (val), true)
+
+static nyoci_command_t
+command_queue_exchange_(nyoci_command_t* ptr, nyoci_command_t val)
+{
+	nyoci_command_t ret = *ptr;
+	*ptr = val;
+	return ret;
+}
+#endif
+
+nyoci_command_t
+nyoci_command_init(
+	nyoci_command_t command,
+	nyoci_command_func func,
+	void* context
+) {
+	if (command != NULL) {
+		command->next = NULL;
+		command->func = func;
+		command->context = context;
+	}
+	return command;
+}
+
+void
+nyoci_post_command(nyoci_t self, nyoci_command_t command)
+{
+	NYOCI_SINGLETON_SELF_HOOK;
+	nyoci_command_t head = COMMAND_QUEUE_LOAD(&self->command_queue);
+
+	do {
+		command->next = head;
+	} while (!COMMAND_QUEUE_CAS(&self->command_queue, &head, command));
+
+	// Only the command that makes the queue non-empty needs to wake up
+	// the owning thread, everything posted after it is picked up in
+	// the same pass.
+	if (head == NULL) {
+		nyoci_plat_wakeup(self);
+	}
+}
+
+int
+nyoci_handle_commands(nyoci_t self)
+{
+	NYOCI_SINGLETON_SELF_HOOK;
+	nyoci_command_t list;
+	nyoci_command_t reversed = NULL;
+	int count = 0;
+
+	if (COMMAND_QUEUE_LOAD(&self->command_queue) == NULL) {
+		return 0;
+	}
+
+	list = COMMAND_QUEUE_EXCHANGE(&self->command_queue, NULL);
+
+	while (list != NULL) {
+		nyoci_command_t next = list->next;
+		list->next = reversed;
+		reversed = list;
+		list = next;
+	}
+
+	nyoci_set_current_instance(self);
+
+	while (reversed != NULL) {
+		nyoci_command_t command = reversed;
+
+		// The command may be freed or posted again by its callback.
+		reversed = command->next;
+		command->next = NULL;
+
+		(*command->func)(self, command->context);
+		count++;
+	}
+
+	return count;
+}
@@ -0,0 +1,99 @@
+/*!	@file nyoci-command.h
+**	@author Robert Quattlebaum <darco@deepdarc.com>
+**	@brief Cross-thread command queue
+**
+**	Copyright (C) 2017 Robert Quattlebaum
+**
+**	Permission is hereby granted, free of charge, to any person
+**	obtaining a copy of this software and associated
+**	documentation files (the "Software"), to deal in the
+**	Software without restriction, including without limitation
+**	the rights to use, copy, modify, merge, publish, distribute,
+**	sublicense, and/or sell copies of the Software, and to
+**	permit persons to whom the Software is furnished to do so,
+**	subject to the following conditions:
+**
+**	The above copyright notice and this permission notice shall
+**	be included in all copies or substantial portions of the
+**	Software.
+**
+**	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+**	KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+**	WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+**	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+**	OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+**	OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+**	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+**	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef NYOCI_nyoci_command_h
+#define NYOCI_nyoci_command_h
+
+#if !defined(NYOCI_INCLUDED_FROM_LIBNYOCI_H) && !defined(BUILDING_LIBNYOCI)
+#error "Do not include this header directly, include <libnyoci/libnyoci.h> instead"
+#endif
+
+#if NYOCI_SINGLETON
+#define nyoci_post_command(self,...)		nyoci_post_command(__VA_ARGS__)
+#define nyoci_handle_commands(self)		nyoci_handle_commands()
+#endif
+
+NYOCI_BEGIN_C_DECLS
+
+/*!	@addtogroup nyoci
+**	@{
+*/
+
+/*!	@defgroup nyoci_command Command Queue API
+**	@{
+**	@brief Running code on the thread that owns an instance.
+**
+**	Only the thread that runs an instance (the one calling
+**	nyoci_plat_process() or nyoci_plat_run_once()) may call into it.
+**	Other threads can instead post a command, which is a callback
+**	that the owning thread will run on its next pass. This is how
+**	requests, observable triggers and async-response completions
+**	should be started from other threads.
+**
+**	Posting is lock-free and never blocks. If the owning thread is
+**	blocked waiting for packets, it is woken up right away.
+*/
+
+typedef void (*nyoci_command_func)(nyoci_t nyoci, void* context);
+
+//!	A queued command. Owned by the caller of nyoci_post_command().
+/*!	The structure must stay valid until `func` has been called. It may
+**	be freed or posted again from within `func`. */
+struct nyoci_command_s {
+	struct nyoci_command_s* next;
+	nyoci_command_func		func;
+	void*					context;
+};
+
+typedef struct nyoci_command_s* nyoci_command_t;
+
+//!	Initializes `command` to call `func` with `context`.
+NYOCI_API_EXTERN nyoci_command_t nyoci_command_init(
+	nyoci_command_t command,
+	nyoci_command_func func,
+	void* context
+);
+
+//!	Queues `command` to be run by the thread that owns `self`.
+/*!	May be called from any thread, including from within a
+**	command. Commands posted from the same thread run in order. */
+NYOCI_API_EXTERN void nyoci_post_command(nyoci_t self, nyoci_command_t command);
+
+//!	Runs every command that is currently queued.
+/*!	Called by the platform from nyoci_plat_process().
+**	Returns the number of commands that were run. */
+NYOCI_INTERNAL_EXTERN int nyoci_handle_commands(nyoci_t self);
+
+/*!	@} */
+
+/*!	@} */
+
+NYOCI_END_C_DECLS
+
+#endif // NYOCI_nyoci_command_h
@@ -128,6 +128,8 @@
 **
 **	NOTE: Only relevant when NYOCI_AVOID_MALLOC is set.
 **
+**	Each instance has a pool of this many transactions, which
+**	`nyoci_transaction_init()` hands out when it isn't given one.
 **	You can have more than this value if you statically
 **	allocate the transactions. Dynamic allocation is
 **	disabled if this value is set to zero and NYOCI_AVOID_MALLOC
@@ -138,6 +140,18 @@
 #define NYOCI_TRANSACTION_POOL_SIZE				2
 #endif
 
+//!	@define NYOCI_CONF_TRANSACTION_SLAB_CHUNK
+/*!	Smallest number of transactions the transaction slab of an
+**	instance grows by when it runs out. Each time it grows it at
+**	least doubles, so a busy instance soon stops calling malloc.
+**	Use `nyoci_transaction_reserve()` to size it up front.
+**
+**	NOTE: Not used when NYOCI_AVOID_MALLOC is set.
+*/
+#ifndef NYOCI_CONF_TRANSACTION_SLAB_CHUNK
+#define NYOCI_CONF_TRANSACTION_SLAB_CHUNK		16
+#endif
+
 //!	@define NYOCI_CONF_MAX_TIMEOUT
 /*! The maximum timeout (in seconds) returned form `nyoci_get_timeout()`
 */
@@ -145,14 +159,96 @@
 #define NYOCI_CONF_MAX_TIMEOUT					3600
 #endif
 
+//!	@define NYOCI_CONF_TIMER_BUDGET
+/*! Default maximum number of expired timers fired by a single call to
+**	`nyoci_handle_timers()`. Zero or less means no limit.
+**	Can be changed at runtime with `nyoci_set_timer_budget()`.
+*/
+#ifndef NYOCI_CONF_TIMER_BUDGET
+#if NYOCI_EMBEDDED
+#define NYOCI_CONF_TIMER_BUDGET					4
+#else
+#define NYOCI_CONF_TIMER_BUDGET					64
+#endif
+#endif
+
+//!	@define NYOCI_CONF_TIMER_STATS
+/*! Keep counters and a lateness histogram for fired timers.
+**	See `nyoci_get_timer_stats()`.
+*/
+#ifndef NYOCI_CONF_TIMER_STATS
+#define NYOCI_CONF_TIMER_STATS					!NYOCI_EMBEDDED
+#endif
+
 //! @define NYOCI_CONF_DUPE_BUFFER_SIZE
-/*! Number of previous packets to keep track of for duplicate detection.
+/*! Maximum number of previous packets to keep track of for duplicate
+**	detection. Packets are forgotten after EXCHANGE_LIFETIME, or
+**	earlier if this many newer packets have arrived since. See
+**	`nyoci_get_dupe_stats()` to tell if this is too small.
 */
 #ifndef NYOCI_CONF_DUPE_BUFFER_SIZE
 #if NYOCI_EMBEDDED
 #define NYOCI_CONF_DUPE_BUFFER_SIZE				16
 #else
-#define NYOCI_CONF_DUPE_BUFFER_SIZE				64
+#define NYOCI_CONF_DUPE_BUFFER_SIZE				1024
+#endif
+#endif
+
+//! @define NYOCI_CONF_MAX_PEERS
+/*! Number of remote endpoints to keep state for, such as the last
+**	message id sent to each. When the table is full the least recently
+**	used entry is recycled. Zero disables the table, in which case
+**	all peers share a single message id counter.
+*/
+#ifndef NYOCI_CONF_MAX_PEERS
+#if NYOCI_EMBEDDED
+#define NYOCI_CONF_MAX_PEERS					4
+#else
+#define NYOCI_CONF_MAX_PEERS					256
+#endif
+#endif
+
+//! @define NYOCI_CONF_MIN_RTO
+/*! Lower bound, in milliseconds, on the retransmission timeout that
+**	is estimated for each peer from measured round-trip times.
+**	Can be changed at runtime with `nyoci_set_rto_bounds()`.
+*/
+#ifndef NYOCI_CONF_MIN_RTO
+#define NYOCI_CONF_MIN_RTO						20
+#endif
+
+//! @define NYOCI_CONF_MAX_RTO
+/*! Upper bound, in milliseconds, on the estimated retransmission
+**	timeout, and on how far retransmissions back off from it. Can be
+**	changed at runtime with `nyoci_set_rto_bounds()`.
+*/
+#ifndef NYOCI_CONF_MAX_RTO
+#define NYOCI_CONF_MAX_RTO						32000
+#endif
+
+//! @define NYOCI_CONF_NSTART
+/*! Default number of confirmable requests that may be outstanding
+**	towards a single peer at once (NSTART in RFC7252). Transactions
+**	beyond that wait in a queue for that peer until one of the
+**	outstanding exchanges completes. Zero removes the limit. Can be
+**	changed at runtime with `nyoci_set_nstart()`. Has no effect when
+**	`NYOCI_CONF_MAX_PEERS` is zero.
+*/
+#ifndef NYOCI_CONF_NSTART
+#define NYOCI_CONF_NSTART						1
+#endif
+
+//! @define NYOCI_CONF_DUPE_RESPONSE_CACHE_SIZE
+/*! Number of bytes set aside for remembering piggybacked responses,
+**	so that a duplicate confirmable request can be answered with the
+**	exact bytes of the original response without running the request
+**	handler again. Zero disables this.
+*/
+#ifndef NYOCI_CONF_DUPE_RESPONSE_CACHE_SIZE
+#if NYOCI_EMBEDDED
+#define NYOCI_CONF_DUPE_RESPONSE_CACHE_SIZE		0
+#else
+#define NYOCI_CONF_DUPE_RESPONSE_CACHE_SIZE		32768
 #endif
 #endif
 
@@ -192,6 +288,50 @@
 #define NYOCI_TRANSACTIONS_USE_BTREE				!NYOCI_EMBEDDED
 #endif
 
+//! @define NYOCI_TRANSACTIONS_USE_TOKEN_HASH
+/*! Keeps a hash table of transactions indexed by token, so that
+**	separate responses and observe notifications can be matched to
+**	their transaction in constant time instead of by walking every
+**	transaction.
+*/
+#ifndef NYOCI_TRANSACTIONS_USE_TOKEN_HASH
+#define NYOCI_TRANSACTIONS_USE_TOKEN_HASH		(NYOCI_TRANSACTIONS_USE_BTREE && !NYOCI_AVOID_MALLOC)
+#endif
+
+//! @define NYOCI_CONF_TOKEN_LENGTH
+/*! Default length, in bytes, of the tokens generated for outbound
+**	requests. Must be between 1 and 8. Longer tokens make it harder
+**	for an off-path attacker to spoof a response and let more
+**	requests be in flight before a token is reused.
+**	Can be changed at runtime with `nyoci_set_token_length()`.
+*/
+#ifndef NYOCI_CONF_TOKEN_LENGTH
+#if NYOCI_EMBEDDED
+#define NYOCI_CONF_TOKEN_LENGTH					2
+#else
+#define NYOCI_CONF_TOKEN_LENGTH					4
+#endif
+#endif
+
+//! @define NYOCI_TIMERS_USE_HEAP
+/*! Determines if scheduled timers are kept in a 4-ary heap or in a
+**	sorted linked list. The heap makes scheduling and invalidating
+**	O(log n) instead of O(n), which matters once there are thousands
+**	of transactions in flight, but it has to allocate its array.
+*/
+#ifndef NYOCI_TIMERS_USE_HEAP
+#define NYOCI_TIMERS_USE_HEAP					!NYOCI_AVOID_MALLOC
+#endif
+
+//! @define NYOCI_CONF_TRANSACTION_TIMER_SLACK_DIVISOR
+/*! Retransmit, keep-alive and max-age timers of transactions may fire
+**	up to 1/n of their interval late, so that nearby timers can share
+**	a wakeup. Set to zero to make them fire on time.
+*/
+#ifndef NYOCI_CONF_TRANSACTION_TIMER_SLACK_DIVISOR
+#define NYOCI_CONF_TRANSACTION_TIMER_SLACK_DIVISOR	8
+#endif
+
 //! @define NYOCI_TRANSACTION_BURST_COUNT
 /*!	Number of retransmit attempts during a burst. */
 #ifndef NYOCI_TRANSACTION_BURST_COUNT
@@ -234,13 +374,60 @@
 /*****************************************************************************/
 // MARK: - Observation Options
 
+//!	@define NYOCI_MAX_OBSERVERS
+/*!	Maximum number of observers per instance.
+**
+**	When NYOCI_AVOID_MALLOC is set, each instance has a table of this
+**	many observers. Otherwise the table grows on demand, see
+**	`NYOCI_CONF_OBSERVER_CHUNK_SIZE`, and this is only a limit.
+*/
 #ifdef NYOCI_CONF_MAX_OBSERVERS
 #define NYOCI_MAX_OBSERVERS			(NYOCI_CONF_MAX_OBSERVERS)
 #else
 #if NYOCI_EMBEDDED
 #define NYOCI_MAX_OBSERVERS			(2)
-#else
+#elif NYOCI_AVOID_MALLOC
 #define NYOCI_MAX_OBSERVERS			(64)
+#else
+#define NYOCI_MAX_OBSERVERS			(65536)
+#endif
+#endif
+
+//!	@define NYOCI_CONF_OBSERVER_CHUNK_SIZE
+/*!	Number of observers the observer table of an instance grows by.
+**	Observers never move once allocated, so the table is made of
+**	chunks of this size.
+**
+**	NOTE: Not used when NYOCI_AVOID_MALLOC is set.
+*/
+#ifndef NYOCI_CONF_OBSERVER_CHUNK_SIZE
+#define NYOCI_CONF_OBSERVER_CHUNK_SIZE		(64)
+#endif
+
+//!	@define NYOCI_CONF_OBSERVABLE_LEGACY_BROADCAST_KEY
+/*!	Observable keys used to be eight bits wide, and
+**	`NYOCI_OBSERVABLE_BROADCAST_KEY` used to be 0xFF. Set this to 1
+**	to keep treating key 255 as the broadcast key, for code that
+**	hasn't been updated yet. Key 255 can't be an ordinary key then.
+*/
+#ifndef NYOCI_CONF_OBSERVABLE_LEGACY_BROADCAST_KEY
+#define NYOCI_CONF_OBSERVABLE_LEGACY_BROADCAST_KEY	0
+#endif
+
+//!	@define NYOCI_CONF_OBSERVER_FANOUT
+/*!	Number of notifications rendered by request handlers that each
+**	instance keeps, so that they can be sent to the other observers
+**	of the same resource that were triggered along with them rather
+**	than calling the handler once per observer. Each one costs a
+**	packet-sized buffer. Set to zero to always call the handler.
+**
+**	@sa NYOCI_OBS_TRIGGER_FLAG_RENDER_EACH
+*/
+#ifndef NYOCI_CONF_OBSERVER_FANOUT
+#if NYOCI_EMBEDDED
+#define NYOCI_CONF_OBSERVER_FANOUT		0
+#else
+#define NYOCI_CONF_OBSERVER_FANOUT		4
 #endif
 #endif
 
@@ -260,6 +447,32 @@
 #define NYOCI_OBSERVER_NON_EVENT_EXPIRATION		(1*MSEC_PER_SEC)
 #endif
 
+//!	@define NYOCI_OBSERVER_CON_INTERVAL
+/*!	How often nyoci_observer_default_policy() sends a notification as
+**	CON, counting in notifications, before it knows anything about the
+**	link. It moves between `NYOCI_OBSERVER_CON_INTERVAL_MIN` and
+**	`NYOCI_OBSERVER_CON_INTERVAL_MAX` as acknowledgements come back.
+*/
+#ifndef NYOCI_OBSERVER_CON_INTERVAL
+#define NYOCI_OBSERVER_CON_INTERVAL				(8)
+#endif
+
+//!	@define NYOCI_OBSERVER_CON_INTERVAL_MIN
+/*!	Shortest CON interval nyoci_observer_default_policy() uses, in
+**	notifications. One means every notification is sent as CON.
+*/
+#ifndef NYOCI_OBSERVER_CON_INTERVAL_MIN
+#define NYOCI_OBSERVER_CON_INTERVAL_MIN			(1)
+#endif
+
+//!	@define NYOCI_OBSERVER_CON_INTERVAL_MAX
+/*!	Longest CON interval nyoci_observer_default_policy() uses, in
+**	notifications, however clean the link has been.
+*/
+#ifndef NYOCI_OBSERVER_CON_INTERVAL_MAX
+#define NYOCI_OBSERVER_CON_INTERVAL_MAX			(64)
+#endif
+
 /*****************************************************************************/
 // MARK: - Extras
 
@@ -32,48 +32,172 @@
 #endif
 
 #include <stdio.h>
+#include "assert-macros.h"
 #include "nyoci-internal.h"
 #include "nyoci-dupe.h"
 #include "fasthash.h"
 
-// TODO: This code could use some optimization.
+//!	Forgets the oldest remembered packet.
+static void
+nyoci_dupe_remove_first_(struct nyoci_dupe_info_s* info)
+{
+	uint16_t* link = &info->bucket[info->dupe[info->first].hash % NYOCI_CONF_DUPE_BUFFER_SIZE];
+
+	while (*link != info->first + 1) {
+		link = &info->dupe[*link - 1].next;
+	}
+
+	*link = info->dupe[info->first].next;
+
+	info->first = (info->first + 1) % NYOCI_CONF_DUPE_BUFFER_SIZE;
+	info->count--;
+}
 
 bool
 nyoci_inbound_dupe_check(void)
 {
 	nyoci_t const self = nyoci_get_current_instance();
-	bool is_dupe = false;
+	struct nyoci_dupe_info_s* const info = &self->dupe_info;
+	const nyoci_sockaddr_t* const remote_sockaddr = nyoci_plat_get_remote_sockaddr();
+	const coap_msg_id_t msg_id = self->inbound.packet->msg_id;
+	const nyoci_timestamp_t now = nyoci_plat_cms_to_timestamp(0);
 	struct fasthash_state_s fasthash;
+	uint16_t* bucket;
 	uint32_t hash;
-	const nyoci_sockaddr_t* const remote_sockaddr = nyoci_plat_get_remote_sockaddr();
+	uint16_t i;
+
+	info->current = 0;
+
+	// Forget everything that is older than EXCHANGE_LIFETIME.
+	while ( info->count != 0
+	     && nyoci_plat_timestamp_diff(now, info->dupe[info->first].timestamp) >= NYOCI_DUPE_LIFETIME
+	) {
+		nyoci_dupe_remove_first_(info);
+		info->stats.expired++;
+	}
+
+	if (info->seed == 0) {
+		info->seed = NYOCI_FUNC_RANDOM_UINT32() | 1;
+	}
 
 	// Calculate the message-id hash (address+port+message_id)
-	fasthash_start(&fasthash, 0); // SECURITY-TODO: Use some sort of seed key
+	fasthash_start(&fasthash, info->seed);
 	fasthash_feed(&fasthash, (const void*)remote_sockaddr, sizeof(nyoci_sockaddr_t));
-	fasthash_feed(&fasthash, (const uint8_t*)&self->inbound.packet->msg_id, sizeof(self->inbound.packet->msg_id));
+	fasthash_feed(&fasthash, (const uint8_t*)&msg_id, sizeof(msg_id));
 	hash = fasthash_finish_uint32(&fasthash);
 
+	bucket = &info->bucket[hash % NYOCI_CONF_DUPE_BUFFER_SIZE];
+
 	// Check to see if this packet is a duplicate.
-	unsigned int i = NYOCI_CONF_DUPE_BUFFER_SIZE;
-	while (i--) {
-		if (self->dupe_info.dupe[i].hash == hash) {
-			if ((0 == memcmp(&self->dupe_info.dupe[i].from, (const void*)remote_sockaddr, sizeof(nyoci_sockaddr_t)))
-				&& (self->dupe_info.dupe[i].msg_id == self->inbound.packet->msg_id)
-			) {
-				is_dupe = true;
-				break;
-			}
+	for (i = *bucket; i != 0; i = info->dupe[i - 1].next) {
+		if ( (info->dupe[i - 1].hash == hash)
+		  && (info->dupe[i - 1].msg_id == msg_id)
+		  && (0 == memcmp(&info->dupe[i - 1].from, (const void*)remote_sockaddr, sizeof(nyoci_sockaddr_t)))
+		) {
+			info->stats.duplicates++;
+			info->current = i;
+			return true;
 		}
 	}
 
-	if (!is_dupe) {
-		// This is not a dupe, add it to the list.
-		self->dupe_info.dupe[self->dupe_info.dupe_index].hash = hash;
-		self->dupe_info.dupe[self->dupe_info.dupe_index].msg_id = self->inbound.packet->msg_id;
-		memcpy(&self->dupe_info.dupe[self->dupe_info.dupe_index].from, (const void*)remote_sockaddr, sizeof(nyoci_sockaddr_t));
-		self->dupe_info.dupe_index++;
-		self->dupe_info.dupe_index %= NYOCI_CONF_DUPE_BUFFER_SIZE;
+	// This is not a dupe, add it to the table.
+	if (info->count == NYOCI_CONF_DUPE_BUFFER_SIZE) {
+		nyoci_dupe_remove_first_(info);
+		info->stats.evicted++;
 	}
 
-	return is_dupe;
+	i = (info->first + info->count) % NYOCI_CONF_DUPE_BUFFER_SIZE;
+	info->count++;
+
+	info->dupe[i].hash = hash;
+	info->dupe[i].timestamp = now;
+	info->dupe[i].msg_id = msg_id;
+	memcpy(&info->dupe[i].from, (const void*)remote_sockaddr, sizeof(nyoci_sockaddr_t));
+	info->dupe[i].next = *bucket;
+	*bucket = i + 1;
+#if NYOCI_CONF_DUPE_RESPONSE_CACHE_SIZE
+	info->dupe[i].response_len = 0;
+#endif
+
+	info->current = i + 1;
+
+	return false;
+}
+
+void
+nyoci_dupe_remember_response(const struct coap_header_s* packet, coap_size_t packet_len)
+{
+#if NYOCI_CONF_DUPE_RESPONSE_CACHE_SIZE
+	nyoci_t const self = nyoci_get_current_instance();
+	struct nyoci_dupe_info_s* const info = &self->dupe_info;
+	uint32_t offset;
+
+	require_quiet(info->current != 0, bail);
+	require_quiet(packet->tt == COAP_TRANS_TYPE_ACK, bail);
+	require_quiet(packet->code != COAP_CODE_EMPTY, bail);
+	require_quiet(packet->msg_id == info->dupe[info->current - 1].msg_id, bail);
+	require_quiet(packet_len <= NYOCI_CONF_DUPE_RESPONSE_CACHE_SIZE, bail);
+
+	offset = info->response_write_pos % NYOCI_CONF_DUPE_RESPONSE_CACHE_SIZE;
+
+	if (offset + packet_len > NYOCI_CONF_DUPE_RESPONSE_CACHE_SIZE) {
+		// Doesn't fit before the end, start over at the beginning.
+		info->response_write_pos += NYOCI_CONF_DUPE_RESPONSE_CACHE_SIZE - offset;
+		offset = 0;
+	}
+
+	memcpy(info->responses + offset, packet, packet_len);
+
+	info->dupe[info->current - 1].response_pos = info->response_write_pos;
+	info->dupe[info->current - 1].response_len = packet_len;
+	info->response_write_pos += packet_len;
+
+bail:
+	return;
+#endif
+}
+
+bool
+nyoci_dupe_replay_response(void)
+{
+	nyoci_t const self = nyoci_get_current_instance();
+	struct nyoci_dupe_info_s* const info = &self->dupe_info;
+	bool ret = false;
+
+	require_quiet(info->current != 0, bail);
+
+#if NYOCI_CONF_DUPE_RESPONSE_CACHE_SIZE
+	{
+		const uint32_t pos = info->dupe[info->current - 1].response_pos;
+		const coap_size_t len = info->dupe[info->current - 1].response_len;
+
+		// Make sure it hasn't been overwritten by newer responses since.
+		if ( (len != 0)
+		  && ((uint32_t)(info->response_write_pos - pos) <= NYOCI_CONF_DUPE_RESPONSE_CACHE_SIZE)
+		) {
+			ret = (NYOCI_STATUS_OK == nyoci_plat_outbound_finish(
+				self,
+				info->responses + (pos % NYOCI_CONF_DUPE_RESPONSE_CACHE_SIZE),
+				len,
+				0
+			));
+		}
+	}
+#endif
+
+	if (ret) {
+		info->stats.replayed++;
+	} else {
+		info->stats.replay_misses++;
+	}
+
+bail:
+	return ret;
+}
+
+void
+nyoci_get_dupe_stats(nyoci_t self, struct nyoci_dupe_stats_s* stats)
+{
+	NYOCI_SINGLETON_SELF_HOOK;
+	*stats = self->dupe_info.stats;
 }
@@ -31,26 +31,70 @@
 #define NYOCI_nyoci_dupe_h
 
 #include "libnyoci.h"
+#include "fasthash.h"
 
 NYOCI_BEGIN_C_DECLS
 
+#if NYOCI_CONF_DUPE_BUFFER_SIZE >= 0xFFFF
+#error NYOCI_CONF_DUPE_BUFFER_SIZE must be less than 65535
+#endif
+
+//!	Messages are remembered for this long before they expire.
+#define NYOCI_DUPE_LIFETIME		((nyoci_cms_t)(COAP_EXCHANGE_LIFETIME*MSEC_PER_SEC))
+
+/*!	Recently seen messages are kept in a ring, oldest first, so
+**	that they can be expired in the order they arrived. Each entry
+**	is also on a hash chain so that lookups don't have to scan the
+**	whole ring. Chain links are entry indices plus one, so that a
+**	zeroed table is empty. */
 struct nyoci_dupe_info_s {
 	struct {
 		uint32_t hash;
+		nyoci_timestamp_t timestamp;
 		nyoci_sockaddr_t from;
 		coap_msg_id_t msg_id;
-		coap_code_t code;
+		uint16_t next;
+#if NYOCI_CONF_DUPE_RESPONSE_CACHE_SIZE
+		//!	Where the response we sent is in `responses`, see below.
+		uint32_t response_pos;
+		coap_size_t response_len;
+#endif
 	} dupe[NYOCI_CONF_DUPE_BUFFER_SIZE];
 
-#if NYOCI_CONF_DUPE_BUFFER_SIZE<=256
-	uint8_t dupe_index;
-#else
-	uint16_t dupe_index;
+	uint16_t bucket[NYOCI_CONF_DUPE_BUFFER_SIZE];
+
+	//!	Index of the oldest entry.
+	uint16_t first;
+	uint16_t count;
+
+	//!	Entry of the inbound packet being processed, plus one.
+	uint16_t current;
+
+	fasthash_hash_t seed;
+
+#if NYOCI_CONF_DUPE_RESPONSE_CACHE_SIZE
+	/*!	Piggybacked responses are appended to this ring of bytes.
+	**	Positions count every byte ever written, so a response is
+	**	still intact as long as `response_pos` is no more than the
+	**	size of the ring behind `response_write_pos`. A response
+	**	is never split across the end of the ring. */
+	uint8_t responses[NYOCI_CONF_DUPE_RESPONSE_CACHE_SIZE];
+	uint32_t response_write_pos;
 #endif
+
+	struct nyoci_dupe_stats_s stats;
 };
 
 bool nyoci_inbound_dupe_check(void);
 
+//!	Remembers `packet` if it is the piggybacked response to the
+//!	current inbound request.
+void nyoci_dupe_remember_response(const struct coap_header_s* packet, coap_size_t packet_len);
+
+//!	Resends the response remembered for the current inbound packet.
+/*!	Returns false if there isn't one. */
+bool nyoci_dupe_replay_response(void);
+
 NYOCI_END_C_DECLS
 
 #endif
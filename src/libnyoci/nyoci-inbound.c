@@ -361,6 +361,17 @@ nyoci_inbound_packet_process(
 
 	if (!(self->inbound.flags & NYOCI_INBOUND_FLAG_FAKE) && nyoci_inbound_dupe_check()) {
 		self->inbound.flags |= NYOCI_INBOUND_FLAG_DUPE;
+
+		if ( (packet->tt == COAP_TRANS_TYPE_CONFIRMABLE)
+		  && COAP_CODE_IS_REQUEST(packet->code)
+		  && nyoci_dupe_replay_response()
+		) {
+			// We sent the exact same response as last time, so
+			// there is no need to bother the request handler.
+			self->did_respond = true;
+			ret = NYOCI_STATUS_OK;
+			goto bail;
+		}
 	}
 
 	{	// Initial scan thru all of the options.
@@ -33,6 +33,7 @@
 #include "libnyoci.h"
 #include "string-utils.h"
 #include "nyoci-dupe.h"
+#include "nyoci-peer.h"
 #include "nyoci-plat-net-internal.h"
 
 #ifndef VERBOSE_DEBUG
@@ -75,6 +76,104 @@ struct nyoci_vhost_s {
 };
 #endif
 
+//!	Transactions handed out by nyoci_transaction_init() when it is
+//!	not given one.
+struct nyoci_transaction_slab_s {
+	nyoci_transaction_t		free_list;
+#if NYOCI_AVOID_MALLOC
+#if NYOCI_TRANSACTION_POOL_SIZE
+	struct nyoci_transaction_s pool[NYOCI_TRANSACTION_POOL_SIZE];
+#endif
+#else
+	struct nyoci_transaction_chunk_s* chunks;
+#endif
+	struct nyoci_transaction_slab_stats_s stats;
+};
+
+struct nyoci_observer_s {
+	struct nyoci_observable_s *observable;
+	uint32_t link;		// index of this observer, +1
+	uint32_t prev;		// always n+1, zero is start of list
+	uint32_t next;		// always n+1, zero is end of list. Also links free observers.
+	uint32_t hash_next;	// always n+1, next observer in the same hash bucket
+	uint32_t hash;
+	uint32_t seq;
+	uint32_t generation;	// Value of the registry generation when last triggered
+	uint16_t key;
+	bool on_hold:1;   // Set when we are waiting for a response to a CON
+	bool in_use:1;
+	bool render_each:1;	// Never share a rendered notification with this observer
+	bool dirty:1;		// A notification is being held back, see notify_observer()
+	bool confirm:1;		// The policy asked for the current notification to be CON
+	uint8_t ack_history;	// See nyoci_observer_link_s
+	uint8_t ack_count;
+	uint32_t since_con;
+	nyoci_cms_t srtt;
+	nyoci_cms_t rttvar;
+	nyoci_timestamp_t last_con;
+	nyoci_timestamp_t con_started;	// First transmission of the current CON
+	uint8_t con_transmissions;
+	uint8_t pending_flags;	// Trigger flags for the held back notification
+	nyoci_timestamp_t last_notify;
+	struct nyoci_timer_s flush_timer;
+	struct nyoci_async_response_s async_response;
+	struct nyoci_transaction_s transaction;
+};
+
+#if NYOCI_CONF_OBSERVER_FANOUT
+//!	A notification the request handler rendered for an observer.
+/*!	Other observers of the same resource that were triggered at the
+**	same time are sent copies of it, with their own token, message id,
+**	type and Observe value, instead of rendering it again. */
+struct nyoci_observer_fanout_s {
+	uint32_t				source;		// Link of the observer it was rendered for, zero if none
+	uint32_t				generation;
+
+	coap_code_t				code;
+	coap_option_key_t		last_option_key;
+
+	//!	Where the Observe option sits in `bytes`, and the key of the
+	//!	option before it, so the value can be re-encoded in place.
+	coap_size_t				observe_start;
+	coap_size_t				observe_end;
+	coap_option_key_t		observe_prev_key;
+
+	//!	`bytes` holds the options, then the content.
+	coap_size_t				options_len;
+	coap_size_t				content_len;
+	uint8_t					bytes[NYOCI_MAX_PACKET_LENGTH];
+};
+#endif
+
+//!	The observers of an instance, see nyoci-observable.c.
+struct nyoci_observer_registry_s {
+#if NYOCI_AVOID_MALLOC
+	struct nyoci_observer_s	observer[NYOCI_MAX_OBSERVERS];
+	uint32_t				bucket_storage[NYOCI_MAX_OBSERVERS];
+#else
+	struct nyoci_observer_s** chunk;
+	uint32_t				chunk_count;
+	uint32_t				chunk_capacity;
+#endif
+
+	//!	Hash of (observable, key, remote, token), for finding the
+	//!	observer a request refers to. Entries are links.
+	uint32_t*				bucket;
+	uint32_t				bucket_count;
+
+	uint32_t				capacity;
+	uint32_t				count;
+	uint32_t				free_list;	// always n+1
+
+	//!	Incremented every time observers are triggered.
+	uint32_t				generation;
+
+#if NYOCI_CONF_OBSERVER_FANOUT
+	struct nyoci_observer_fanout_s fanout[NYOCI_CONF_OBSERVER_FANOUT];
+	uint8_t					fanout_next;	// Entry to replace next
+#endif
+};
+
 // Consider members of this struct to be private!
 struct nyoci_s {
 	nyoci_request_handler_func	request_handler;
@@ -82,10 +181,40 @@ struct nyoci_s {
 
 	struct nyoci_plat_s		plat;
 
+#if NYOCI_TIMERS_USE_HEAP
+	//!	4-ary min-heap of scheduled timers, ordered by fire date.
+	nyoci_timer_t*			timer_heap;
+	uint32_t				timer_count;
+	uint32_t				timer_capacity;
+
+	//!	Bumped on every schedule, so equal deadlines fire in order.
+	uint32_t				timer_sequence;
+#else
 	nyoci_timer_t			timers;
+#endif
+	int						timer_budget;
+
+	//!	See nyoci_set_rto_bounds().
+	nyoci_cms_t				rto_min;
+	nyoci_cms_t				rto_max;
+#if NYOCI_CONF_TIMER_STATS
+	struct nyoci_timer_stats_s timer_stats;
+#endif
+
+	//!	Commands posted from other threads, most recent first.
+	nyoci_command_t			command_queue;
 
 	nyoci_transaction_t		transactions;
 	nyoci_transaction_t		current_transaction;
+	struct nyoci_transaction_slab_s transaction_slab;
+	struct nyoci_observer_registry_s observers;
+
+#if NYOCI_TRANSACTIONS_USE_TOKEN_HASH
+	//!	Open-addressing hash table of active transactions, keyed by token.
+	nyoci_transaction_t*	token_table;
+	uint32_t				token_table_size;
+	uint32_t				token_table_count;
+#endif
 
 	// Operational Flags
 	uint8_t					is_responding:1,
@@ -98,6 +227,12 @@ struct nyoci_s {
 
 	coap_msg_id_t			last_msg_id;
 
+	//!	Request tokens are derived from this counter, see
+	//!	nyoci_transaction_begin().
+	uint64_t				token_counter;
+	uint64_t				token_salt;
+	uint8_t					token_len;
+
 	//! Inbound packet variables.
 	struct {
 		const struct coap_header_s*	packet;
@@ -134,6 +269,14 @@ struct nyoci_s {
 
 	struct nyoci_dupe_info_s dupe_info;
 
+#if NYOCI_CONF_MAX_PEERS
+	struct nyoci_peer_info_s peer_info;
+	struct nyoci_nstart_stats_s nstart_stats;
+#endif
+
+	//!	See nyoci_set_nstart().
+	uint8_t					nstart;
+
 	const char* proxy_url;
 
 #if NYOCI_CONF_ENABLE_VHOSTS
@@ -160,6 +303,34 @@ NYOCI_INTERNAL_EXTERN nyoci_status_t nyoci_outbound_set_var_content_int(int v);
 NYOCI_INTERNAL_EXTERN nyoci_status_t nyoci_outbound_set_var_content_unsigned_int(unsigned int v);
 NYOCI_INTERNAL_EXTERN nyoci_status_t nyoci_outbound_set_var_content_unsigned_long_int(unsigned long int v);
 
+//!	Records that `transaction` is being sent to `remote` in a message
+//!	with id `msg_id`, and returns the message id that should be used
+//!	instead.
+NYOCI_INTERNAL_EXTERN coap_msg_id_t nyoci_internal_transaction_bind_remote(
+	nyoci_t self,
+	nyoci_transaction_t transaction,
+	const nyoci_sockaddr_t* remote,
+	coap_msg_id_t msg_id
+);
+
+//!	Keeps a copy of `packet` if it was sent for `transaction` and the
+//!	transaction has `NYOCI_TRANSACTION_CACHE_PACKET` set.
+NYOCI_INTERNAL_EXTERN void nyoci_internal_transaction_cache_packet(
+	nyoci_t self,
+	nyoci_transaction_t transaction,
+	const struct coap_header_s* packet,
+	coap_size_t packet_len
+);
+
+//!	Frees the memory of the transaction slab of `self`.
+NYOCI_INTERNAL_EXTERN void nyoci_internal_transaction_slab_finalize(nyoci_t self);
+
+//!	Frees the memory of the observer table of `self`.
+NYOCI_INTERNAL_EXTERN void nyoci_internal_observer_finalize(nyoci_t self);
+
+//!	Returns the message id that follows `msg_id` in a counter's sequence.
+NYOCI_INTERNAL_EXTERN coap_msg_id_t nyoci_msg_id_step(coap_msg_id_t msg_id);
+
 #if NYOCI_CONF_ENABLE_VHOSTS
 NYOCI_INTERNAL_EXTERN nyoci_status_t nyoci_vhost_route(nyoci_request_handler_func* func, void** context);
 #endif
@@ -34,103 +34,342 @@
 #include "nyoci-internal.h"
 #include "nyoci-logging.h"
 
-#define INVALID_OBSERVER_INDEX		(NYOCI_MAX_OBSERVERS)
+#include "fasthash.h"
 
-#if NYOCI_MAX_OBSERVERS > 127
-#error "NYOCI_MAX_OBSERVERS must be set below 127"
+#define SHOULD_CONFIRM_EVENT_FOR_OBSERVER(obs)		should_confirm_event_for_observer(obs)
+
+static void observer_flush_(nyoci_t self, struct nyoci_observer_s* observer);
+
+static bool
+should_confirm_event_for_observer(const struct nyoci_observer_s* obs) {
+	return obs->on_hold || obs->confirm;
+}
+
+// MARK: -
+// MARK: Observer Table
+
+static struct nyoci_observer_registry_s*
+observer_registry(nyoci_t interface) {
+#if NYOCI_SINGLETON
+	(void)interface;
+	return &nyoci_get_current_instance()->observers;
+#else
+	return &interface->observers;
 #endif
+}
 
-#define SHOULD_CONFIRM_EVENT_FOR_OBSERVER(obs)		should_confirm_event_for_observer(obs)
+static nyoci_t
+observer_interface(const struct nyoci_observer_s* observer) {
+#if NYOCI_SINGLETON
+	return nyoci_get_current_instance();
+#else
+	return observer->observable->interface;
+#endif
+}
 
-struct nyoci_observer_s {
-	/**** All of this is private. Don't touch. ****/
+//!	Returns the observer that `link` refers to, or NULL if it is zero.
+static struct nyoci_observer_s*
+observer_from_link(const struct nyoci_observer_registry_s* registry, uint32_t link) {
+	if (link == 0) {
+		return NULL;
+	}
 
-	struct nyoci_observable_s *observable;
-	int8_t next;	// always n+1, zero is end of list
-	uint8_t key;
-	bool on_hold:1;   // Set when we are waiting for a response to a CON
-	uint32_t seq;
-	struct nyoci_async_response_s async_response;
-	struct nyoci_transaction_s transaction;
-};
+	link--;
 
-// TODO: We really need to move the observer table into the nyoci_t instance.
-// Note that this doesn't really matter for embedded systems, but on
-// multi-threaded systems with multiple nyoci instances, this is going to
-// fail.
-static struct nyoci_observer_s observer_table[NYOCI_MAX_OBSERVERS];
+#if NYOCI_AVOID_MALLOC
+	return (struct nyoci_observer_s*)&registry->observer[link];
+#else
+	return &registry->chunk[link / NYOCI_CONF_OBSERVER_CHUNK_SIZE][link % NYOCI_CONF_OBSERVER_CHUNK_SIZE];
+#endif
+}
 
-static bool
-should_confirm_event_for_observer(const struct nyoci_observer_s* obs) {
-	return obs->on_hold || !((obs)->seq&0x7);
+//!	Hashes the observable, key and the remote and token of the
+//!	current inbound request.
+static uint32_t
+observer_hash(nyoci_observable_t context, uint16_t key) {
+	const nyoci_sockaddr_t* const remote = nyoci_plat_get_remote_sockaddr();
+	const struct coap_header_s* const packet = nyoci_inbound_get_packet();
+	struct fasthash_state_s fasthash;
+
+	fasthash_start(&fasthash, 0);
+	fasthash_feed(&fasthash, (const uint8_t*)&context, sizeof(context));
+	fasthash_feed(&fasthash, (const uint8_t*)&key, sizeof(key));
+	fasthash_feed(&fasthash, (const uint8_t*)&remote->nyoci_addr, sizeof(nyoci_addr_t));
+	fasthash_feed(&fasthash, (const uint8_t*)&remote->nyoci_port, sizeof(remote->nyoci_port));
+	fasthash_feed(&fasthash, packet->token, packet->token_len);
+
+	return fasthash_finish_uint32(&fasthash);
 }
 
-static int8_t
-get_unused_observer_index() {
-	int8_t ret = 0;
-	for (; ret < NYOCI_MAX_OBSERVERS; ret++) {
-		const struct nyoci_observer_s * const obs = &observer_table[ret];
-		if ( obs->async_response.request_len == 0
-		  && obs->next == 0
-		  && obs->transaction.active == 0
-		) {
-			break;
+static void
+observer_hash_insert(struct nyoci_observer_registry_s* registry, struct nyoci_observer_s* observer) {
+	uint32_t* const bucket = &registry->bucket[observer->hash % registry->bucket_count];
+
+	observer->hash_next = *bucket;
+	*bucket = observer->link;
+}
+
+static void
+observer_hash_remove(struct nyoci_observer_registry_s* registry, struct nyoci_observer_s* observer) {
+	uint32_t* iter = &registry->bucket[observer->hash % registry->bucket_count];
+
+	while (*iter != observer->link) {
+		assert(*iter != 0);
+		iter = &observer_from_link(registry, *iter)->hash_next;
+	}
+
+	*iter = observer->hash_next;
+	observer->hash_next = 0;
+}
+
+#if !NYOCI_AVOID_MALLOC
+//!	Resizes the hash to have at least as many buckets as observers.
+static nyoci_status_t
+observer_hash_resize(struct nyoci_observer_registry_s* registry) {
+	uint32_t bucket_count = registry->bucket_count ? registry->bucket_count : 16;
+	uint32_t* bucket;
+	uint32_t link;
+
+	while (bucket_count < registry->capacity) {
+		bucket_count *= 2;
+	}
+
+	if (bucket_count == registry->bucket_count) {
+		return NYOCI_STATUS_OK;
+	}
+
+	bucket = calloc(bucket_count, sizeof(*bucket));
+
+	if (bucket == NULL) {
+		return NYOCI_STATUS_MALLOC_FAILURE;
+	}
+
+	free(registry->bucket);
+	registry->bucket = bucket;
+	registry->bucket_count = bucket_count;
+
+	for (link = 1; link <= registry->capacity; link++) {
+		struct nyoci_observer_s* const observer = observer_from_link(registry, link);
+
+		if (observer->in_use) {
+			observer_hash_insert(registry, observer);
 		}
 	}
-	if (ret == NYOCI_MAX_OBSERVERS) {
-		ret = -1;
+
+	return NYOCI_STATUS_OK;
+}
+#endif
+
+//!	Adds room for at least `count` observers to the free list.
+static nyoci_status_t
+observer_registry_grow(struct nyoci_observer_registry_s* registry, uint32_t count) {
+	nyoci_status_t ret = NYOCI_STATUS_OK;
+	uint32_t const capacity = registry->capacity;
+	uint32_t link;
+
+	require_action(
+		registry->capacity < NYOCI_MAX_OBSERVERS,
+		bail,
+		ret = NYOCI_STATUS_MALLOC_FAILURE
+	);
+
+#if NYOCI_AVOID_MALLOC
+	registry->bucket = registry->bucket_storage;
+	registry->bucket_count = NYOCI_MAX_OBSERVERS;
+	registry->capacity = NYOCI_MAX_OBSERVERS;
+	(void)count;
+	(void)capacity;
+#else
+	do {
+		struct nyoci_observer_s* chunk;
+
+		if (registry->chunk_count == registry->chunk_capacity) {
+			uint32_t chunk_capacity = registry->chunk_capacity ? registry->chunk_capacity * 2 : 4;
+			struct nyoci_observer_s** chunks = realloc(
+				registry->chunk,
+				chunk_capacity * sizeof(*chunks)
+			);
+
+			require_action(chunks != NULL, bail, ret = NYOCI_STATUS_MALLOC_FAILURE);
+
+			registry->chunk = chunks;
+			registry->chunk_capacity = chunk_capacity;
+		}
+
+		chunk = calloc(NYOCI_CONF_OBSERVER_CHUNK_SIZE, sizeof(*chunk));
+		require_action(chunk != NULL, bail, ret = NYOCI_STATUS_MALLOC_FAILURE);
+
+		registry->chunk[registry->chunk_count++] = chunk;
+		registry->capacity += NYOCI_CONF_OBSERVER_CHUNK_SIZE;
+	} while (count > registry->capacity - capacity);
+
+	ret = observer_hash_resize(registry);
+	require_noerr(ret, bail);
+#endif
+
+	// Only the new observers have no link yet. Push them in reverse,
+	// so that they are handed out in order.
+	for (link = registry->capacity; link > 0; link--) {
+		struct nyoci_observer_s* const observer = observer_from_link(registry, link);
+
+		if (observer->link != 0) {
+			break;
+		}
+
+		observer->link = link;
+		observer->next = registry->free_list;
+		registry->free_list = link;
 	}
+
+bail:
 	return ret;
 }
 
+static struct nyoci_observer_s*
+alloc_observer(struct nyoci_observer_registry_s* registry) {
+	struct nyoci_observer_s* observer = NULL;
+	uint32_t link;
+
+	require_quiet(registry->count < NYOCI_MAX_OBSERVERS, bail);
+
+	if (registry->free_list == 0) {
+		require_noerr(observer_registry_grow(registry, 1), bail);
+	}
+
+	link = registry->free_list;
+	observer = observer_from_link(registry, link);
+	registry->free_list = observer->next;
+
+	memset(observer, 0, sizeof(*observer));
+	observer->link = link;
+	observer->in_use = true;
+	nyoci_timer_init(
+		&observer->flush_timer,
+		(nyoci_timer_callback_t)&observer_flush_,
+		NULL,
+		observer
+	);
+	registry->count++;
+
+bail:
+	return observer;
+}
+
 static void
 free_observer(struct nyoci_observer_s *observer)
 {
 	nyoci_observable_t const context = observer->observable;
-	int8_t i = (int8_t)(observer - observer_table);
+	nyoci_t interface;
+	struct nyoci_observer_registry_s* registry;
+	struct nyoci_observer_s* neighbor;
 
-#if !NYOCI_SINGLETON
-	if (!observer->observable) {
+	if (!observer->in_use) {
 		goto bail;
 	}
-	nyoci_t const interface = observer->observable->interface;
-#endif
 
-	nyoci_transaction_end(interface, &observer->transaction);
+	interface = observer_interface(observer);
+	registry = observer_registry(interface);
 
-	if ((context->first_observer==i+1) && (context->last_observer==i+1)) {
-		context->first_observer = context->last_observer = 0;
+	if (observer->transaction.active) {
+		nyoci_transaction_end(interface, &observer->transaction);
+	}
 
-	} else if (context->first_observer == i+1) {
-		context->first_observer = observer_table[i].next;
+	nyoci_invalidate_timer(interface, &observer->flush_timer);
+	observer->dirty = false;
 
+	if ((neighbor = observer_from_link(registry, observer->prev)) != NULL) {
+		neighbor->next = observer->next;
 	} else {
-		int8_t prev;
-		for (prev = context->first_observer-1; prev>=0; i = observer_table[i].next - 1) {
-			if (observer_table[prev].next == i) {
-				break;
-			}
-		}
+		context->first_observer = observer->next;
+	}
 
-		observer_table[prev].next = observer_table[i].next;
+	if ((neighbor = observer_from_link(registry, observer->next)) != NULL) {
+		neighbor->prev = observer->prev;
+	} else {
+		context->last_observer = observer->prev;
+	}
+
+	observer_hash_remove(registry, observer);
+	nyoci_finish_async_response(&observer->async_response);
 
-		if (context->last_observer == i+1) {
-			context->last_observer = prev;
+#if NYOCI_CONF_OBSERVER_FANOUT
+	{
+		int i;
+		for (i = 0; i < NYOCI_CONF_OBSERVER_FANOUT; i++) {
+			if (registry->fanout[i].source == observer->link) {
+				registry->fanout[i].source = 0;
+			}
 		}
 	}
+#endif
 
-bail:
 	observer->observable = NULL;
-	observer->next = 0;
-	nyoci_finish_async_response(&observer->async_response);
+	observer->in_use = false;
+	observer->prev = 0;
+	observer->next = registry->free_list;
+	registry->free_list = observer->link;
+	registry->count--;
+
+bail:
 	return;
 }
 
 nyoci_status_t
-nyoci_observable_update(nyoci_observable_t context, uint8_t key) {
+nyoci_observer_reserve(nyoci_t interface, uint32_t count)
+{
+	struct nyoci_observer_registry_s* const registry = observer_registry(interface);
+	uint32_t const available = registry->capacity - registry->count;
+
+	if (available >= count) {
+		return NYOCI_STATUS_OK;
+	}
+
+	if (registry->count + count > NYOCI_MAX_OBSERVERS) {
+		return NYOCI_STATUS_MALLOC_FAILURE;
+	}
+
+	return observer_registry_grow(registry, count - available);
+}
+
+void
+nyoci_internal_observer_finalize(nyoci_t self)
+{
+#if !NYOCI_AVOID_MALLOC
+	struct nyoci_observer_registry_s* const registry = &self->observers;
+
+	while (registry->chunk_count > 0) {
+		free(registry->chunk[--registry->chunk_count]);
+	}
+
+	free(registry->chunk);
+	free(registry->bucket);
+	memset(registry, 0, sizeof(*registry));
+#endif
+}
+
+// MARK: -
+
+//!	See `NYOCI_CONF_OBSERVABLE_LEGACY_BROADCAST_KEY`.
+static uint16_t
+observable_key(uint16_t key)
+{
+#if NYOCI_CONF_OBSERVABLE_LEGACY_BROADCAST_KEY
+	if (key == 0xFF) {
+		return NYOCI_OBSERVABLE_BROADCAST_KEY;
+	}
+#endif
+	return key;
+}
+
+nyoci_status_t
+nyoci_observable_update(nyoci_observable_t context, uint16_t key) {
 	nyoci_status_t ret = NYOCI_STATUS_OK;
 	nyoci_t const interface = nyoci_get_current_instance();
-	int8_t i;
+	struct nyoci_observer_registry_s* const registry = observer_registry(interface);
+	struct nyoci_observer_s* observer = NULL;
+	uint32_t hash;
+
+	key = observable_key(key);
 
 #if !NYOCI_SINGLETON
 	context->interface = interface;
@@ -143,64 +382,253 @@ nyoci_observable_update(nyoci_observable_t context, uint8_t key) {
 		goto bail;
 	}
 
-	for (i = context->first_observer-1; i >= 0; i = observer_table[i].next - 1) {
-		assert(observer_table[i].observable == context);
-		if (observer_table[i].key != key) {
-			continue;
-		}
-		if (nyoci_inbound_is_related_to_async_response(&observer_table[i].async_response)) {
-			break;
+	hash = observer_hash(context, key);
+
+	if (registry->bucket_count != 0) {
+		uint32_t link = registry->bucket[hash % registry->bucket_count];
+
+		for (; (observer = observer_from_link(registry, link)) != NULL; link = observer->hash_next) {
+			if ( (observer->hash == hash)
+			  && (observer->observable == context)
+			  && (observer->key == key)
+			  && nyoci_inbound_is_related_to_async_response(&observer->async_response)
+			) {
+				break;
+			}
 		}
 	}
 
 	if (interface->inbound.flags & NYOCI_INBOUND_FLAG_HAS_OBSERVE) {
-		if (i == -1) {
-			i = get_unused_observer_index();
+		if (observer == NULL) {
+			observer = alloc_observer(registry);
 
-			if (i == -1) {
+			if (observer == NULL) {
 				goto bail;
 			}
 
+			observer->prev = context->last_observer;
+
 			if (context->last_observer == 0) {
-				context->first_observer = context->last_observer = i + 1;
+				context->first_observer = observer->link;
 			} else {
-				observer_table[context->last_observer-1].next = i +1;
-				context->last_observer = i + 1;
+				observer_from_link(registry, context->last_observer)->next = observer->link;
 			}
+			context->last_observer = observer->link;
 
-			observer_table[i].key = key;
-			observer_table[i].seq = 0;
-			observer_table[i].observable = context;
-			observer_table[i].on_hold = false;
+			observer->key = key;
+			observer->hash = hash;
+			observer->observable = context;
+			observer_hash_insert(registry, observer);
 		}
 
 		require_noerr_action(
 			ret = nyoci_start_async_response(
-				&observer_table[i].async_response,
+				&observer->async_response,
 				NYOCI_ASYNC_RESPONSE_FLAG_DONT_ACK
 			),
 			bail,
-			free_observer(&observer_table[i])
+			free_observer(observer)
 		);
 
 		require_noerr_action(
-			ret = nyoci_outbound_add_option_uint(COAP_OPTION_OBSERVE, observer_table[i].seq),
+			ret = nyoci_outbound_add_option_uint(COAP_OPTION_OBSERVE, observer->seq),
 			bail,
-			free_observer(&observer_table[i])
+			free_observer(observer)
 		);
 
-	} else if (i != -1) {
-		free_observer(&observer_table[i]);
+		// This response carries the latest state, so anything that
+		// was being held back for this observer is moot.
+		nyoci_invalidate_timer(interface, &observer->flush_timer);
+		observer->dirty = false;
+		observer->last_notify = nyoci_plat_cms_to_timestamp(0);
+
+		if (observer->ack_count == 0) {
+			observer->last_con = observer->last_notify;
+		}
+
+	} else if (observer != NULL) {
+		free_observer(observer);
 	}
 
 bail:
 	return ret;
 }
 
+// MARK: -
+// MARK: Confirmation Policy
+
+bool
+nyoci_observer_default_policy(const struct nyoci_observer_link_s* link, void* context)
+{
+	uint32_t interval = NYOCI_OBSERVER_CON_INTERVAL;
+	uint8_t streak = 0;
+	uint8_t i;
+
+	(void)context;
+
+	if (link->since_con_ms >= NYOCI_OBSERVATION_KEEPALIVE_INTERVAL) {
+		return true;
+	}
+
+	while ((streak < link->ack_count) && (link->ack_history & (1 << streak))) {
+		streak++;
+	}
+
+	for (i = streak; i < link->ack_count; i++) {
+		if (!(link->ack_history & (1 << i))) {
+			interval /= 2;
+		}
+	}
+
+	// Round trips that vary this much usually mean queues are building up.
+	if ((link->srtt > 0) && (link->rttvar * 2 > link->srtt)) {
+		interval /= 2;
+	}
+
+	if (streak == link->ack_count) {
+		interval <<= streak / 2;
+	}
+
+	if (interval < NYOCI_OBSERVER_CON_INTERVAL_MIN) {
+		interval = NYOCI_OBSERVER_CON_INTERVAL_MIN;
+	} else if (interval > NYOCI_OBSERVER_CON_INTERVAL_MAX) {
+		interval = NYOCI_OBSERVER_CON_INTERVAL_MAX;
+	}
+
+	return link->since_con + 1 >= interval;
+}
+
+void
+nyoci_observable_set_policy(
+	nyoci_observable_t context,
+	nyoci_observer_policy_func policy,
+	void* policy_context
+) {
+	context->policy = policy;
+	context->policy_context = policy_context;
+}
+
+//!	Decides whether the notification about to be sent is CON.
+static void
+observer_decide_confirm(struct nyoci_observer_s* observer, bool force_con)
+{
+	nyoci_observable_t const context = observer->observable;
+	nyoci_timestamp_t const now = nyoci_plat_cms_to_timestamp(0);
+	struct nyoci_observer_link_s link;
+
+	if (!force_con && !observer->on_hold) {
+		link.since_con = observer->since_con;
+		link.since_con_ms = nyoci_plat_timestamp_diff(now, observer->last_con);
+		link.ack_history = observer->ack_history;
+		link.ack_count = observer->ack_count;
+		link.srtt = observer->srtt;
+		link.rttvar = observer->rttvar;
+
+		if (context->policy != NULL) {
+			observer->confirm = (*context->policy)(&link, context->policy_context);
+		} else {
+			observer->confirm = nyoci_observer_default_policy(&link, NULL);
+		}
+	} else {
+		observer->confirm = true;
+	}
+
+	if (!observer->on_hold) {
+		observer->con_transmissions = 0;
+	}
+
+	if (observer->confirm) {
+		observer->since_con = 0;
+		observer->last_con = now;
+	} else if (observer->since_con < UINT32_MAX) {
+		observer->since_con++;
+	}
+}
+
+//!	Records the acknowledgement of a CON notification.
+static void
+observer_record_ack(struct nyoci_observer_s* observer)
+{
+	bool const first_try = (observer->con_transmissions <= 1);
+
+	observer->ack_history = (uint8_t)((observer->ack_history << 1) | first_try);
+
+	if (observer->ack_count < 8) {
+		observer->ack_count++;
+	}
+
+	// Only unambiguous samples, as in RFC6298.
+	if (observer->con_transmissions == 1) {
+		nyoci_cms_t rtt = nyoci_plat_timestamp_diff(
+			nyoci_plat_cms_to_timestamp(0),
+			observer->con_started
+		);
+
+		if (rtt < 1) {
+			rtt = 1;
+		}
+
+		if (observer->srtt == 0) {
+			observer->srtt = rtt;
+			observer->rttvar = rtt / 2;
+		} else {
+			nyoci_cms_t const delta = (observer->srtt > rtt) ? observer->srtt - rtt : rtt - observer->srtt;
+
+			observer->rttvar = (3 * observer->rttvar + delta) / 4;
+			observer->srtt = (7 * observer->srtt + rtt) / 8;
+		}
+	}
+}
+
+// MARK: -
+// MARK: Conflation
+
+//!	Returns how many milliseconds `observer` has to wait before it can
+//!	be sent another notification, or -1 if it is waiting for the
+//!	acknowledgement of a confirmable one.
+static nyoci_cms_t
+observer_wait_time(const struct nyoci_observer_s* observer)
+{
+	nyoci_cms_t const min_interval = observer->observable->min_interval;
+
+	if (observer->on_hold && observer->transaction.active) {
+		return -1;
+	}
+
+	if (min_interval > 0) {
+		nyoci_cms_t const elapsed = nyoci_plat_timestamp_diff(
+			nyoci_plat_cms_to_timestamp(0),
+			observer->last_notify
+		);
+
+		if (elapsed < min_interval) {
+			return min_interval - elapsed;
+		}
+	}
+
+	return 0;
+}
+
+//!	Arranges for the held back notification of `observer` to be sent
+//!	as soon as it is allowed to.
+static void
+observer_schedule_flush(nyoci_t interface, struct nyoci_observer_s* observer)
+{
+	nyoci_cms_t const wait = observer_wait_time(observer);
+
+	if (wait >= 0) {
+		nyoci_invalidate_timer(interface, &observer->flush_timer);
+		nyoci_schedule_timer(interface, &observer->flush_timer, wait);
+	}
+}
+
 static nyoci_status_t
 event_response_handler(int statuscode, struct nyoci_observer_s* observer)
 {
 	if (statuscode >= 0) {
+		if (observer->on_hold) {
+			observer_record_ack(observer);
+		}
 		observer->on_hold = false;
 	}
 
@@ -227,20 +655,211 @@ event_response_handler(int statuscode, struct nyoci_observer_s* observer)
 		return NYOCI_STATUS_RESET;
 	}
 
+	if (observer->dirty) {
+		// We can't start the next notification from inside the
+		// callback of this one.
+		observer_schedule_flush(observer_interface(observer), observer);
+	}
+
 	return NYOCI_STATUS_OK;
 }
 
+// MARK: -
+// MARK: Fan-out
+
+#if NYOCI_CONF_OBSERVER_FANOUT
+//!	Returns true if `fanout` can be sent to `observer`.
+static bool
+observer_fanout_matches_(
+	nyoci_t self,
+	const struct nyoci_observer_fanout_s* fanout,
+	const struct nyoci_observer_s* observer
+) {
+	const struct nyoci_observer_s* const source = observer_from_link(observer_registry(self), fanout->source);
+	const struct coap_header_s* a;
+	const struct coap_header_s* b;
+	coap_size_t options_len;
+
+	if ( (source == NULL)
+	  || (fanout->generation != observer->generation)
+	  || (source->observable != observer->observable)
+	  || (source->key != observer->key)
+	) {
+		return false;
+	}
+
+	// The requests may only differ in their message id and token,
+	// otherwise options like Accept or Uri-Query could tell them apart.
+	a = &source->async_response.request.header;
+	b = &observer->async_response.request.header;
+	options_len = source->async_response.request_len - a->token_len;
+
+	if ( (a->code != b->code)
+	  || (options_len != observer->async_response.request_len - b->token_len)
+	  || (0 != memcmp(
+			a->token + a->token_len,
+			b->token + b->token_len,
+			options_len - sizeof(struct coap_header_s)
+		))
+	) {
+		return false;
+	}
+
+	// Room for our token, the largest Observe option and the
+	// end-of-options marker.
+	return sizeof(struct coap_header_s) + b->token_len
+		+ fanout->options_len + fanout->content_len + 8
+		<= self->outbound.max_packet_len;
+}
+
+//!	Returns the cached notification that can be sent to `observer`, if any.
+static const struct nyoci_observer_fanout_s*
+observer_fanout_lookup(nyoci_t self, const struct nyoci_observer_s* observer)
+{
+	const struct nyoci_observer_registry_s* const registry = observer_registry(self);
+	int i;
+
+	if (observer->render_each) {
+		return NULL;
+	}
+
+	for (i = 0; i < NYOCI_CONF_OBSERVER_FANOUT; i++) {
+		if (observer_fanout_matches_(self, &registry->fanout[i], observer)) {
+			return &registry->fanout[i];
+		}
+	}
+
+	return NULL;
+}
+
+//!	Fills in the options and content of the outbound packet from
+//!	`fanout`, with the Observe value of `observer`.
+static void
+observer_fanout_stamp(
+	nyoci_t self,
+	const struct nyoci_observer_fanout_s* fanout,
+	const struct nyoci_observer_s* observer
+) {
+	uint8_t* ptr = (uint8_t*)self->outbound.packet->token + self->outbound.packet->token_len;
+	uint32_t const seq = htonl(observer->seq);
+	const uint8_t* value = (const uint8_t*)&seq;
+	coap_size_t value_len = sizeof(seq);
+
+	while ((value_len > 0) && (*value == 0)) {
+		value++;
+		value_len--;
+	}
+
+	self->outbound.packet->code = fanout->code;
+
+	memcpy(ptr, fanout->bytes, fanout->observe_start);
+	ptr += fanout->observe_start;
+
+	ptr = coap_encode_option(ptr, fanout->observe_prev_key, COAP_OPTION_OBSERVE, value, value_len);
+
+	memcpy(ptr, fanout->bytes + fanout->observe_end, fanout->options_len - fanout->observe_end);
+	ptr += fanout->options_len - fanout->observe_end;
+
+	*ptr++ = 0xFF;  // End-of-options marker
+
+	memcpy(ptr, fanout->bytes + fanout->options_len, fanout->content_len);
+
+	self->outbound.content_ptr = (char*)ptr;
+	self->outbound.content_len = fanout->content_len;
+	self->outbound.last_option_key = fanout->last_option_key;
+}
+
+//!	Remembers the notification that was just sent to `observer`.
+static void
+observer_fanout_capture(nyoci_t self, const struct nyoci_observer_s* observer)
+{
+	struct nyoci_observer_registry_s* const registry = observer_registry(self);
+	struct nyoci_observer_fanout_s* fanout = NULL;
+	const uint8_t* const start = (const uint8_t*)self->outbound.packet->token + self->outbound.packet->token_len;
+	const uint8_t* const end = (const uint8_t*)self->outbound.content_ptr - 1;
+	const uint8_t* iter = start;
+	coap_option_key_t key = 0;
+	bool has_observe = false;
+	int i;
+
+	// Prefer an entry that is empty or from an earlier trigger.
+	for (i = 0; i < NYOCI_CONF_OBSERVER_FANOUT; i++) {
+		if ( (registry->fanout[i].source == 0)
+		  || (registry->fanout[i].generation != observer->generation)
+		) {
+			fanout = &registry->fanout[i];
+			break;
+		}
+	}
+
+	if (fanout == NULL) {
+		fanout = &registry->fanout[registry->fanout_next];
+		registry->fanout_next = (registry->fanout_next + 1) % NYOCI_CONF_OBSERVER_FANOUT;
+	}
+
+	fanout->source = 0;
+
+	require_quiet(end > start, bail);
+
+	while (iter < end) {
+		const uint8_t* const option = iter;
+		coap_option_key_t const prev_key = key;
+
+		iter = coap_decode_option(iter, &key, NULL, NULL);
+		require_quiet(iter != NULL, bail);
+
+		if (key == COAP_OPTION_OBSERVE) {
+			fanout->observe_start = (coap_size_t)(option - start);
+			fanout->observe_end = (coap_size_t)(iter - start);
+			fanout->observe_prev_key = prev_key;
+			has_observe = true;
+		}
+	}
+
+	require_quiet(has_observe, bail);
+
+	fanout->options_len = (coap_size_t)(end - start);
+	fanout->content_len = self->outbound.content_len;
+
+	require_quiet(fanout->options_len + fanout->content_len <= sizeof(fanout->bytes), bail);
+
+	memcpy(fanout->bytes, start, fanout->options_len);
+	memcpy(fanout->bytes + fanout->options_len, self->outbound.content_ptr, fanout->content_len);
+
+	fanout->code = self->outbound.packet->code;
+	fanout->last_option_key = self->outbound.last_option_key;
+	fanout->generation = observer->generation;
+	fanout->source = observer->link;
+
+bail:
+	return;
+}
+#else
+#define observer_fanout_lookup(self, observer)		NULL
+#define observer_fanout_stamp(self, fanout, observer)	do { } while (0)
+#define observer_fanout_capture(self, observer)		do { } while (0)
+#endif // NYOCI_CONF_OBSERVER_FANOUT
+
+// MARK: -
+
 static nyoci_status_t
 retry_sending_event(struct nyoci_observer_s* observer)
 {
 	nyoci_status_t status;
 	nyoci_t const self = nyoci_get_current_instance();
+	const struct nyoci_observer_fanout_s* fanout;
 
 	status = nyoci_outbound_begin_async_response(COAP_RESULT_205_CONTENT, &observer->async_response);
 	require_noerr(status,bail);
 
-	status = nyoci_outbound_add_option_uint(COAP_OPTION_OBSERVE, observer->seq);
-	require_noerr(status,bail);
+	fanout = observer_fanout_lookup(self, observer);
+
+	if (fanout != NULL) {
+		observer_fanout_stamp(self, fanout, observer);
+	} else {
+		status = nyoci_outbound_add_option_uint(COAP_OPTION_OBSERVE, observer->seq);
+		require_noerr(status,bail);
+	}
 
 	self->outbound.packet->tt = SHOULD_CONFIRM_EVENT_FOR_OBSERVER(observer)
 		? COAP_TRANS_TYPE_CONFIRMABLE
@@ -261,12 +880,32 @@ retry_sending_event(struct nyoci_observer_s* observer)
 	);
 #endif
 
-	status = nyoci_handle_request();
-	require(!status || status == NYOCI_STATUS_NOT_FOUND || status == NYOCI_STATUS_NOT_ALLOWED, bail);
+	if (fanout != NULL) {
+		// Already rendered for another observer.
+		status = nyoci_outbound_send();
+	} else {
+		status = nyoci_handle_request();
+		require(!status || status == NYOCI_STATUS_NOT_FOUND || status == NYOCI_STATUS_NOT_ALLOWED, bail);
+
+		if (status) {
+			nyoci_outbound_set_content_len(0);
+			nyoci_outbound_send();
+		} else if (self->did_respond && !observer->render_each) {
+			observer_fanout_capture(self, observer);
+		}
+	}
 
-	if (status) {
-		nyoci_outbound_set_content_len(0);
-		nyoci_outbound_send();
+	if ( (status == NYOCI_STATUS_OK)
+	  && self->did_respond
+	  && (self->outbound.packet->tt == COAP_TRANS_TYPE_CONFIRMABLE)
+	) {
+		// Counted for nyoci_observer_link_s::ack_history.
+		if (observer->con_transmissions == 0) {
+			observer->con_started = nyoci_plat_cms_to_timestamp(0);
+		}
+		if (observer->con_transmissions < 0xFF) {
+			observer->con_transmissions++;
+		}
 	}
 
 bail:
@@ -285,6 +924,19 @@ trigger_observer(nyoci_t interface, struct nyoci_observer_s* observer, int flags
 		observer->seq++;
 	}
 
+	observer->generation = observer_registry(interface)->generation;
+	observer->render_each = ((flags & NYOCI_OBS_TRIGGER_FLAG_RENDER_EACH) == NYOCI_OBS_TRIGGER_FLAG_RENDER_EACH);
+
+	nyoci_invalidate_timer(interface, &observer->flush_timer);
+	observer->dirty = false;
+	observer->observable->stats.sent++;
+
+	if (observer->observable->min_interval > 0) {
+		observer->last_notify = nyoci_plat_cms_to_timestamp(0);
+	}
+
+	observer_decide_confirm(observer, force_con);
+
 	// If we are about to need confirmation, then
 	// clear out the previous transaction so we can
 	// continue;
@@ -296,7 +948,11 @@ trigger_observer(nyoci_t interface, struct nyoci_observer_s* observer, int flags
 		// The transaction is still active, so just tickle it.
 
 		if (!observer->on_hold) {
-			nyoci_transaction_new_msg_id(interface, &observer->transaction, nyoci_get_next_msg_id(interface));
+			nyoci_transaction_new_msg_id(interface, &observer->transaction, nyoci_peer_next_msg_id(interface, &observer->transaction.sockaddr_remote));
+
+			// This is a new message, so it gets its own attempts. Long
+			// runs of NON notifications would otherwise run out.
+			observer->transaction.attemptCount = 0;
 		}
 
 		nyoci_transaction_tickle(interface, &observer->transaction);
@@ -322,49 +978,131 @@ trigger_observer(nyoci_t interface, struct nyoci_observer_s* observer, int flags
 	return ret;
 }
 
+//!	Triggers `observer`, unless it isn't ready for another notification.
+/*!	In that case it is marked dirty, and a single notification goes
+**	out once it is ready, however many triggers came in meanwhile. */
+static nyoci_status_t
+notify_observer(nyoci_t interface, struct nyoci_observer_s* observer, uint8_t flags)
+{
+	nyoci_observable_t const context = observer->observable;
+
+	context->stats.triggered++;
+
+	if (observer->dirty) {
+		// Only skip the increment if none of the triggers asked for it.
+		observer->pending_flags = (uint8_t)(
+			((observer->pending_flags | flags) & ~NYOCI_OBS_TRIGGER_FLAG_NO_INCREMENT)
+			| (observer->pending_flags & flags & NYOCI_OBS_TRIGGER_FLAG_NO_INCREMENT)
+		);
+		context->stats.conflated++;
+		return NYOCI_STATUS_OK;
+	}
+
+	if (observer_wait_time(observer) != 0) {
+		observer->dirty = true;
+		observer->pending_flags = flags;
+		context->stats.deferred++;
+		observer_schedule_flush(interface, observer);
+		return NYOCI_STATUS_OK;
+	}
+
+	return trigger_observer(interface, observer, flags);
+}
+
+static void
+observer_flush_(nyoci_t self, struct nyoci_observer_s* observer)
+{
+	if (!observer->in_use || !observer->dirty) {
+		return;
+	}
+
+	if (observer_wait_time(observer) != 0) {
+		// Still waiting for an acknowledgement, the response
+		// handler will schedule us again.
+		observer_schedule_flush(self, observer);
+		return;
+	}
+
+	trigger_observer(self, observer, observer->pending_flags);
+}
+
 int
 nyoci_count_observers(nyoci_t interface)
 {
-	int ret = 0;
-	int8_t i = 0;
+	return (int)observer_registry(interface)->count;
+}
 
-	for (; i < NYOCI_MAX_OBSERVERS; i++) {
-		struct nyoci_observer_s* observer = &observer_table[i];
+void
+nyoci_refresh_observers(nyoci_t interface, uint8_t flags)
+{
+	struct nyoci_observer_registry_s* const registry = observer_registry(interface);
+	uint32_t link;
 
-		if ( (observer->next != 0)
-		  && (observer->observable != NULL)
-#if !NYOCI_SINGLETON
-		  && (observer->observable->interface == interface)
-#endif
-		) {
-			ret++;
+	registry->generation++;
+
+	for (link = 1; link <= registry->capacity; link++) {
+		struct nyoci_observer_s* const observer = observer_from_link(registry, link);
+
+		if (observer->in_use) {
+			notify_observer(interface, observer, flags);
 		}
 	}
-	return ret;
 }
 
-void
-nyoci_refresh_observers(nyoci_t interface, uint8_t flags)
+static bool
+observer_matches_key(const struct nyoci_observer_s* observer, uint16_t key)
 {
-	int8_t i = 0;
-	for (; i < NYOCI_MAX_OBSERVERS; i++) {
-		struct nyoci_observer_s* observer = &observer_table[i];
-		if ( (observer->next != 0)
-		  && (observer->observable != NULL)
-#if !NYOCI_SINGLETON
-		  && (observer->observable->interface == interface)
-#endif
-		) {
-			trigger_observer(interface, observer, flags);
+	key = observable_key(key);
+
+	return (observer->key == NYOCI_OBSERVABLE_BROADCAST_KEY)
+		|| (key == NYOCI_OBSERVABLE_BROADCAST_KEY)
+		|| (observer->key == key);
+}
+
+//!	The keys a batch trigger applies to: either a list or a bitmap.
+struct observer_key_set_s {
+	const uint16_t* keys;
+	uint16_t nkeys;
+	const uint8_t* bitmap;
+	uint32_t nbits;
+	bool is_empty;
+	bool has_broadcast;
+};
+
+static bool
+observer_matches_set(const struct nyoci_observer_s* observer, const struct observer_key_set_s* set)
+{
+	uint16_t i;
+
+	if (set->is_empty) {
+		return false;
+	}
+
+	if (set->has_broadcast || (observer->key == NYOCI_OBSERVABLE_BROADCAST_KEY)) {
+		return true;
+	}
+
+	if (set->bitmap != NULL) {
+		return (observer->key < set->nbits)
+			&& (set->bitmap[observer->key / 8] & (1 << (observer->key % 8)));
+	}
+
+	for (i = 0; i < set->nkeys; i++) {
+		if (observable_key(set->keys[i]) == observer->key) {
+			return true;
 		}
 	}
+
+	return false;
 }
 
-nyoci_status_t
-nyoci_observable_trigger(nyoci_observable_t context, uint8_t key, uint8_t flags)
+//!	Notifies each observer of `context` whose key is in `set`, once.
+static nyoci_status_t
+observable_trigger_set_(nyoci_observable_t context, const struct observer_key_set_s* set, uint8_t flags)
 {
 	nyoci_status_t ret = NYOCI_STATUS_OK;
-	int8_t i;
+	struct nyoci_observer_registry_s* registry;
+	struct nyoci_observer_s* observer;
 #if !NYOCI_SINGLETON
 	nyoci_t const interface = context->interface;
 
@@ -375,49 +1113,135 @@ nyoci_observable_trigger(nyoci_observable_t context, uint8_t key, uint8_t flags)
 	nyoci_t const interface = nyoci_get_current_instance();
 #endif
 
-
-	if (!context->first_observer) {
+	if (set->is_empty) {
 		goto bail;
 	}
 
-	for (i = context->first_observer-1; i >= 0; i = observer_table[i].next - 1) {
-		assert(observer_table[i].observable == context);
-		assert((i != context->last_observer-1) || observer_table[i].next == 0);
+	registry = observer_registry(interface);
+	registry->generation++;
 
-		if ((observer_table[i].key != NYOCI_OBSERVABLE_BROADCAST_KEY)
-			&& (key != NYOCI_OBSERVABLE_BROADCAST_KEY)
-			&& (observer_table[i].key != key)
-		) {
+	for ( observer = observer_from_link(registry, context->first_observer)
+		; observer != NULL
+		; observer = observer_from_link(registry, observer->next)
+	) {
+		assert(observer->observable == context);
+		assert((observer->link != context->last_observer) || observer->next == 0);
+
+		if (!observer_matches_set(observer, set)) {
 			continue;
 		}
-		ret = trigger_observer(interface, &observer_table[i], flags);
+		ret = notify_observer(interface, observer, flags);
 	}
 
 bail:
 	return ret;
 }
 
+nyoci_status_t
+nyoci_observable_trigger(nyoci_observable_t context, uint16_t key, uint8_t flags)
+{
+	return nyoci_observable_trigger_set(context, &key, 1, flags);
+}
+
+nyoci_status_t
+nyoci_observable_trigger_set(
+	nyoci_observable_t context,
+	const uint16_t* keys,
+	uint16_t nkeys,
+	uint8_t flags
+) {
+	struct observer_key_set_s set = { 0 };
+	uint16_t i;
+
+	set.keys = keys;
+	set.nkeys = nkeys;
+	set.is_empty = (nkeys == 0);
+
+	for (i = 0; i < nkeys; i++) {
+		if (observable_key(keys[i]) == NYOCI_OBSERVABLE_BROADCAST_KEY) {
+			set.has_broadcast = true;
+			break;
+		}
+	}
+
+	return observable_trigger_set_(context, &set, flags);
+}
+
+nyoci_status_t
+nyoci_observable_trigger_bitmap(
+	nyoci_observable_t context,
+	const uint8_t* bitmap,
+	uint32_t nbits,
+	uint8_t flags
+) {
+	struct observer_key_set_s set = { 0 };
+	uint32_t i;
+
+	set.bitmap = bitmap;
+	set.nbits = (nbits < NYOCI_OBSERVABLE_BROADCAST_KEY) ? nbits : NYOCI_OBSERVABLE_BROADCAST_KEY;
+	set.is_empty = true;
+
+	for (i = 0; i < (set.nbits + 7) / 8; i++) {
+		uint8_t byte = bitmap[i];
+
+		if ((i == set.nbits / 8) && (set.nbits % 8)) {
+			// Ignore the bits past the end.
+			byte &= (uint8_t)((1 << (set.nbits % 8)) - 1);
+		}
+
+		if (byte != 0) {
+			set.is_empty = false;
+			break;
+		}
+	}
+
+#if NYOCI_CONF_OBSERVABLE_LEGACY_BROADCAST_KEY
+	if ((set.nbits > 0xFF) && (bitmap[0xFF / 8] & (1 << (0xFF % 8)))) {
+		set.has_broadcast = true;
+	}
+#endif
+
+	return observable_trigger_set_(context, &set, flags);
+}
+
+void
+nyoci_observable_set_min_interval(nyoci_observable_t context, nyoci_cms_t interval)
+{
+	context->min_interval = (interval > 0) ? interval : 0;
+}
+
+void
+nyoci_observable_get_stats(nyoci_observable_t context, struct nyoci_observable_stats_s* stats)
+{
+	*stats = context->stats;
+}
+
 int
-nyoci_observable_observer_count(nyoci_observable_t context, uint8_t key)
+nyoci_observable_observer_count(nyoci_observable_t context, uint16_t key)
 {
 	int count = 0;
-	int i;
+	struct nyoci_observer_registry_s* registry;
+	struct nyoci_observer_s* observer;
 
 	if (!context->first_observer) {
 		goto bail;
 	}
 
-	for (i = context->first_observer-1; i >= 0; i = observer_table[i].next - 1) {
-		assert(observer_table[i].observable == context);
-		assert((i != context->last_observer-1) || observer_table[i].next == 0);
+#if !NYOCI_SINGLETON
+	registry = observer_registry(context->interface);
+#else
+	registry = observer_registry(NULL);
+#endif
 
-		if ((observer_table[i].key != NYOCI_OBSERVABLE_BROADCAST_KEY)
-			&& (key != NYOCI_OBSERVABLE_BROADCAST_KEY)
-			&& (observer_table[i].key != key)
-		) {
-			continue;
+	for ( observer = observer_from_link(registry, context->first_observer)
+		; observer != NULL
+		; observer = observer_from_link(registry, observer->next)
+	) {
+		assert(observer->observable == context);
+
+		if (observer_matches_key(observer, key)) {
+			count++;
 		}
-		count++;
 	}
 
 bail:
@@ -427,32 +1251,32 @@ bail:
 int
 nyoci_observable_clear(
 	nyoci_observable_t context,
-	uint8_t key
+	uint16_t key
 ) {
 	int count = 0;
-	int i;
+	struct nyoci_observer_registry_s* registry;
+	struct nyoci_observer_s* observer;
+	uint32_t next;
 
 	if (!context->first_observer) {
 		goto bail;
 	}
 
-restart:
+#if !NYOCI_SINGLETON
+	registry = observer_registry(context->interface);
+#else
+	registry = observer_registry(NULL);
+#endif
+
+	for (observer = observer_from_link(registry, context->first_observer); observer != NULL; observer = observer_from_link(registry, next)) {
+		assert(observer->observable == context);
 
-	for (i = context->first_observer-1; i >= 0; i = observer_table[i].next - 1) {
-		assert(observer_table[i].observable == context);
-		assert((i != context->last_observer-1) || observer_table[i].next == 0);
+		next = observer->next;
 
-		if ((observer_table[i].key != NYOCI_OBSERVABLE_BROADCAST_KEY)
-			&& (key != NYOCI_OBSERVABLE_BROADCAST_KEY)
-			&& (observer_table[i].key != key)
-		) {
-			continue;
+		if (observer_matches_key(observer, key)) {
+			count++;
+			free_observer(observer);
 		}
-		count++;
-		free_observer(&observer_table[i]);
-
-		// Since we mutated the list, start from the top.
-		goto restart;
 	}
 
 bail:
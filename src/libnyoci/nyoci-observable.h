@@ -46,6 +46,56 @@ NYOCI_BEGIN_C_DECLS
 **	@sa @ref nyoci-example-4
 */
 
+//! Counters kept by each observable context.
+struct nyoci_observable_stats_s {
+	//!	Notifications asked for, one per observer per trigger.
+	uint32_t triggered;
+
+	//!	Notifications actually started.
+	uint32_t sent;
+
+	//!	Notifications held back because the observer had not yet
+	//!	acknowledged the previous one, or the minimum interval had
+	//!	not elapsed.
+	uint32_t deferred;
+
+	//!	Triggers folded into a notification that was already held back.
+	uint32_t conflated;
+};
+
+//!	What is known about the link to an observer, for deciding whether
+//!	the next notification should be confirmable.
+/*!	Only confirmable notifications tell us anything: each one is
+**	either acknowledged on its first transmission, or it needed to be
+**	retransmitted. An observer that never acknowledges is removed
+**	once the retransmissions run out. */
+struct nyoci_observer_link_s {
+	//!	Notifications sent as NON since the last CON.
+	uint32_t since_con;
+
+	//!	Milliseconds since the last CON was sent, or since the
+	//!	observer registered if there wasn't one yet.
+	nyoci_cms_t since_con_ms;
+
+	//!	The last eight CONs, newest in bit 0. A bit is set if that
+	//!	CON was acknowledged without being retransmitted.
+	uint8_t ack_history;
+
+	//!	Number of valid bits in `ack_history`.
+	uint8_t ack_count;
+
+	//!	Smoothed round trip time of acknowledged CONs, and its
+	//!	variation, in milliseconds. Zero until first measured.
+	nyoci_cms_t srtt;
+	nyoci_cms_t rttvar;
+};
+
+//!	Returns true if the next notification to an observer should be CON.
+typedef bool (*nyoci_observer_policy_func)(
+	const struct nyoci_observer_link_s* link,
+	void* context
+);
+
 //! Observable context.
 /*!	The observable context is a datastructure that keeps track of
 **	who is observing which resources. You may have as many or as few as
@@ -60,12 +110,23 @@ struct nyoci_observable_s {
 
 	// Consider all members below this line as private!
 
-	int8_t first_observer; //!^ always +1, zero is end of list
-	int8_t last_observer;  //!^ always +1, zero is end of list
+	uint32_t first_observer; //!^ always +1, zero is end of list
+	uint32_t last_observer;  //!^ always +1, zero is end of list
+
+	nyoci_cms_t min_interval; //!^ See nyoci_observable_set_min_interval()
+	struct nyoci_observable_stats_s stats;
+
+	nyoci_observer_policy_func policy; //!^ See nyoci_observable_set_policy()
+	void* policy_context;
 };
 
 //! Key to trigger all observers using the given observable context.
-#define NYOCI_OBSERVABLE_BROADCAST_KEY		(0xFF)
+/*!	NOTE: This was 0xFF before keys were widened to 16 bits, and 255
+**	is now an ordinary key. Code that passes 255, or keeps keys in a
+**	`uint8_t`, no longer reaches every observer and must be updated,
+**	or built with `NYOCI_CONF_OBSERVABLE_LEGACY_BROADCAST_KEY`.
+*/
+#define NYOCI_OBSERVABLE_BROADCAST_KEY		(0xFFFF)
 
 typedef struct nyoci_observable_s *nyoci_observable_t;
 
@@ -83,23 +144,105 @@ typedef struct nyoci_observable_s *nyoci_observable_t;
 */
 NYOCI_API_EXTERN nyoci_status_t nyoci_observable_update(
 	nyoci_observable_t context, //!< [IN] Pointer to observable context
-	uint8_t key		//!< [IN] Key for this resource (must be same as used in trigger)
+	uint16_t key		//!< [IN] Key for this resource (must be same as used in trigger)
 );
 
 #define NYOCI_OBS_TRIGGER_FLAG_NO_INCREMENT    (1<<0)
 #define NYOCI_OBS_TRIGGER_FLAG_FORCE_CON       (1<<1)
 
+//!	Call the request handler for every observer.
+/*!	By default, the notification the request handler renders for one
+**	observer is also sent to the other observers of the same key
+**	whose requests had the same options. Use this flag if the handler
+**	renders something different depending on who is asking. */
+#define NYOCI_OBS_TRIGGER_FLAG_RENDER_EACH     (1<<2)
+
 //!	Triggers an observable resource to send an update to its observers.
 /*!
 **	You may use NYOCI_OBSERVABLE_BROADCAST_KEY for the key to trigger
 **	all resources associated with this observable context to update.
+**
+**	When `NYOCI_CONF_OBSERVER_FANOUT` is set, the request handler is
+**	normally called only once per distinct request, and each observer
+**	is sent a copy of that notification with its own token, message
+**	id and Observe value. See NYOCI_OBS_TRIGGER_FLAG_RENDER_EACH.
 */
 NYOCI_API_EXTERN nyoci_status_t nyoci_observable_trigger(
 	nyoci_observable_t context, //!< [IN] Pointer to observable context
-	uint8_t key,	//!< [IN] Key for this resource (must be same as used in update)
+	uint16_t key,	//!< [IN] Key for this resource (must be same as used in update)
 	uint8_t flags	//!< [IN] Flags
 );
 
+//!	Triggers the observers of several keys at once.
+/*!	Works like calling nyoci_observable_trigger() for each key in
+**	`keys`, except that the observers are only walked once, and each
+**	matching observer is notified once however many of its keys are
+**	listed. Observers registered with NYOCI_OBSERVABLE_BROADCAST_KEY
+**	are notified if `nkeys` isn't zero.
+*/
+NYOCI_API_EXTERN nyoci_status_t nyoci_observable_trigger_set(
+	nyoci_observable_t context, //!< [IN] Pointer to observable context
+	const uint16_t* keys,	//!< [IN] Keys to trigger
+	uint16_t nkeys,	//!< [IN] Number of keys in `keys`
+	uint8_t flags	//!< [IN] Flags
+);
+
+//!	Like nyoci_observable_trigger_set(), with the keys given as a bitmap.
+/*!	Key `n` is triggered if bit `n % 8` of `bitmap[n / 8]` is set.
+**	This suits resources whose keys are small indexes, like those of
+**	@ref nyoci-var-handler.
+*/
+NYOCI_API_EXTERN nyoci_status_t nyoci_observable_trigger_bitmap(
+	nyoci_observable_t context, //!< [IN] Pointer to observable context
+	const uint8_t* bitmap,	//!< [IN] Bitmap of keys to trigger
+	uint32_t nbits,	//!< [IN] Number of bits in `bitmap`
+	uint8_t flags	//!< [IN] Flags
+);
+
+//!	Sets the minimum time between two notifications to the same observer.
+/*!	Triggers that come sooner are held back until the interval has
+**	elapsed, and then a single notification with the latest state is
+**	sent. The same happens while an observer has yet to acknowledge a
+**	confirmable notification, whatever the interval. Zero, the
+**	default, means no minimum.
+*/
+NYOCI_API_EXTERN void nyoci_observable_set_min_interval(
+	nyoci_observable_t context, //!< [IN] Pointer to observable context
+	nyoci_cms_t interval	//!< [IN] Interval, in milliseconds
+);
+
+//!	Sets the function that decides which notifications are sent as CON.
+/*!	Passing NULL restores nyoci_observer_default_policy(). Notifications
+**	are always CON while a previous CON is unacknowledged, or when
+**	triggered with NYOCI_OBS_TRIGGER_FLAG_FORCE_CON.
+*/
+NYOCI_API_EXTERN void nyoci_observable_set_policy(
+	nyoci_observable_t context, //!< [IN] Pointer to observable context
+	nyoci_observer_policy_func policy,	//!< [IN] Policy, or NULL
+	void* policy_context	//!< [IN] Passed to `policy`
+);
+
+//!	The policy used when none is set.
+/*!	Starts out sending every `NYOCI_OBSERVER_CON_INTERVAL`th
+**	notification as CON. Each recent CON that had to be retransmitted
+**	halves that interval, so an observer that has gone away is found
+**	out quickly. So does jitter: a round-trip variation of more than
+**	half the smoothed round-trip time. A run of clean acknowledgements
+**	lengthens it, up to `NYOCI_OBSERVER_CON_INTERVAL_MAX`. A CON is
+**	also sent if there wasn't one for
+**	`NYOCI_OBSERVATION_KEEPALIVE_INTERVAL`.
+*/
+NYOCI_API_EXTERN bool nyoci_observer_default_policy(
+	const struct nyoci_observer_link_s* link,
+	void* context
+);
+
+//!	Copies the counters of an observable context into `stats`.
+NYOCI_API_EXTERN void nyoci_observable_get_stats(
+	nyoci_observable_t context, //!< [IN] Pointer to observable context
+	struct nyoci_observable_stats_s* stats	//!< [OUT] Counters
+);
+
 //!	Triggers all observable resources to send a CON update to their observers.
 /*!
 **	This is useful to call occasionally to help weed out dead
@@ -113,6 +256,11 @@ NYOCI_API_EXTERN void nyoci_refresh_observers(nyoci_t interface, uint8_t flags);
 //! Returns the number of active observers.
 NYOCI_API_EXTERN int nyoci_count_observers(nyoci_t interface);
 
+//!	Makes sure `count` more observers can register without allocating memory.
+/*!	Returns `NYOCI_STATUS_MALLOC_FAILURE` if that would take more
+**	than `NYOCI_MAX_OBSERVERS` observers, or the memory isn't available. */
+NYOCI_API_EXTERN nyoci_status_t nyoci_observer_reserve(nyoci_t interface, uint32_t count);
+
 //!	Gets the number of observers for a given resource and key
 /*!
 **	You may use NYOCI_OBSERVABLE_BROADCAST_KEY for the key to get the
@@ -120,7 +268,7 @@ NYOCI_API_EXTERN int nyoci_count_observers(nyoci_t interface);
 */
 NYOCI_API_EXTERN int nyoci_observable_observer_count(
 	nyoci_observable_t context, //!< [IN] Pointer to observable context
-	uint8_t key	//!< [IN] Key for this resource (must be same as used in update)
+	uint16_t key	//!< [IN] Key for this resource (must be same as used in update)
 );
 
 //!	Removes observers for a given resource and key
@@ -130,7 +278,7 @@ NYOCI_API_EXTERN int nyoci_observable_observer_count(
 */
 NYOCI_API_EXTERN int nyoci_observable_clear(
 	nyoci_observable_t context, //!< [IN] Pointer to observable context
-	uint8_t key	//!< [IN] Key for this resource (must be same as used in update)
+	uint16_t key	//!< [IN] Key for this resource (must be same as used in update)
 );
 
 /*!	@} */
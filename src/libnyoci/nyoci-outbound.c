@@ -145,8 +145,8 @@ nyoci_outbound_begin(
 
 	} else if (code && (code < COAP_RESULT_100) && self->current_transaction) {
 		// For sending a request.
-		self->outbound.packet->token_len = sizeof(self->current_transaction->token);
-		memcpy(self->outbound.packet->token,(void*)&self->current_transaction->token,self->outbound.packet->token_len);
+		self->outbound.packet->token_len = self->current_transaction->token_len;
+		memcpy(self->outbound.packet->token,self->current_transaction->token,self->outbound.packet->token_len);
 	} else {
 		self->outbound.packet->token_len = 0;
 	}
@@ -751,8 +751,19 @@ nyoci_outbound_send(void)
 
 	if (self->current_transaction) {
 		self->current_transaction->sent_code = self->outbound.packet->code;
-		self->current_transaction->sockaddr_remote = *nyoci_plat_get_remote_sockaddr();
-		self->current_transaction->multicast = NYOCI_IS_ADDR_MULTICAST(&self->current_transaction->sockaddr_remote.nyoci_addr);
+		self->outbound.packet->msg_id = nyoci_internal_transaction_bind_remote(
+			self,
+			self->current_transaction,
+			nyoci_plat_get_remote_sockaddr(),
+			self->outbound.packet->msg_id
+		);
+
+		if ( (self->outbound.packet->tt == COAP_TRANS_TYPE_CONFIRMABLE)
+		  && (self->outbound.packet->msg_id == self->current_transaction->msg_id)
+		) {
+			ret = nyoci_peer_nstart_acquire(self, self->current_transaction);
+			require_quiet(ret == NYOCI_STATUS_OK, bail);
+		}
 	}
 
 #if defined(NYOCI_DEBUG_OUTBOUND_DROP_PERCENT)
@@ -779,6 +790,22 @@ nyoci_outbound_send(void)
 			header_len + self->outbound.content_len,
 			0 // FLAGS
 		);
+
+		if ((ret == NYOCI_STATUS_OK) && self->is_processing_message) {
+			nyoci_dupe_remember_response(
+				self->outbound.packet,
+				header_len + self->outbound.content_len
+			);
+		}
+
+		if ((ret == NYOCI_STATUS_OK) && self->current_transaction) {
+			nyoci_internal_transaction_cache_packet(
+				self,
+				self->current_transaction,
+				self->outbound.packet,
+				header_len + self->outbound.content_len
+			);
+		}
 	}
 
 
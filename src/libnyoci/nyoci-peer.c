@@ -0,0 +1,660 @@
+/*	@file nyoci-peer.c
+**	@author Robert Quattlebaum <darco@deepdarc.com>
+**	@desc Per-peer state
+**
+**	Copyright (C) 2017 Robert Quattlebaum
+**
+**	Permission is hereby granted, free of charge, to any person
+**	obtaining a copy of this software and associated
+**	documentation files (the "Software"), to deal in the
+**	Software without restriction, including without limitation
+**	the rights to use, copy, modify, merge, publish, distribute,
+**	sublicense, and/or sell copies of the Software, and to
+**	permit persons to whom the Software is furnished to do so,
+**	subject to the following conditions:
+**
+**	The above copyright notice and this permission notice shall
+**	be included in all copies or substantial portions of the
+**	Software.
+**
+**	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+**	KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+**	WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+**	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+**	OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+**	OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+**	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+**	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifndef VERBOSE_DEBUG
+#define VERBOSE_DEBUG 0
+#endif
+
+#ifndef DEBUG
+#define DEBUG VERBOSE_DEBUG
+#endif
+
+#include "assert-macros.h"
+#include "nyoci-internal.h"
+#include "nyoci-logging.h"
+#include "nyoci-peer.h"
+#include "fasthash.h"
+
+#if NYOCI_CONF_MAX_PEERS
+
+static bool
+nyoci_peer_matches_(nyoci_peer_t peer, const nyoci_sockaddr_t* sockaddr)
+{
+	return (peer->sockaddr.nyoci_port == sockaddr->nyoci_port)
+		&& (0 == memcmp(&peer->sockaddr.nyoci_addr, &sockaddr->nyoci_addr, sizeof(nyoci_addr_t)));
+}
+
+static uint32_t
+nyoci_peer_bucket_(const nyoci_sockaddr_t* sockaddr)
+{
+	struct fasthash_state_s fasthash;
+
+	fasthash_start(&fasthash, 0);
+	fasthash_feed(&fasthash, (const uint8_t*)&sockaddr->nyoci_addr, sizeof(nyoci_addr_t));
+	fasthash_feed(&fasthash, (const uint8_t*)&sockaddr->nyoci_port, sizeof(sockaddr->nyoci_port));
+
+	return fasthash_finish_uint32(&fasthash) % NYOCI_CONF_MAX_PEERS;
+}
+
+static void
+nyoci_peer_lru_unlink_(struct nyoci_peer_info_s* info, nyoci_peer_t peer)
+{
+	if (peer->lru_prev) {
+		peer->lru_prev->lru_next = peer->lru_next;
+	} else {
+		info->lru_head = peer->lru_next;
+	}
+
+	if (peer->lru_next) {
+		peer->lru_next->lru_prev = peer->lru_prev;
+	} else {
+		info->lru_tail = peer->lru_prev;
+	}
+
+	peer->lru_prev = NULL;
+	peer->lru_next = NULL;
+}
+
+static void
+nyoci_peer_lru_push_(struct nyoci_peer_info_s* info, nyoci_peer_t peer)
+{
+	peer->lru_prev = NULL;
+	peer->lru_next = info->lru_head;
+
+	if (info->lru_head) {
+		info->lru_head->lru_prev = peer;
+	} else {
+		info->lru_tail = peer;
+	}
+
+	info->lru_head = peer;
+}
+
+static void
+nyoci_peer_unhash_(struct nyoci_peer_info_s* info, nyoci_peer_t peer)
+{
+	nyoci_peer_t* iter = &info->bucket[nyoci_peer_bucket_(&peer->sockaddr)];
+
+	while (*iter != peer) {
+		assert(*iter != NULL);
+		iter = &(*iter)->hash_next;
+	}
+
+	*iter = peer->hash_next;
+	peer->hash_next = NULL;
+}
+
+//!	Peers that NSTART still needs can't be recycled.
+static bool
+nyoci_peer_is_pinned_(nyoci_peer_t peer)
+{
+	return (peer->outstanding != 0)
+		|| (peer->parked_head != NULL)
+		|| (peer->nstart != 0);
+}
+
+//!	Peers can only be recycled once nothing they sent can still be
+//!	answered. Their message id space is lost with them, and the
+//!	next entry for the same remote would otherwise reuse its ids
+//!	within EXCHANGE_LIFETIME.
+static bool
+nyoci_peer_can_recycle_(nyoci_peer_t peer)
+{
+	if (nyoci_peer_is_pinned_(peer)) {
+		return false;
+	}
+
+	if (peer->last_used == 0) {
+		// Never sent a message id.
+		return true;
+	}
+
+	return nyoci_plat_timestamp_diff(nyoci_plat_cms_to_timestamp(0), peer->last_used)
+		>= (nyoci_cms_t)(COAP_EXCHANGE_LIFETIME*MSEC_PER_SEC);
+}
+
+static nyoci_peer_t
+nyoci_peer_find_(struct nyoci_peer_info_s* info, const nyoci_sockaddr_t* sockaddr, uint32_t bucket)
+{
+	nyoci_peer_t peer;
+
+	for (peer = info->bucket[bucket]; peer != NULL; peer = peer->hash_next) {
+		if (nyoci_peer_matches_(peer, sockaddr)) {
+			break;
+		}
+	}
+
+	return peer;
+}
+
+nyoci_peer_t
+nyoci_peer_lookup(nyoci_t self, const nyoci_sockaddr_t* sockaddr)
+{
+	struct nyoci_peer_info_s* const info = &self->peer_info;
+	nyoci_peer_t peer = NULL;
+	uint32_t bucket;
+
+	require_quiet(!NYOCI_IS_ADDR_MULTICAST(&sockaddr->nyoci_addr), bail);
+
+	bucket = nyoci_peer_bucket_(sockaddr);
+	peer = nyoci_peer_find_(info, sockaddr, bucket);
+
+	if (peer == NULL) {
+		if (info->count < NYOCI_CONF_MAX_PEERS) {
+			peer = &info->peer[info->count++];
+		} else {
+			// Recycle the least recently used entry.
+			peer = info->lru_tail;
+
+			while ((peer != NULL) && !nyoci_peer_can_recycle_(peer)) {
+				peer = peer->lru_prev;
+			}
+
+			require_quiet(peer != NULL, bail);
+
+			DEBUG_PRINTF("Evicting peer %p, idle for %dms", peer,
+				(int)nyoci_plat_timestamp_diff(nyoci_plat_cms_to_timestamp(0), peer->last_used));
+			nyoci_peer_lru_unlink_(info, peer);
+			nyoci_peer_unhash_(info, peer);
+		}
+
+		memset(peer, 0, sizeof(*peer));
+		peer->sockaddr = *sockaddr;
+		// While it had no entry, this remote got its message ids from
+		// the instance counter. Picking up where that counter is walks
+		// the same sequence, so those ids don't come up again for a
+		// whole cycle.
+		peer->last_msg_id = nyoci_get_next_msg_id(self);
+		peer->hash_next = info->bucket[bucket];
+		info->bucket[bucket] = peer;
+
+	} else if (peer != info->lru_head) {
+		nyoci_peer_lru_unlink_(info, peer);
+
+	} else {
+		goto bail;
+	}
+
+	nyoci_peer_lru_push_(info, peer);
+
+bail:
+	return peer;
+}
+
+coap_msg_id_t
+nyoci_peer_next_msg_id(nyoci_t self, const nyoci_sockaddr_t* sockaddr)
+{
+	nyoci_peer_t const peer = nyoci_peer_lookup(self, sockaddr);
+
+	if (peer == NULL) {
+		return nyoci_get_next_msg_id(self);
+	}
+
+	peer->last_msg_id = nyoci_msg_id_step(peer->last_msg_id);
+	peer->last_used = nyoci_plat_cms_to_timestamp(0);
+
+	return peer->last_msg_id;
+}
+
+// MARK: -
+// MARK: Retransmission Timeouts
+
+// This follows CoCoA, the "CoAP Simple Congestion Control/Advanced"
+// draft: RFC 6298 style estimators, one fed only by exchanges that
+// were not retransmitted ("strong") and one by exchanges that were
+// retransmitted once or twice ("weak"), blended into an overall RTO.
+
+//!	Returns `estimator`'s own RTO in milliseconds, with variance
+//!	factor `k`.
+static nyoci_cms_t
+nyoci_rtt_estimator_rto_(const struct nyoci_rtt_estimator_s* estimator, int k)
+{
+	int32_t variance = k * estimator->rttvar;
+
+	// Clock granularity is one millisecond.
+	if (variance < 8) {
+		variance = 8;
+	}
+
+	return (estimator->srtt + variance + 7) / 8;
+}
+
+static void
+nyoci_rtt_estimator_update_(struct nyoci_rtt_estimator_s* estimator, int32_t rtt)
+{
+	if (estimator->samples++ == 0) {
+		estimator->srtt = rtt;
+		estimator->rttvar = rtt / 2;
+	} else {
+		int32_t delta = estimator->srtt - rtt;
+
+		if (delta < 0) {
+			delta = -delta;
+		}
+
+		// beta = 1/4, alpha = 1/8
+		estimator->rttvar += (delta - estimator->rttvar) / 4;
+		estimator->srtt += (rtt - estimator->srtt) / 8;
+	}
+}
+
+static nyoci_cms_t
+nyoci_peer_clamp_rto_(nyoci_t self, nyoci_cms_t rto)
+{
+	if (rto > self->rto_max) {
+		rto = self->rto_max;
+	}
+	if (rto < self->rto_min) {
+		rto = self->rto_min;
+	}
+	return rto;
+}
+
+nyoci_cms_t
+nyoci_peer_get_rto(nyoci_t self, const nyoci_sockaddr_t* sockaddr)
+{
+	nyoci_peer_t peer;
+	nyoci_cms_t idle;
+
+	if (NYOCI_IS_ADDR_MULTICAST(&sockaddr->nyoci_addr)) {
+		goto bail;
+	}
+
+	peer = nyoci_peer_find_(&self->peer_info, sockaddr, nyoci_peer_bucket_(sockaddr));
+
+	if ((peer == NULL) || (peer->rto == 0)) {
+		goto bail;
+	}
+
+	idle = nyoci_plat_timestamp_diff(nyoci_plat_cms_to_timestamp(0), peer->rto_updated);
+
+	// Age estimates that haven't been confirmed in a while back
+	// towards the default.
+	if ((peer->rto < 1*MSEC_PER_SEC) && (idle > 16 * peer->rto)) {
+		peer->rto *= 2;
+		peer->rto_updated = nyoci_plat_cms_to_timestamp(0);
+
+	} else if ((peer->rto > 3*MSEC_PER_SEC) && (idle > 4 * peer->rto)) {
+		peer->rto = 2*MSEC_PER_SEC + peer->rto / 2;
+		peer->rto_updated = nyoci_plat_cms_to_timestamp(0);
+	}
+
+	return nyoci_peer_clamp_rto_(self, peer->rto);
+
+bail:
+	return nyoci_peer_clamp_rto_(self, (nyoci_cms_t)(COAP_ACK_TIMEOUT * MSEC_PER_SEC));
+}
+
+void
+nyoci_peer_rtt_sample(
+	nyoci_t self,
+	const nyoci_sockaddr_t* sockaddr,
+	nyoci_cms_t rtt,
+	uint8_t transmissions
+) {
+	nyoci_peer_t peer;
+	nyoci_cms_t rto;
+
+	// After more than two retransmissions we can't tell which one
+	// was answered well enough for the sample to be useful.
+	require_quiet((transmissions >= 1) && (transmissions <= 3), bail);
+	require_quiet(rtt >= 0, bail);
+
+	peer = nyoci_peer_lookup(self, sockaddr);
+	require_quiet(peer != NULL, bail);
+
+	rto = peer->rto;
+
+	if (rto == 0) {
+		rto = (nyoci_cms_t)(COAP_ACK_TIMEOUT * MSEC_PER_SEC);
+	}
+
+	if (transmissions == 1) {
+		nyoci_rtt_estimator_update_(&peer->strong, rtt * 8);
+		rto = (nyoci_rtt_estimator_rto_(&peer->strong, 4) + rto) / 2;
+	} else {
+		nyoci_rtt_estimator_update_(&peer->weak, rtt * 8);
+		rto = (nyoci_rtt_estimator_rto_(&peer->weak, 1) + 3 * rto) / 4;
+	}
+
+	peer->rto = nyoci_peer_clamp_rto_(self, rto);
+	peer->rto_updated = nyoci_plat_cms_to_timestamp(0);
+
+	DEBUG_PRINTF("Peer %p: RTT %dms after %d transmission(s), RTO now %dms",
+		peer, (int)rtt, (int)transmissions, (int)peer->rto);
+
+bail:
+	return;
+}
+
+nyoci_status_t
+nyoci_get_rtt_stats(
+	nyoci_t self,
+	const nyoci_sockaddr_t* remote,
+	struct nyoci_rtt_stats_s* stats
+) {
+	NYOCI_SINGLETON_SELF_HOOK;
+	nyoci_peer_t const peer = nyoci_peer_find_(&self->peer_info, remote, nyoci_peer_bucket_(remote));
+
+	memset(stats, 0, sizeof(*stats));
+
+	if (peer == NULL) {
+		return NYOCI_STATUS_NOT_FOUND;
+	}
+
+	stats->rto = nyoci_peer_get_rto(self, remote);
+	stats->strong_srtt_us = (uint32_t)peer->strong.srtt * 125;
+	stats->strong_rttvar_us = (uint32_t)peer->strong.rttvar * 125;
+	stats->strong_samples = peer->strong.samples;
+	stats->weak_srtt_us = (uint32_t)peer->weak.srtt * 125;
+	stats->weak_rttvar_us = (uint32_t)peer->weak.rttvar * 125;
+	stats->weak_samples = peer->weak.samples;
+
+	return NYOCI_STATUS_OK;
+}
+
+// MARK: -
+// MARK: NSTART
+
+static uint8_t
+nyoci_peer_nstart_(nyoci_t self, nyoci_peer_t peer)
+{
+	return peer->nstart ? peer->nstart : self->nstart;
+}
+
+static void
+nyoci_peer_unpark_(nyoci_t self, nyoci_peer_t peer, nyoci_transaction_t handler)
+{
+	if (handler->parked_prev) {
+		handler->parked_prev->parked_next = handler->parked_next;
+	} else {
+		peer->parked_head = handler->parked_next;
+	}
+
+	if (handler->parked_next) {
+		handler->parked_next->parked_prev = handler->parked_prev;
+	} else {
+		peer->parked_tail = handler->parked_prev;
+	}
+
+	handler->parked_prev = NULL;
+	handler->parked_next = NULL;
+	handler->parked = 0;
+	self->nstart_stats.queued--;
+}
+
+//!	Hands free slots of `peer` to the transactions waiting for them.
+static void
+nyoci_peer_nstart_drain_(nyoci_t self, nyoci_peer_t peer)
+{
+	nyoci_transaction_t handler;
+	uint8_t limit = nyoci_peer_nstart_(self, peer);
+
+	while ( ((handler = peer->parked_head) != NULL)
+	     && ((limit == 0) || (peer->outstanding < limit))
+	) {
+		nyoci_cms_t wait = nyoci_plat_timestamp_diff(
+			nyoci_plat_cms_to_timestamp(0),
+			handler->parked_since
+		);
+
+		nyoci_peer_unpark_(self, peer, handler);
+
+		handler->holds_nstart = 1;
+		peer->outstanding++;
+		self->nstart_stats.outstanding++;
+
+		self->nstart_stats.total_wait += (uint32_t)wait;
+		if ((uint32_t)wait > self->nstart_stats.max_wait) {
+			self->nstart_stats.max_wait = (uint32_t)wait;
+		}
+
+		DEBUG_PRINTF("Peer %p: Releasing transaction %p after %dms", peer, handler, (int)wait);
+
+		// Nothing has been sent yet, so start retransmitting afresh.
+		handler->attemptCount = 0;
+		nyoci_transaction_tickle(self, handler);
+	}
+}
+
+nyoci_status_t
+nyoci_peer_nstart_acquire(nyoci_t self, nyoci_transaction_t handler)
+{
+	nyoci_status_t ret = NYOCI_STATUS_OK;
+	nyoci_peer_t peer;
+	uint8_t limit;
+
+	require_quiet(!handler->holds_nstart, bail);
+
+	if (handler->parked) {
+		// Still waiting for a slot.
+		ret = NYOCI_STATUS_WAIT_FOR_PEER;
+		goto bail;
+	}
+
+	// If there is no room left in the peer table, don't hold
+	// anything back.
+	peer = nyoci_peer_lookup(self, &handler->sockaddr_remote);
+	require_quiet(peer != NULL, bail);
+
+	handler->peer = peer;
+	limit = nyoci_peer_nstart_(self, peer);
+
+	if ((limit == 0) || ((peer->outstanding < limit) && (peer->parked_head == NULL))) {
+		handler->holds_nstart = 1;
+		peer->outstanding++;
+		self->nstart_stats.outstanding++;
+		goto bail;
+	}
+
+	DEBUG_PRINTF("Peer %p: %d requests outstanding, parking transaction %p",
+		peer, (int)peer->outstanding, handler);
+
+	handler->parked = 1;
+	handler->parked_since = nyoci_plat_cms_to_timestamp(0);
+	handler->parked_prev = peer->parked_tail;
+	handler->parked_next = NULL;
+
+	if (peer->parked_tail) {
+		peer->parked_tail->parked_next = handler;
+	} else {
+		peer->parked_head = handler;
+	}
+	peer->parked_tail = handler;
+
+	self->nstart_stats.parked++;
+	if (++self->nstart_stats.queued > self->nstart_stats.max_queued) {
+		self->nstart_stats.max_queued = self->nstart_stats.queued;
+	}
+
+	ret = NYOCI_STATUS_WAIT_FOR_PEER;
+
+bail:
+	return ret;
+}
+
+void
+nyoci_peer_nstart_release(nyoci_t self, nyoci_transaction_t handler)
+{
+	nyoci_peer_t const peer = handler->peer;
+
+	require_quiet(peer != NULL, bail);
+
+	handler->peer = NULL;
+
+	if (handler->parked) {
+		nyoci_peer_unpark_(self, peer, handler);
+
+	} else if (handler->holds_nstart) {
+		handler->holds_nstart = 0;
+		peer->outstanding--;
+		self->nstart_stats.outstanding--;
+		nyoci_peer_nstart_drain_(self, peer);
+	}
+
+bail:
+	return;
+}
+
+nyoci_status_t
+nyoci_set_nstart(nyoci_t self, const nyoci_sockaddr_t* remote, uint8_t nstart)
+{
+	NYOCI_SINGLETON_SELF_HOOK;
+	struct nyoci_peer_info_s* const info = &self->peer_info;
+	nyoci_status_t ret = NYOCI_STATUS_OK;
+	nyoci_peer_t peer;
+
+	if (remote == NULL) {
+		uint16_t i;
+
+		self->nstart = nstart;
+
+		for (i = 0; i < info->count; i++) {
+			nyoci_peer_nstart_drain_(self, &info->peer[i]);
+		}
+
+	} else {
+		peer = nyoci_peer_lookup(self, remote);
+		require_action(peer != NULL, bail, ret = NYOCI_STATUS_INVALID_ARGUMENT);
+
+		peer->nstart = nstart;
+		nyoci_peer_nstart_drain_(self, peer);
+	}
+
+bail:
+	return ret;
+}
+
+void
+nyoci_get_nstart_stats(nyoci_t self, struct nyoci_nstart_stats_s* stats)
+{
+	NYOCI_SINGLETON_SELF_HOOK;
+
+	*stats = self->nstart_stats;
+}
+
+#else // NYOCI_CONF_MAX_PEERS
+
+nyoci_peer_t
+nyoci_peer_lookup(nyoci_t self, const nyoci_sockaddr_t* sockaddr)
+{
+	return NULL;
+}
+
+coap_msg_id_t
+nyoci_peer_next_msg_id(nyoci_t self, const nyoci_sockaddr_t* sockaddr)
+{
+	return nyoci_get_next_msg_id(self);
+}
+
+nyoci_cms_t
+nyoci_peer_get_rto(nyoci_t self, const nyoci_sockaddr_t* sockaddr)
+{
+	nyoci_cms_t rto = (nyoci_cms_t)(COAP_ACK_TIMEOUT * MSEC_PER_SEC);
+
+	if (rto > self->rto_max) {
+		rto = self->rto_max;
+	}
+	if (rto < self->rto_min) {
+		rto = self->rto_min;
+	}
+	return rto;
+}
+
+void
+nyoci_peer_rtt_sample(
+	nyoci_t self,
+	const nyoci_sockaddr_t* sockaddr,
+	nyoci_cms_t rtt,
+	uint8_t transmissions
+) {
+}
+
+nyoci_status_t
+nyoci_get_rtt_stats(
+	nyoci_t self,
+	const nyoci_sockaddr_t* remote,
+	struct nyoci_rtt_stats_s* stats
+) {
+	memset(stats, 0, sizeof(*stats));
+	return NYOCI_STATUS_NOT_FOUND;
+}
+
+nyoci_status_t
+nyoci_peer_nstart_acquire(nyoci_t self, nyoci_transaction_t handler)
+{
+	return NYOCI_STATUS_OK;
+}
+
+void
+nyoci_peer_nstart_release(nyoci_t self, nyoci_transaction_t handler)
+{
+}
+
+nyoci_status_t
+nyoci_set_nstart(nyoci_t self, const nyoci_sockaddr_t* remote, uint8_t nstart)
+{
+	NYOCI_SINGLETON_SELF_HOOK;
+
+	if (remote != NULL) {
+		return NYOCI_STATUS_NOT_IMPLEMENTED;
+	}
+
+	self->nstart = nstart;
+
+	return NYOCI_STATUS_OK;
+}
+
+void
+nyoci_get_nstart_stats(nyoci_t self, struct nyoci_nstart_stats_s* stats)
+{
+	memset(stats, 0, sizeof(*stats));
+}
+
+#endif // NYOCI_CONF_MAX_PEERS
+
+void
+nyoci_set_rto_bounds(nyoci_t self, nyoci_cms_t min_rto, nyoci_cms_t max_rto)
+{
+	NYOCI_SINGLETON_SELF_HOOK;
+
+	if (min_rto < 1) {
+		min_rto = 1;
+	}
+	if (max_rto < min_rto) {
+		max_rto = min_rto;
+	}
+
+	self->rto_min = min_rto;
+	self->rto_max = max_rto;
+}
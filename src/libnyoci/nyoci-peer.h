@@ -0,0 +1,152 @@
+/*!	@file nyoci-peer.h
+**	@author Robert Quattlebaum <darco@deepdarc.com>
+**	@brief Per-peer state
+**
+**	Copyright (C) 2017 Robert Quattlebaum
+**
+**	Permission is hereby granted, free of charge, to any person
+**	obtaining a copy of this software and associated
+**	documentation files (the "Software"), to deal in the
+**	Software without restriction, including without limitation
+**	the rights to use, copy, modify, merge, publish, distribute,
+**	sublicense, and/or sell copies of the Software, and to
+**	permit persons to whom the Software is furnished to do so,
+**	subject to the following conditions:
+**
+**	The above copyright notice and this permission notice shall
+**	be included in all copies or substantial portions of the
+**	Software.
+**
+**	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+**	KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+**	WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+**	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+**	OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+**	OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+**	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+**	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef NYOCI_nyoci_peer_h
+#define NYOCI_nyoci_peer_h
+
+#include "libnyoci.h"
+
+NYOCI_BEGIN_C_DECLS
+
+//!	One of the two RTT estimators CoCoA keeps per peer.
+/*!	Times are in eighths of a millisecond, so that LAN round trips of
+**	a millisecond or two still smooth properly. */
+struct nyoci_rtt_estimator_s {
+	int32_t					srtt;
+	int32_t					rttvar;
+	uint32_t				samples;
+};
+
+//!	State kept for each remote endpoint we have recently talked to.
+struct nyoci_peer_s {
+	//!	Next peer in the same hash bucket.
+	struct nyoci_peer_s*	hash_next;
+
+	//!	Neighbours in the LRU list, most recently used first.
+	struct nyoci_peer_s*	lru_prev;
+	struct nyoci_peer_s*	lru_next;
+
+	nyoci_sockaddr_t		sockaddr;
+	nyoci_timestamp_t		last_used;
+	coap_msg_id_t			last_msg_id;
+
+	//!	Estimator fed by exchanges that needed no retransmission.
+	struct nyoci_rtt_estimator_s strong;
+
+	//!	Estimator fed by exchanges that needed one or two.
+	struct nyoci_rtt_estimator_s weak;
+
+	//!	Overall retransmission timeout, in milliseconds. Zero until
+	//!	the first RTT sample arrives.
+	nyoci_cms_t				rto;
+	nyoci_timestamp_t		rto_updated;
+
+	//!	Confirmable requests currently outstanding towards this peer.
+	uint8_t					outstanding;
+
+	//!	Limit on `outstanding`, or zero to use the instance default.
+	uint8_t					nstart;
+
+	//!	Transactions waiting for `outstanding` to drop, oldest first.
+	struct nyoci_transaction_s* parked_head;
+	struct nyoci_transaction_s* parked_tail;
+};
+
+typedef struct nyoci_peer_s* nyoci_peer_t;
+
+#if NYOCI_CONF_MAX_PEERS
+struct nyoci_peer_info_s {
+	struct nyoci_peer_s		peer[NYOCI_CONF_MAX_PEERS];
+	nyoci_peer_t			bucket[NYOCI_CONF_MAX_PEERS];
+	nyoci_peer_t			lru_head;
+	nyoci_peer_t			lru_tail;
+	uint16_t				count;
+};
+#endif
+
+//!	Returns the entry for `sockaddr`, creating it if necessary.
+/*!	When the table is full the least recently used entry that
+**	hasn't drawn a message id for EXCHANGE_LIFETIME is recycled.
+**	Returns NULL if there is no such entry, for multicast addresses,
+**	or if the table has been compiled out. */
+NYOCI_INTERNAL_EXTERN nyoci_peer_t nyoci_peer_lookup(
+	nyoci_t self,
+	const nyoci_sockaddr_t* sockaddr
+);
+
+//!	Returns a message id that has not been sent to `sockaddr` recently.
+/*!	Each peer has its own message id space, so the limit that
+**	EXCHANGE_LIFETIME places on reusing message ids applies per
+**	peer instead of per instance. Falls back to
+**	nyoci_get_next_msg_id() when no peer entry is available; new
+**	entries continue from that counter, so a remote never sees the
+**	same id twice within a cycle of it. */
+NYOCI_INTERNAL_EXTERN coap_msg_id_t nyoci_peer_next_msg_id(
+	nyoci_t self,
+	const nyoci_sockaddr_t* sockaddr
+);
+
+//!	Returns the retransmission timeout to use for `sockaddr`, in ms.
+/*!	This is the CoCoA overall RTO of the peer, aged towards the
+**	default if it hasn't been updated in a while, and kept within
+**	the bounds set with nyoci_set_rto_bounds(). */
+NYOCI_INTERNAL_EXTERN nyoci_cms_t nyoci_peer_get_rto(
+	nyoci_t self,
+	const nyoci_sockaddr_t* sockaddr
+);
+
+//!	Feeds an RTT measurement into the estimators of `sockaddr`.
+/*!	`rtt` is measured from the first transmission of the message,
+**	and `transmissions` is how many times it was sent in total. */
+NYOCI_INTERNAL_EXTERN void nyoci_peer_rtt_sample(
+	nyoci_t self,
+	const nyoci_sockaddr_t* sockaddr,
+	nyoci_cms_t rtt,
+	uint8_t transmissions
+);
+
+//!	Takes one of the NSTART slots of the peer `handler` is sending to.
+/*!	Returns `NYOCI_STATUS_WAIT_FOR_PEER` if they are all taken, in
+**	which case `handler` is queued. When an earlier exchange with the
+**	peer completes, the slot is handed to the transaction that has
+**	been waiting longest and it is tickled so that it sends again. */
+NYOCI_INTERNAL_EXTERN nyoci_status_t nyoci_peer_nstart_acquire(
+	nyoci_t self,
+	struct nyoci_transaction_s* handler
+);
+
+//!	Gives up the NSTART slot `handler` holds, or its place in the queue.
+NYOCI_INTERNAL_EXTERN void nyoci_peer_nstart_release(
+	nyoci_t self,
+	struct nyoci_transaction_s* handler
+);
+
+NYOCI_END_C_DECLS
+
+#endif
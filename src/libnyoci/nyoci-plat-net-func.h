@@ -51,6 +51,7 @@
 #define nyoci_plat_multicast_join(self,...)		nyoci_plat_multicast_join(__VA_ARGS__)
 #define nyoci_plat_multicast_leave(self,...)		nyoci_plat_multicast_leave(__VA_ARGS__)
 #define nyoci_plat_update_pollfds(self,...)		nyoci_plat_update_pollfds(__VA_ARGS__)
+#define nyoci_plat_wakeup(self)		nyoci_plat_wakeup()
 #endif
 
 #endif
@@ -93,6 +94,7 @@ NYOCI_BEGIN_C_DECLS
 **	* nyoci_plat_set_local_sockaddr()
 **	* nyoci_plat_outbound_start()
 **	* nyoci_plat_outbound_send_packet()
+**	* nyoci_plat_wakeup()
 **
 **	Any data that you need to associate with an instance needs to
 **	be stored in the struct `nyoci_plat_s`, defined in the internal
@@ -134,6 +136,12 @@ NYOCI_API_EXTERN nyoci_status_t nyoci_plat_process(nyoci_t self);
 **  Some platforms do not implement this function. */
 NYOCI_API_EXTERN nyoci_status_t nyoci_plat_wait(nyoci_t self, nyoci_cms_t cms);
 
+//!	Makes a pending or future nyoci_plat_wait() on `self` return early.
+/*!	Unlike every other function here, this may be called from any
+**	thread. It is used by nyoci_post_command(). Platforms that can't
+**	block in nyoci_plat_wait() can implement it as a no-op. */
+NYOCI_INTERNAL_EXTERN void nyoci_plat_wakeup(nyoci_t self);
+
 /*!	@} */
 
 /*!	@addtogroup nyoci_timer
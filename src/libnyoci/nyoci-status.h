@@ -74,7 +74,9 @@ enum {
 	NYOCI_STATUS_OUT_OF_SESSIONS     = -31,
 	NYOCI_STATUS_UNSUPPORTED_MEDIA_TYPE = -32,
 	//! When returned from a resend callback (in a transaction), stop sending packets without invalidate the transaction
-	NYOCI_STATUS_STOP_RESENDING		= -33
+	NYOCI_STATUS_STOP_RESENDING		= -33,
+	//! The peer already has as many outstanding requests as NSTART allows.
+	NYOCI_STATUS_WAIT_FOR_PEER		= -34
 };
 
 typedef int nyoci_status_t;
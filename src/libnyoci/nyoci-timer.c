@@ -51,18 +51,163 @@
 #include "nyoci-logging.h"
 #include "url-helpers.h"
 #include <string.h>
+#include <stdlib.h>
 
 #ifndef NYOCI_MAX_TIMEOUT
 #define NYOCI_MAX_TIMEOUT    (NYOCI_CONF_MAX_TIMEOUT * MSEC_PER_SEC)
 #endif
 
+//!	Compares the latest firing times of two timers (fire date plus slack).
+/*!	Timers are kept ordered by this, so the next wakeup is always the
+**	earliest deadline. Anything whose fire date has already passed at
+**	that point gets fired in the same pass. */
+static nyoci_cms_t
+nyoci_timer_deadline_diff_(nyoci_timer_t lhs, nyoci_timer_t rhs)
+{
+	return nyoci_plat_timestamp_diff(lhs->fire_date, rhs->fire_date)
+		+ lhs->slack - rhs->slack;
+}
+
+#if NYOCI_TIMERS_USE_HEAP
+
+// MARK: -
+// MARK: Timer Heap
+
+#define NYOCI_TIMER_HEAP_ARITY				4
+#define NYOCI_TIMER_HEAP_INITIAL_CAPACITY	16
+
+//!	Timers with the same deadline fire in the order they were scheduled.
+static bool
+nyoci_timer_fires_before_(nyoci_timer_t lhs, nyoci_timer_t rhs)
+{
+	nyoci_cms_t diff = nyoci_timer_deadline_diff_(lhs, rhs);
+
+	if (diff == 0) {
+		return (int32_t)(lhs->heap_sequence - rhs->heap_sequence) < 0;
+	}
+
+	return diff < 0;
+}
+
+static void
+nyoci_timer_heap_place_(nyoci_t self, nyoci_timer_t timer, uint32_t index)
+{
+	self->timer_heap[index] = timer;
+	timer->heap_index = index + 1;
+}
+
+static void
+nyoci_timer_heap_sift_up_(nyoci_t self, uint32_t index)
+{
+	nyoci_timer_t const timer = self->timer_heap[index];
+
+	while (index > 0) {
+		uint32_t parent = (index - 1) / NYOCI_TIMER_HEAP_ARITY;
+
+		if (!nyoci_timer_fires_before_(timer, self->timer_heap[parent])) {
+			break;
+		}
+
+		nyoci_timer_heap_place_(self, self->timer_heap[parent], index);
+		index = parent;
+	}
+
+	nyoci_timer_heap_place_(self, timer, index);
+}
+
+static void
+nyoci_timer_heap_sift_down_(nyoci_t self, uint32_t index)
+{
+	nyoci_timer_t const timer = self->timer_heap[index];
+
+	for (;;) {
+		uint32_t child = index * NYOCI_TIMER_HEAP_ARITY + 1;
+		uint32_t end = child + NYOCI_TIMER_HEAP_ARITY;
+		uint32_t best = child;
+
+		if (child >= self->timer_count) {
+			break;
+		}
+
+		if (end > self->timer_count) {
+			end = self->timer_count;
+		}
+
+		for (child++; child < end; child++) {
+			if (nyoci_timer_fires_before_(self->timer_heap[child], self->timer_heap[best])) {
+				best = child;
+			}
+		}
+
+		if (!nyoci_timer_fires_before_(self->timer_heap[best], timer)) {
+			break;
+		}
+
+		nyoci_timer_heap_place_(self, self->timer_heap[best], index);
+		index = best;
+	}
+
+	nyoci_timer_heap_place_(self, timer, index);
+}
+
+static nyoci_status_t
+nyoci_timer_heap_insert_(nyoci_t self, nyoci_timer_t timer)
+{
+	if (self->timer_count == self->timer_capacity) {
+		uint32_t capacity = self->timer_capacity
+			? self->timer_capacity * 2
+			: NYOCI_TIMER_HEAP_INITIAL_CAPACITY;
+		nyoci_timer_t* heap = realloc(self->timer_heap, capacity * sizeof(*heap));
+
+		if (heap == NULL) {
+			return NYOCI_STATUS_MALLOC_FAILURE;
+		}
+
+		self->timer_heap = heap;
+		self->timer_capacity = capacity;
+	}
+
+	nyoci_timer_heap_place_(self, timer, self->timer_count++);
+	nyoci_timer_heap_sift_up_(self, timer->heap_index - 1);
+
+	return NYOCI_STATUS_OK;
+}
+
+static void
+nyoci_timer_heap_remove_(nyoci_t self, nyoci_timer_t timer)
+{
+	uint32_t index = timer->heap_index - 1;
+	nyoci_timer_t last = self->timer_heap[--self->timer_count];
+
+	timer->heap_index = 0;
+
+	if (last != timer) {
+		nyoci_timer_heap_place_(self, last, index);
+		nyoci_timer_heap_sift_up_(self, index);
+		nyoci_timer_heap_sift_down_(self, last->heap_index - 1);
+	}
+}
+
+//!	Moves an already scheduled timer after its fire date has changed.
+static void
+nyoci_timer_heap_update_(nyoci_t self, nyoci_timer_t timer)
+{
+	nyoci_timer_heap_sift_up_(self, timer->heap_index - 1);
+	nyoci_timer_heap_sift_down_(self, timer->heap_index - 1);
+}
+
+#define nyoci_next_timer_(self)	((self)->timer_count ? (self)->timer_heap[0] : NULL)
+#define nyoci_timer_count_(self)	((size_t)(self)->timer_count)
+
+#else // NYOCI_TIMERS_USE_HEAP
+
 static ll_compare_result_t
 nyoci_timer_compare_func(
 	const void* lhs_, const void* rhs_, void* context
 ) {
 	const nyoci_timer_t lhs = (nyoci_timer_t)lhs_;
 	const nyoci_timer_t rhs = (nyoci_timer_t)rhs_;
-	nyoci_cms_t x = nyoci_plat_timestamp_diff(lhs->fire_date, rhs->fire_date);
+	nyoci_cms_t x = nyoci_timer_deadline_diff_(lhs, rhs);
 
 	if(x > 0) {
 		return 1;
@@ -75,6 +220,13 @@ nyoci_timer_compare_func(
 	return 0;
 }
 
+#define nyoci_next_timer_(self)	((self)->timers)
+#define nyoci_timer_count_(self)	ll_count((self)->timers)
+
+#endif // NYOCI_TIMERS_USE_HEAP
+
+// MARK: -
+
 nyoci_timer_t
 nyoci_timer_init(
 	nyoci_timer_t			self,
@@ -96,7 +248,12 @@ nyoci_timer_is_scheduled(
 	nyoci_t self, nyoci_timer_t timer
 ) {
 	NYOCI_SINGLETON_SELF_HOOK;
+#if NYOCI_TIMERS_USE_HEAP
+	(void)self; // The heap index alone tells us. Supress warning.
+	return timer->heap_index != 0;
+#else
 	return timer->ll.next || timer->ll.prev || (self->timers == timer);
+#endif
 }
 
 nyoci_status_t
@@ -104,31 +261,63 @@ nyoci_schedule_timer(
 	nyoci_t	self,
 	nyoci_timer_t	timer,
 	nyoci_cms_t			cms
+) {
+	NYOCI_SINGLETON_SELF_HOOK;
+	return nyoci_schedule_timer_with_slack(self, timer, cms, 0);
+}
+
+nyoci_status_t
+nyoci_schedule_timer_with_slack(
+	nyoci_t	self,
+	nyoci_timer_t	timer,
+	nyoci_cms_t			cms,
+	nyoci_cms_t			slack
 ) {
 	nyoci_status_t ret = NYOCI_STATUS_FAILURE;
+	bool was_scheduled;
 	NYOCI_SINGLETON_SELF_HOOK;
 
 	assert(self!=NULL);
 	assert(timer!=NULL);
 
-	// If we are already scheduled, go
-	// ahead and remove us from the list
-	if (nyoci_timer_is_scheduled(self, timer)) {
-		ll_remove((void**)&self->timers, (void*)timer);
+	was_scheduled = nyoci_timer_is_scheduled(self, timer);
+
+	if (was_scheduled) {
 		DEBUG_PRINTF("Timer:%p: Rescheduling to fire in %dms ...",timer,cms);
 	} else {
 		DEBUG_PRINTF("Timer:%p: Scheduling to fire in %dms ...",timer,cms);
 	}
 
 #if NYOCI_DEBUG_TIMERS
-	size_t previousTimerCount = ll_count(self->timers);
+	size_t previousTimerCount = nyoci_timer_count_(self);
 #endif
 
 	if (cms < 0) {
 		cms = 0;
 	}
 
+	if (slack < 0) {
+		slack = 0;
+	}
+
 	timer->fire_date = nyoci_plat_cms_to_timestamp(cms);
+	timer->slack = slack;
+
+#if NYOCI_TIMERS_USE_HEAP
+	timer->heap_sequence = self->timer_sequence++;
+
+	if (was_scheduled) {
+		nyoci_timer_heap_update_(self, timer);
+	} else {
+		ret = nyoci_timer_heap_insert_(self, timer);
+		require_noerr(ret, bail);
+	}
+#else
+	// If we are already scheduled, go
+	// ahead and remove us from the list
+	if (was_scheduled) {
+		ll_remove((void**)&self->timers, (void*)timer);
+	}
 
 	ll_sorted_insert(
 			(void**)&self->timers,
@@ -136,14 +325,15 @@ nyoci_schedule_timer(
 		&nyoci_timer_compare_func,
 		NULL
 	);
+#endif
 
 	ret = NYOCI_STATUS_OK;
 
 	DEBUG_PRINTF("Timer:%p(CTX=%p): Scheduled.",timer,timer->context);
-	DEBUG_PRINTF("%p: Timers in play = %d",self,(int)ll_count(self->timers));
+	DEBUG_PRINTF("%p: Timers in play = %d",self,(int)nyoci_timer_count_(self));
 
 #if NYOCI_DEBUG_TIMERS
-	assert((ll_count(self->timers)) == previousTimerCount+1);
+	assert(nyoci_timer_count_(self) == previousTimerCount + !was_scheduled);
 #endif
 
 bail:
@@ -157,7 +347,7 @@ nyoci_invalidate_timer(
 ) {
 	NYOCI_SINGLETON_SELF_HOOK;
 #if NYOCI_DEBUG_TIMERS
-	size_t previousTimerCount = ll_count(self->timers);
+	size_t previousTimerCount = nyoci_timer_count_(self);
 	// Sanity check. If we don't have at least one timer
 	// then we know something is off.
 	check(previousTimerCount>=1);
@@ -166,17 +356,23 @@ nyoci_invalidate_timer(
 	DEBUG_PRINTF("Timer:%p: Invalidating...",timer);
 	DEBUG_PRINTF("Timer:%p: (CTX=%p)",timer,timer->context);
 
+#if NYOCI_TIMERS_USE_HEAP
+	if (timer->heap_index != 0) {
+		nyoci_timer_heap_remove_(self, timer);
+	}
+#else
 	ll_remove((void**)&self->timers, (void*)timer);
+#endif
 
 #if NYOCI_DEBUG_TIMERS
-	check((ll_count(self->timers)) == previousTimerCount-1);
+	check(nyoci_timer_count_(self) == previousTimerCount-1);
 #endif
 	timer->ll.next = NULL;
 	timer->ll.prev = NULL;
 	if(timer->cancel)
 		(*timer->cancel)(self,timer->context);
 	DEBUG_PRINTF("Timer:%p: Invalidated.",timer);
-	DEBUG_PRINTF("%p: Timers in play = %d",self,(int)ll_count(self->timers));
+	DEBUG_PRINTF("%p: Timers in play = %d",self,(int)nyoci_timer_count_(self));
 }
 
 #if NYOCI_DEBUG_TIMERS || VERBOSE_DEBUG
@@ -184,10 +380,17 @@ static void
 nyoci_dump_all_timers(nyoci_t self) {
 	nyoci_timer_t iter;
 
-	if (self->timers) {
+	if (nyoci_next_timer_(self)) {
 		DEBUG_PRINTF("nyoci(%p): Current Timers:",self);
 
+#if NYOCI_TIMERS_USE_HEAP
+		// In heap order, not in firing order.
+		uint32_t i;
+		for (i = 0; i < self->timer_count; i++) {
+			iter = self->timer_heap[i];
+#else
 		for (iter = self->timers;iter;iter = (void*)iter->ll.next) {
+#endif
 			DEBUG_PRINTF("\t* [%p] expires-in:%dms context:%p",iter,nyoci_plat_timestamp_to_cms(iter->fire_date),iter->context);
 		}
 	} else {
@@ -201,8 +404,9 @@ nyoci_get_timeout(nyoci_t self) {
 	nyoci_cms_t ret = NYOCI_MAX_TIMEOUT;
 	NYOCI_SINGLETON_SELF_HOOK;
 
-	if (self->timers) {
-		ret = MIN(ret, nyoci_plat_timestamp_to_cms(self->timers->fire_date));
+	if (nyoci_next_timer_(self)) {
+		nyoci_timer_t const next = nyoci_next_timer_(self);
+		ret = MIN(ret, nyoci_plat_timestamp_to_cms(next->fire_date) + next->slack);
 	}
 
 	ret = MAX(ret, 0);
@@ -216,30 +420,99 @@ nyoci_get_timeout(nyoci_t self) {
 	return ret;
 }
 
-void
+#if NYOCI_CONF_TIMER_STATS
+static void
+nyoci_timer_record_lateness_(nyoci_t self, nyoci_cms_t lateness)
+{
+	struct nyoci_timer_stats_s* const stats = &self->timer_stats;
+	int bucket = 0;
+
+	if (lateness < 0) {
+		lateness = 0;
+	}
+
+	while ((lateness >> bucket) != 0 && bucket < NYOCI_TIMER_LATENESS_BUCKETS - 1) {
+		bucket++;
+	}
+
+	stats->fired++;
+	stats->lateness[bucket]++;
+
+	if (lateness > stats->max_lateness) {
+		stats->max_lateness = lateness;
+	}
+}
+#endif
+
+int
 nyoci_handle_timers(nyoci_t self) {
 	NYOCI_SINGLETON_SELF_HOOK;
+	NYOCI_NON_RECURSIVE nyoci_timer_t timer;
+	NYOCI_NON_RECURSIVE nyoci_timer_callback_t callback;
+	NYOCI_NON_RECURSIVE void* context;
+	nyoci_timestamp_t start = nyoci_plat_cms_to_timestamp(0);
+	int count = 0;
+
 	nyoci_set_current_instance(self);
-	if (self->timers
-		&& (nyoci_plat_timestamp_to_cms(self->timers->fire_date) <= 0)
+
+	// Only fire what was due when we started, so that a timer that
+	// keeps rescheduling itself for "now" can't keep us here forever.
+	// Timers are ordered by deadline, so this also picks up timers
+	// whose slack would have let them wait longer, but stops at the
+	// first one that isn't due yet.
+	while ((timer = nyoci_next_timer_(self)) != NULL
+		&& (nyoci_plat_timestamp_diff(timer->fire_date, start) <= 0)
 	) {
-		NYOCI_NON_RECURSIVE nyoci_timer_t timer;
-		NYOCI_NON_RECURSIVE nyoci_timer_callback_t callback;
-		NYOCI_NON_RECURSIVE void* context;
+		if ((self->timer_budget > 0) && (count >= self->timer_budget)) {
+#if NYOCI_CONF_TIMER_STATS
+			self->timer_stats.over_budget++;
+#endif
+			break;
+		}
 
-		timer = self->timers;
 		callback = timer->callback;
 		context = timer->context;
 
 		DEBUG_PRINTF("Timer:%p(CTX=%p): Firing...",timer,timer->context);
 
+#if NYOCI_CONF_TIMER_STATS
+		nyoci_timer_record_lateness_(self, -nyoci_plat_timestamp_to_cms(timer->fire_date) - timer->slack);
+#endif
+
 		timer->cancel = NULL;
 		nyoci_invalidate_timer(self, timer);
+		count++;
+
 		if (callback) {
 			callback(self, context);
 		}
 	}
 #if NYOCI_DEBUG_TIMERS
 	nyoci_dump_all_timers(self);
+#endif
+	return count;
+}
+
+void
+nyoci_set_timer_budget(nyoci_t self, int budget) {
+	NYOCI_SINGLETON_SELF_HOOK;
+	self->timer_budget = budget;
+}
+
+void
+nyoci_get_timer_stats(nyoci_t self, struct nyoci_timer_stats_s* stats) {
+	NYOCI_SINGLETON_SELF_HOOK;
+#if NYOCI_CONF_TIMER_STATS
+	*stats = self->timer_stats;
+#else
+	memset(stats, 0, sizeof(*stats));
+#endif
+}
+
+void
+nyoci_reset_timer_stats(nyoci_t self) {
+	NYOCI_SINGLETON_SELF_HOOK;
+#if NYOCI_CONF_TIMER_STATS
+	memset(&self->timer_stats, 0, sizeof(self->timer_stats));
 #endif
 }
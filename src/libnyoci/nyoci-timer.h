@@ -44,9 +44,13 @@
 // from many functions. In order to make things as maintainable
 // as possible, these macros do all of the work for us.
 #define nyoci_schedule_timer(self,...)		nyoci_schedule_timer(__VA_ARGS__)
+#define nyoci_schedule_timer_with_slack(self,...)		nyoci_schedule_timer_with_slack(__VA_ARGS__)
 #define nyoci_invalidate_timer(self,...)		nyoci_invalidate_timer(__VA_ARGS__)
 #define nyoci_handle_timers(self,...)		nyoci_handle_timers(__VA_ARGS__)
 #define nyoci_timer_is_scheduled(self,...)		nyoci_timer_is_scheduled(__VA_ARGS__)
+#define nyoci_set_timer_budget(self,...)		nyoci_set_timer_budget(__VA_ARGS__)
+#define nyoci_get_timer_stats(self,...)		nyoci_get_timer_stats(__VA_ARGS__)
+#define nyoci_reset_timer_stats(self)		nyoci_reset_timer_stats()
 #endif
 
 #ifndef MSEC_PER_SEC
@@ -87,11 +91,21 @@ NYOCI_BEGIN_C_DECLS
 typedef void (*nyoci_timer_callback_t)(nyoci_t, void*);
 
 typedef struct nyoci_timer_s {
+	//!	Used when timers are kept in a sorted list (`NYOCI_TIMERS_USE_HEAP` is 0).
 	struct ll_item_s		ll;
 	nyoci_timestamp_t		fire_date;
 	void*					context;
 	nyoci_timer_callback_t	callback;
 	nyoci_timer_callback_t	cancel;
+
+	//!	How much later than `fire_date` the timer may fire, in milliseconds.
+	nyoci_cms_t				slack;
+
+	//!	Position in the timer heap, plus one. Zero when not scheduled.
+	uint32_t				heap_index;
+
+	//!	When the timer was scheduled, relative to other timers.
+	uint32_t				heap_sequence;
 } *nyoci_timer_t;
 
 NYOCI_API_EXTERN nyoci_timer_t nyoci_timer_init(
@@ -107,11 +121,63 @@ NYOCI_API_EXTERN nyoci_status_t nyoci_schedule_timer(
 	nyoci_cms_t			cms
 );
 
+//!	Schedules `timer` to fire `cms` milliseconds from now, give or take `slack`.
+/*!	The timer never fires early, but may fire up to `slack` milliseconds
+**	late. Timers whose windows overlap are fired together in one wakeup
+**	instead of each waking the loop up on its own. Timers that must be
+**	punctual should use nyoci_schedule_timer(), which has no slack. */
+NYOCI_API_EXTERN nyoci_status_t nyoci_schedule_timer_with_slack(
+	nyoci_t	self,
+	nyoci_timer_t	timer,
+	nyoci_cms_t			cms,
+	nyoci_cms_t			slack
+);
+
 NYOCI_API_EXTERN void nyoci_invalidate_timer(nyoci_t self, nyoci_timer_t timer);
 NYOCI_API_EXTERN nyoci_cms_t nyoci_get_timeout(nyoci_t self);
-NYOCI_API_EXTERN void nyoci_handle_timers(nyoci_t self);
+
+//!	Fires the timers that had expired when the call was made.
+/*!	Stops early once the budget set by nyoci_set_timer_budget() has
+**	been used up; the remaining timers stay due and are fired by the
+**	next call. Timers that expire while the callbacks are running are
+**	also left for the next call.
+**	Returns the number of timers that were fired. */
+NYOCI_API_EXTERN int nyoci_handle_timers(nyoci_t self);
+
 NYOCI_API_EXTERN bool nyoci_timer_is_scheduled(nyoci_t self, nyoci_timer_t timer);
 
+//!	Sets how many timers a single call to nyoci_handle_timers() may fire.
+/*!	Zero or less means no limit. Defaults to `NYOCI_CONF_TIMER_BUDGET`. */
+NYOCI_API_EXTERN void nyoci_set_timer_budget(nyoci_t self, int budget);
+
+//!	Number of buckets in `nyoci_timer_stats_s::lateness`.
+#define NYOCI_TIMER_LATENESS_BUCKETS		12
+
+struct nyoci_timer_stats_s {
+	//!	Total number of timers fired.
+	uint32_t		fired;
+
+	//!	Number of calls to nyoci_handle_timers() that ran out of budget.
+	uint32_t		over_budget;
+
+	//!	Latest firing seen, in milliseconds past the end of the slack.
+	nyoci_cms_t		max_lateness;
+
+	//!	Histogram of how late timers fired.
+	/*!	Lateness is measured from the end of each timer's slack.
+	**	Bucket 0 counts timers that fired on time (less than 1ms late),
+	**	bucket `n` counts timers that were between 2^(n-1) and 2^n - 1
+	**	milliseconds late, and the last bucket counts everything later. */
+	uint32_t		lateness[NYOCI_TIMER_LATENESS_BUCKETS];
+};
+
+//!	Copies the timer counters into `stats`.
+/*!	Only available when `NYOCI_CONF_TIMER_STATS` is set; otherwise
+**	`stats` is zeroed. */
+NYOCI_API_EXTERN void nyoci_get_timer_stats(nyoci_t self, struct nyoci_timer_stats_s* stats);
+
+NYOCI_API_EXTERN void nyoci_reset_timer_stats(nyoci_t self);
+
 /*!	@} */
 /*!	@} */
 
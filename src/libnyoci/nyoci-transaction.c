@@ -37,12 +37,203 @@
 #include "nyoci-logging.h"
 #include "nyoci-missing.h"
 
-#if NYOCI_AVOID_MALLOC && NYOCI_TRANSACTION_POOL_SIZE
-#warning Transaction pool should be moved into the LibNyoci instance.
-static struct nyoci_transaction_s nyoci_transaction_pool[NYOCI_TRANSACTION_POOL_SIZE];
-#endif // NYOCI_AVOID_MALLOC
+// MARK: -
+// MARK: Transaction Slab
+
+#if !NYOCI_AVOID_MALLOC
+struct nyoci_transaction_chunk_s {
+	struct nyoci_transaction_chunk_s* next;
+	uint32_t				count;
+	struct nyoci_transaction_s item[];
+};
+#endif
+
+//!	Makes room for `count` more transactions on the free list.
+static nyoci_status_t
+nyoci_transaction_slab_grow_(nyoci_t self, uint32_t count)
+{
+	struct nyoci_transaction_slab_s* const slab = &self->transaction_slab;
+	nyoci_status_t ret = NYOCI_STATUS_OK;
+	nyoci_transaction_t items;
+	uint32_t i;
+
+#if NYOCI_AVOID_MALLOC
+	// The pool is all there is.
+	require_action_string(
+		slab->stats.capacity == 0 && count <= NYOCI_TRANSACTION_POOL_SIZE,
+		bail,
+		ret = NYOCI_STATUS_MALLOC_FAILURE,
+		"Transaction pool exhausted"
+	);
+#if NYOCI_TRANSACTION_POOL_SIZE
+	items = slab->pool;
+#else
+	items = NULL;
+#endif
+	count = NYOCI_TRANSACTION_POOL_SIZE;
+#else
+	struct nyoci_transaction_chunk_s* chunk;
+
+	if (count < NYOCI_CONF_TRANSACTION_SLAB_CHUNK) {
+		count = NYOCI_CONF_TRANSACTION_SLAB_CHUNK;
+	}
+	if (count < slab->stats.capacity) {
+		count = slab->stats.capacity;
+	}
+
+	chunk = malloc(sizeof(*chunk) + count * sizeof(chunk->item[0]));
+	require_action(chunk != NULL, bail, ret = NYOCI_STATUS_MALLOC_FAILURE);
+
+	chunk->count = count;
+	chunk->next = slab->chunks;
+	slab->chunks = chunk;
+	slab->stats.grows++;
+	items = chunk->item;
+#endif
+
+	// Push them in reverse, so they get handed out in address order.
+	for (i = count; i > 0; i--) {
+		items[i - 1].parked_next = slab->free_list;
+		slab->free_list = &items[i - 1];
+	}
+
+	slab->stats.capacity += count;
+
+bail:
+	return ret;
+}
+
+static nyoci_transaction_t
+nyoci_transaction_slab_alloc_(nyoci_t self)
+{
+	struct nyoci_transaction_slab_s* const slab = &self->transaction_slab;
+	nyoci_transaction_t handler = NULL;
+
+	if (slab->free_list == NULL) {
+		require_noerr(nyoci_transaction_slab_grow_(self, 0), bail);
+	}
+
+	require(slab->free_list != NULL, bail);
+
+	handler = slab->free_list;
+	slab->free_list = handler->parked_next;
+
+	memset(handler, 0, sizeof(*handler));
+	handler->from_slab = 1;
+
+	if (++slab->stats.in_use > slab->stats.high_water) {
+		slab->stats.high_water = slab->stats.in_use;
+	}
+
+bail:
+	return handler;
+}
+
+static void
+nyoci_transaction_slab_free_(nyoci_t self, nyoci_transaction_t handler)
+{
+	struct nyoci_transaction_slab_s* const slab = &self->transaction_slab;
+
+	handler->parked_next = slab->free_list;
+	slab->free_list = handler;
+	slab->stats.in_use--;
+}
+
+//!	Gives back the memory of `handler` if it was allocated for it.
+static void
+nyoci_transaction_dealloc_(nyoci_t self, nyoci_transaction_t handler)
+{
+	if (handler->should_dealloc) {
+		if (handler->from_slab) {
+			nyoci_transaction_slab_free_(self, handler);
+		}
+#if !NYOCI_AVOID_MALLOC
+		else {
+			free(handler);
+		}
+#endif
+	}
+}
+
+void
+nyoci_internal_transaction_slab_finalize(nyoci_t self)
+{
+#if !NYOCI_AVOID_MALLOC
+	struct nyoci_transaction_slab_s* const slab = &self->transaction_slab;
+
+	check_string(slab->stats.in_use == 0, "Transactions still in use");
+
+	while (slab->chunks != NULL) {
+		struct nyoci_transaction_chunk_s* const chunk = slab->chunks;
+
+		slab->chunks = chunk->next;
+		free(chunk);
+	}
+
+	slab->free_list = NULL;
+	slab->stats.capacity = 0;
+#endif
+}
+
+nyoci_status_t
+nyoci_transaction_reserve(nyoci_t self, uint32_t count)
+{
+	NYOCI_SINGLETON_SELF_HOOK;
+	struct nyoci_transaction_slab_s* const slab = &self->transaction_slab;
+	uint32_t available = slab->stats.capacity - slab->stats.in_use;
+
+	if (available >= count) {
+		return NYOCI_STATUS_OK;
+	}
+
+	return nyoci_transaction_slab_grow_(self, count - available);
+}
+
+void
+nyoci_transaction_get_slab_stats(
+	nyoci_t self,
+	struct nyoci_transaction_slab_stats_s* stats
+) {
+	NYOCI_SINGLETON_SELF_HOOK;
+
+	*stats = self->transaction_slab.stats;
+}
+
+// MARK: -
+
+//!	Orders transactions by message id, then by remote endpoint.
+/*!	Message ids are allocated per peer (see nyoci_peer_next_msg_id()),
+**	so the same message id can be in use towards several peers. */
+static int
+nyoci_transaction_compare_key_(
+	const nyoci_transaction_t lhs,
+	coap_msg_id_t msg_id,
+	const nyoci_sockaddr_t* remote
+) {
+	int ret;
+
+	if (lhs->msg_id > msg_id) {
+		return 1;
+	}
+	if (lhs->msg_id < msg_id) {
+		return -1;
+	}
+
+	ret = memcmp(&lhs->sockaddr_remote.nyoci_addr, &remote->nyoci_addr, sizeof(nyoci_addr_t));
+
+	if (ret == 0) {
+		ret = memcmp(&lhs->sockaddr_remote.nyoci_port, &remote->nyoci_port, sizeof(remote->nyoci_port));
+	}
+
+	return ret;
+}
 
 #if NYOCI_TRANSACTIONS_USE_BTREE
+struct nyoci_transaction_key_s {
+	coap_msg_id_t msg_id;
+	const nyoci_sockaddr_t* remote;
+};
+
 static bt_compare_result_t
 nyoci_transaction_compare(
 	const void* lhs_, const void* rhs_, void* context
@@ -50,13 +241,7 @@ nyoci_transaction_compare(
 	const nyoci_transaction_t lhs = (nyoci_transaction_t)lhs_;
 	const nyoci_transaction_t rhs = (nyoci_transaction_t)rhs_;
 
-	if (lhs->msg_id > rhs->msg_id) {
-		return 1;
-	}
-	if (lhs->msg_id < rhs->msg_id) {
-		return -1;
-	}
-	return 0;
+	return nyoci_transaction_compare_key_(lhs, rhs->msg_id, &rhs->sockaddr_remote);
 }
 
 static bt_compare_result_t
@@ -64,54 +249,307 @@ nyoci_transaction_compare_msg_id(
 	const void* lhs_, const void* rhs_, void* context
 ) {
 	const nyoci_transaction_t lhs = (nyoci_transaction_t)lhs_;
-	coap_msg_id_t rhs = (coap_msg_id_t)(uintptr_t)rhs_;
+	const struct nyoci_transaction_key_s* rhs = rhs_;
 
-	if(lhs->msg_id > rhs) {
-		return 1;
-	}
-	if(lhs->msg_id < rhs) {
-		return -1;
-	}
-	return 0;
+	return nyoci_transaction_compare_key_(lhs, rhs->msg_id, rhs->remote);
 }
 #endif
 
 static nyoci_transaction_t
-nyoci_transaction_find_via_msg_id(nyoci_t self, coap_msg_id_t msg_id) {
+nyoci_transaction_find_via_msg_id(
+	nyoci_t self,
+	coap_msg_id_t msg_id,
+	const nyoci_sockaddr_t* remote
+) {
 	NYOCI_SINGLETON_SELF_HOOK;
 
 #if NYOCI_TRANSACTIONS_USE_BTREE
+	struct nyoci_transaction_key_s key = { msg_id, remote };
+
 	return (nyoci_transaction_t)bt_find(
 		(void*)&self->transactions,
-		(void*)(uintptr_t)msg_id,
+		&key,
 		(bt_compare_func_t)nyoci_transaction_compare_msg_id,
 		self
 	);
 #else
 	// Ouch. Linear search.
 	nyoci_transaction_t ret = self->transactions;
-	while(ret && (ret->msg_id != msg_id)) ret = ll_next((void*)ret);
+	while(ret && (0 != nyoci_transaction_compare_key_(ret, msg_id, remote))) ret = ll_next((void*)ret);
 	return ret;
 #endif
 
 }
 
+//!	A packet kept for retransmission, see `NYOCI_TRANSACTION_CACHE_PACKET`.
+struct nyoci_transaction_packet_s {
+	nyoci_session_type_t	session_type;
+	nyoci_sockaddr_t		sockaddr_local;
+	coap_size_t				len;
+	uint8_t					data[];
+};
+
+static void
+nyoci_transaction_drop_cached_packet_(nyoci_transaction_t handler)
+{
+#if !NYOCI_AVOID_MALLOC
+	free(handler->cached_packet);
+	handler->cached_packet = NULL;
+#else
+	(void)handler; // Nothing is cached without malloc. Supress warning.
+#endif
+}
+
+void
+nyoci_internal_transaction_cache_packet(
+	nyoci_t self,
+	nyoci_transaction_t handler,
+	const struct coap_header_s* packet,
+	coap_size_t packet_len
+) {
+	(void)self; // This parameter is not used. Supress warning.
+
+#if !NYOCI_AVOID_MALLOC
+	require_quiet(handler->flags & NYOCI_TRANSACTION_CACHE_PACKET, bail);
+	require_quiet(handler->active, bail);
+	require_quiet(handler->cached_packet == NULL, bail);
+	require_quiet(packet->msg_id == handler->msg_id, bail);
+
+	handler->cached_packet = malloc(sizeof(*handler->cached_packet) + packet_len);
+	require(handler->cached_packet != NULL, bail);
+
+	handler->cached_packet->session_type = nyoci_plat_get_session_type();
+	handler->cached_packet->sockaddr_local = *nyoci_plat_get_local_sockaddr();
+	handler->cached_packet->len = packet_len;
+	memcpy(handler->cached_packet->data, packet, packet_len);
+
+bail:
+	return;
+#else
+	// Nothing is cached without malloc. Supress warnings.
+	(void)handler;
+	(void)packet;
+	(void)packet_len;
+#endif
+}
+
+static nyoci_status_t
+nyoci_transaction_resend_cached_packet_(nyoci_t self, nyoci_transaction_t handler)
+{
+	// Whatever inbound packet came last left its local address
+	// behind, and it must not pick the source of this one.
+	nyoci_plat_set_remote_sockaddr(&handler->sockaddr_remote);
+	nyoci_plat_set_local_sockaddr(&handler->cached_packet->sockaddr_local);
+	nyoci_plat_set_session_type(handler->cached_packet->session_type);
+
+	return nyoci_plat_outbound_finish(
+		self,
+		handler->cached_packet->data,
+		handler->cached_packet->len,
+		0
+	);
+}
+
+static bool
+nyoci_transaction_token_matches_(
+	nyoci_transaction_t handler,
+	const uint8_t* token,
+	uint8_t token_len
+) {
+	return (handler->token_len == token_len)
+		&& (0 == memcmp(handler->token, token, token_len));
+}
+
+#if NYOCI_TRANSACTIONS_USE_TOKEN_HASH
+
+// MARK: -
+// MARK: Token Index
+
+#define NYOCI_TOKEN_TABLE_MIN_SIZE		32
+
+static uint32_t
+nyoci_token_table_home_(nyoci_t self, const uint8_t* token, uint8_t token_len) {
+	uint64_t hash = token_len;
+
+	while (token_len--) {
+		hash = (hash << 8) | *token++;
+	}
+
+	hash *= UINT64_C(0x9E3779B97F4A7C15);
+
+	return (uint32_t)(hash >> 32) & (self->token_table_size - 1);
+}
+
+static nyoci_status_t
+nyoci_token_table_grow_(nyoci_t self) {
+	nyoci_transaction_t* old_table = self->token_table;
+	uint32_t old_size = self->token_table_size;
+	uint32_t size = old_size ? old_size * 2 : NYOCI_TOKEN_TABLE_MIN_SIZE;
+	uint32_t i;
+
+	self->token_table = calloc(size, sizeof(*self->token_table));
+
+	if (self->token_table == NULL) {
+		self->token_table = old_table;
+		return NYOCI_STATUS_MALLOC_FAILURE;
+	}
+
+	self->token_table_size = size;
+
+	for (i = 0; i < old_size; i++) {
+		if (old_table[i] != NULL) {
+			uint32_t j = nyoci_token_table_home_(self, old_table[i]->token, old_table[i]->token_len);
+
+			while (self->token_table[j] != NULL) {
+				j = (j + 1) & (size - 1);
+			}
+
+			self->token_table[j] = old_table[i];
+		}
+	}
+
+	free(old_table);
+
+	return NYOCI_STATUS_OK;
+}
+
+static nyoci_status_t
+nyoci_token_table_insert_(nyoci_t self, nyoci_transaction_t handler) {
+	uint32_t i;
+
+	// Keep the load factor at or below one half.
+	if ((self->token_table_count + 1) * 2 > self->token_table_size) {
+		nyoci_status_t status = nyoci_token_table_grow_(self);
+
+		if (status != NYOCI_STATUS_OK) {
+			return status;
+		}
+	}
+
+	i = nyoci_token_table_home_(self, handler->token, handler->token_len);
+
+	while (self->token_table[i] != NULL) {
+		i = (i + 1) & (self->token_table_size - 1);
+	}
+
+	self->token_table[i] = handler;
+	self->token_table_count++;
+
+	return NYOCI_STATUS_OK;
+}
+
+static void
+nyoci_token_table_remove_(nyoci_t self, nyoci_transaction_t handler) {
+	uint32_t mask = self->token_table_size - 1;
+	uint32_t i, j;
+
+	if (self->token_table_count == 0) {
+		return;
+	}
+
+	i = nyoci_token_table_home_(self, handler->token, handler->token_len);
+
+	while (self->token_table[i] != handler) {
+		if (self->token_table[i] == NULL) {
+			// Not in the table.
+			return;
+		}
+		i = (i + 1) & mask;
+	}
+
+	self->token_table[i] = NULL;
+	self->token_table_count--;
+
+	// Shift later members of the probe run back into the hole, so
+	// lookups never need tombstones.
+	for (j = (i + 1) & mask; self->token_table[j] != NULL; j = (j + 1) & mask) {
+		uint32_t home = nyoci_token_table_home_(self, self->token_table[j]->token, self->token_table[j]->token_len);
+
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			self->token_table[i] = self->token_table[j];
+			self->token_table[j] = NULL;
+			i = j;
+		}
+	}
+}
+
+#endif // NYOCI_TRANSACTIONS_USE_TOKEN_HASH
+
 static nyoci_transaction_t
-nyoci_transaction_find_via_token(nyoci_t self, coap_msg_id_t token) {
+nyoci_transaction_find_via_token(nyoci_t self, const uint8_t* token, uint8_t token_len) {
 	NYOCI_SINGLETON_SELF_HOOK;
 
+#if NYOCI_TRANSACTIONS_USE_TOKEN_HASH
+	nyoci_transaction_t ret = NULL;
+
+	if (self->token_table_count != 0) {
+		uint32_t i = nyoci_token_table_home_(self, token, token_len);
+
+		while ((ret = self->token_table[i]) != NULL
+			&& !nyoci_transaction_token_matches_(ret, token, token_len)
+		) {
+			i = (i + 1) & (self->token_table_size - 1);
+		}
+	}
+#elif NYOCI_TRANSACTIONS_USE_BTREE
 	// Ouch. Linear search.
-#if NYOCI_TRANSACTIONS_USE_BTREE
 	nyoci_transaction_t ret = bt_first(self->transactions);
-	while(ret && (ret->token != token)) ret = bt_next(ret);
+	while(ret && !nyoci_transaction_token_matches_(ret, token, token_len)) ret = bt_next(ret);
 #else
+	// Ouch. Linear search.
 	nyoci_transaction_t ret = self->transactions;
-	while(ret && (ret->token != token)) ret = ll_next((void*)ret);
+	while(ret && !nyoci_transaction_token_matches_(ret, token, token_len)) ret = ll_next((void*)ret);
 #endif
 
 	return ret;
 }
 
+//!	Gives `handler` a fresh token of `self->token_len` bytes.
+/*!	The token is the low bytes of a per-instance counter that has
+**	been multiplied by an odd constant and XORed with a random salt.
+**	Both steps are bijections on the low bytes, so a token of `n`
+**	bytes is not reused for 2^(8n) transactions, while consecutive
+**	tokens still look unrelated on the wire. Tokens that happen to
+**	belong to a transaction which is still active are skipped. */
+static void
+nyoci_transaction_next_token_(nyoci_t self, nyoci_transaction_t handler) {
+	int attempts = 8;
+
+	if (self->token_salt == 0) {
+		self->token_salt = ((uint64_t)NYOCI_FUNC_RANDOM_UINT32() << 32)
+			| NYOCI_FUNC_RANDOM_UINT32()
+			| 1;
+	}
+
+	handler->token_len = self->token_len;
+
+	do {
+		uint64_t value = ++self->token_counter * UINT64_C(0x9E3779B97F4A7C15);
+		uint8_t i;
+
+		value ^= self->token_salt;
+
+		for (i = 0; i < handler->token_len; i++) {
+			handler->token[i] = (uint8_t)(value >> (8 * i));
+		}
+	} while ( --attempts
+	       && nyoci_transaction_find_via_token(self, handler->token, handler->token_len) != NULL
+	);
+}
+
+nyoci_status_t
+nyoci_set_token_length(nyoci_t self, uint8_t token_len) {
+	NYOCI_SINGLETON_SELF_HOOK;
+
+	if ((token_len < 1) || (token_len > COAP_MAX_TOKEN_SIZE)) {
+		return NYOCI_STATUS_INVALID_ARGUMENT;
+	}
+
+	self->token_len = token_len;
+
+	return NYOCI_STATUS_OK;
+}
+
 static void
 nyoci_internal_delete_transaction_(
 	nyoci_transaction_t handler,
@@ -132,8 +570,15 @@ nyoci_internal_delete_transaction_(
 	// Remove the timer associated with this handler.
 	nyoci_invalidate_timer(self, &handler->timer);
 
+#if NYOCI_TRANSACTIONS_USE_TOKEN_HASH
+	nyoci_token_table_remove_(self, handler);
+#endif
+
 	handler->active = 0;
 
+	nyoci_transaction_drop_cached_packet_(handler);
+	nyoci_peer_nstart_release(self, handler);
+
 	// Fire the callback to signal that this handler is now invalidated.
 	if(handler->callback) {
 		(*handler->callback)(
@@ -142,22 +587,28 @@ nyoci_internal_delete_transaction_(
 		);
 	}
 
-#if NYOCI_AVOID_MALLOC
-#if NYOCI_TRANSACTION_POOL_SIZE
-	if (handler->should_dealloc) {
-		handler->callback = NULL;
-	}
-#endif
-#else
-	if (handler->should_dealloc) {
-		free(handler);
-	}
-#endif
+	nyoci_transaction_dealloc_(self, handler);
 }
 
 static nyoci_cms_t
-calc_retransmit_timeout(int retries, bool burst) {
-	nyoci_cms_t ret = (nyoci_cms_t)(COAP_ACK_TIMEOUT * MSEC_PER_SEC);
+calc_retransmit_timeout(nyoci_t self, nyoci_transaction_t handler, int retries, bool burst) {
+	const nyoci_cms_t rto = nyoci_peer_get_rto(self, &handler->sockaddr_remote);
+	nyoci_cms_t ret = rto;
+
+	// Like RFC6298, backing off stops at the largest RTO allowed by
+	// nyoci_set_rto_bounds(), but not below the
+	// COAP_MAX_ACK_RETRANSMIT_DURATION that applied before.
+	nyoci_cms_t ceiling = self->rto_max;
+
+#if defined(COAP_MAX_ACK_RETRANSMIT_DURATION)
+	if (ceiling < COAP_MAX_ACK_RETRANSMIT_DURATION * MSEC_PER_SEC) {
+		ceiling = COAP_MAX_ACK_RETRANSMIT_DURATION * MSEC_PER_SEC;
+	}
+#endif
+
+	if (ceiling > NYOCI_CONF_MAX_TIMEOUT * MSEC_PER_SEC) {
+		ceiling = NYOCI_CONF_MAX_TIMEOUT * MSEC_PER_SEC;
+	}
 
 	if (burst) {
 		if ((retries % NYOCI_TRANSACTION_BURST_COUNT) != (NYOCI_TRANSACTION_BURST_COUNT - 1)) {
@@ -168,33 +619,65 @@ calc_retransmit_timeout(int retries, bool burst) {
 		retries /= NYOCI_TRANSACTION_BURST_COUNT;
 	}
 
-	ret <<= retries;
+	// CoCoA variable backoff: back off faster from small timeouts
+	// and slower from large ones.
+	while ((retries-- > 0) && (ret < ceiling)) {
+		if (rto < 1*MSEC_PER_SEC) {
+			ret *= 3;
+		} else if (rto > 3*MSEC_PER_SEC) {
+			ret += ret / 2;
+		} else {
+			ret *= 2;
+		}
+	}
 
-	ret *= 512 + (NYOCI_FUNC_RANDOM_UINT32() % (int)(512*(COAP_ACK_RANDOM_FACTOR-1.0f)));
-	ret /= 512;
+	if (ret > ceiling) {
+		ret = ceiling;
+	}
 
-bail:
+	// Long timeouts times 512 don't fit in 32 bits.
+	ret = (nyoci_cms_t)(
+		((int64_t)ret * (512 + (NYOCI_FUNC_RANDOM_UINT32() % (int)(512*(COAP_ACK_RANDOM_FACTOR-1.0f))))) / 512
+	);
 
-#if defined(COAP_MAX_ACK_RETRANSMIT_DURATION)
-	if (ret > COAP_MAX_ACK_RETRANSMIT_DURATION * MSEC_PER_SEC)
-		ret = COAP_MAX_ACK_RETRANSMIT_DURATION * MSEC_PER_SEC;
-#endif
+bail:
+	if (ret > ceiling) {
+		ret = ceiling;
+	}
 
 	DEBUG_PRINTF("Will try attempt #%d in %dms",retries,ret);
 	return ret;
 }
 
+//!	Schedules the timer of `handler`, letting it fire a little late.
+static nyoci_status_t
+nyoci_transaction_schedule_timer_(
+	nyoci_t			self,
+	nyoci_transaction_t handler,
+	nyoci_cms_t		cms
+) {
+	nyoci_cms_t slack = 0;
+
+#if NYOCI_CONF_TRANSACTION_TIMER_SLACK_DIVISOR
+	if (cms > 0) {
+		slack = cms / NYOCI_CONF_TRANSACTION_TIMER_SLACK_DIVISOR;
+	}
+#endif
+
+	return nyoci_schedule_timer_with_slack(self, &handler->timer, cms, slack);
+}
+
 void
 nyoci_transaction_new_msg_id(
 	nyoci_t			self,
 	nyoci_transaction_t handler,
 	coap_msg_id_t msg_id
 ) {
-	//NYOCI_SINGLETON_SELF_HOOK;
+	NYOCI_SINGLETON_SELF_HOOK;
 	require(handler->active,bail);
 
 #if NYOCI_TRANSACTIONS_USE_BTREE
-	bt_remove(
+	bt_avl_remove(
 		(void**)&self->transactions,
 		handler,
 		(bt_compare_func_t)nyoci_transaction_compare,
@@ -203,12 +686,20 @@ nyoci_transaction_new_msg_id(
 	);
 #endif
 
-	assert(!nyoci_transaction_find_via_msg_id(self, msg_id));
+	assert(!nyoci_transaction_find_via_msg_id(self, msg_id, &handler->sockaddr_remote));
 
 	handler->msg_id = msg_id;
+	handler->needs_msg_id = 0;
+
+	// The next packet will be different, so it has to be rebuilt.
+	nyoci_transaction_drop_cached_packet_(handler);
+	handler->transmissions = 0;
+
+	// The previous exchange is over, the next one has to wait its turn.
+	nyoci_peer_nstart_release(self, handler);
 
 #if NYOCI_TRANSACTIONS_USE_BTREE
-	bt_insert(
+	bt_avl_insert(
 		(void**)&self->transactions,
 		handler,
 		(bt_compare_func_t)nyoci_transaction_compare,
@@ -221,6 +712,55 @@ bail:
 	return;
 }
 
+coap_msg_id_t
+nyoci_internal_transaction_bind_remote(
+	nyoci_t self,
+	nyoci_transaction_t handler,
+	const nyoci_sockaddr_t* remote,
+	coap_msg_id_t msg_id
+) {
+	bool const is_msg = handler->needs_msg_id && (msg_id == handler->msg_id);
+#if NYOCI_TRANSACTIONS_USE_BTREE
+	bool const rekey = handler->active
+		&& (is_msg || (0 != nyoci_transaction_compare_key_(handler, handler->msg_id, remote)));
+
+	if (rekey) {
+		bt_avl_remove(
+			(void**)&self->transactions,
+			handler,
+			(bt_compare_func_t)nyoci_transaction_compare,
+			(bt_delete_func_t)NULL,
+			self
+		);
+	}
+#endif
+
+	handler->sockaddr_remote = *remote;
+	handler->multicast = NYOCI_IS_ADDR_MULTICAST(&remote->nyoci_addr);
+
+	if (is_msg) {
+		// Now that we know where this is going, draw the message
+		// id from that peer's own message id space.
+		handler->needs_msg_id = 0;
+		handler->msg_id = nyoci_peer_next_msg_id(self, remote);
+		msg_id = handler->msg_id;
+	}
+
+#if NYOCI_TRANSACTIONS_USE_BTREE
+	if (rekey) {
+		bt_avl_insert(
+			(void**)&self->transactions,
+			handler,
+			(bt_compare_func_t)nyoci_transaction_compare,
+			(bt_delete_func_t)nyoci_internal_delete_transaction_,
+			self
+		);
+	}
+#endif
+
+	return msg_id;
+}
+
 static
 bool nyoci_internal_should_burst(nyoci_transaction_t handler){
 	if (handler->flags & NYOCI_TRANSACTION_BURST) {
@@ -258,19 +798,33 @@ nyoci_status_t nyoci_internal_resend(nyoci_t self, nyoci_transaction_t handler,
 
 	nyoci_status_t status = NYOCI_STATUS_OK;
 
-	if(should_resend){
+	if (should_resend && (handler->cached_packet != NULL)) {
+		status = nyoci_transaction_resend_cached_packet_(self, handler);
+	} else if (should_resend) {
 		status = handler->resendCallback(context);
 	}
 
 	if (status == NYOCI_STATUS_OK && should_resend) {
-		*cms = MIN(*cms, calc_retransmit_timeout(handler->attemptCount, should_burst));
+		*cms = MIN(*cms, calc_retransmit_timeout(self, handler, handler->attemptCount, should_burst));
 		handler->attemptCount++;
+
+		if (handler->transmissions == 0) {
+			handler->rtt_start = nyoci_plat_cms_to_timestamp(0);
+		}
+		if (handler->transmissions < 0xFF) {
+			handler->transmissions++;
+		}
 	}
 	else if(status == NYOCI_STATUS_STOP_RESENDING){
 		//Little hack to stop sending packets (without invalidate the transaction)
 		handler->attemptCount = NYOCI_TRANSACTION_MAX_ATTEMPTS;
 		status = NYOCI_STATUS_OK;
 	}
+	else if (status == NYOCI_STATUS_WAIT_FOR_PEER) {
+		// Queued behind earlier requests to the same peer. We will be
+		// tickled when it is our turn, so only wake up to expire.
+		status = NYOCI_STATUS_OK;
+	}
 	else if (status == NYOCI_STATUS_WAIT_FOR_DNS || status == NYOCI_STATUS_WAIT_FOR_SESSION) {
 		// TODO: Figure out a way to avoid polling?
 		*cms = 100;
@@ -319,9 +873,9 @@ nyoci_internal_transaction_timeout_(
 		// at least once.
 		handler->attemptCount += (0 == handler->attemptCount);
 
-		nyoci_schedule_timer(
+		nyoci_transaction_schedule_timer_(
 			self,
-			&handler->timer,
+			handler,
 			cms
 		);
 #if NYOCI_CONF_TRANS_ENABLE_OBSERVING
@@ -337,7 +891,7 @@ nyoci_internal_transaction_timeout_(
 #if NYOCI_CONF_TRANS_ENABLE_BLOCK2
 		handler->next_block2 = 0;
 #endif
-		nyoci_transaction_new_msg_id(self,handler,nyoci_get_next_msg_id(self));
+		nyoci_transaction_new_msg_id(self,handler,nyoci_peer_next_msg_id(self,&handler->sockaddr_remote));
 		handler->expiration = nyoci_plat_cms_to_timestamp(NYOCI_OBSERVATION_DEFAULT_MAX_AGE);
 
 		if (handler->resendCallback) {
@@ -357,9 +911,9 @@ nyoci_internal_transaction_timeout_(
 			cms = NYOCI_OBSERVATION_KEEPALIVE_INTERVAL;
 		}
 
-		status = nyoci_schedule_timer(
+		status = nyoci_transaction_schedule_timer_(
 			self,
-			&handler->timer,
+			handler,
 			cms
 		);
 #endif
@@ -399,6 +953,42 @@ nyoci_internal_transaction_timeout_(
 }
 
 
+static void
+nyoci_transaction_init_fields_(
+	nyoci_transaction_t handler,
+	int	flags,
+	nyoci_inbound_resend_func resendCallback,
+	nyoci_response_handler_func	callback,
+	void* context
+) {
+	handler->resendCallback = resendCallback;
+	handler->callback = callback;
+	handler->context = context;
+	handler->flags = (uint8_t)flags;
+	handler->maxAttempts = NYOCI_TRANSACTION_MAX_ATTEMPTS;
+}
+
+nyoci_transaction_t
+nyoci_transaction_create(
+	nyoci_t self,
+	int	flags,
+	nyoci_inbound_resend_func resendCallback,
+	nyoci_response_handler_func	callback,
+	void* context
+) {
+	nyoci_transaction_t handler;
+	NYOCI_SINGLETON_SELF_HOOK;
+
+	handler = nyoci_transaction_slab_alloc_(self);
+	require(handler != NULL, bail);
+
+	handler->should_dealloc = 1;
+	nyoci_transaction_init_fields_(handler, flags, resendCallback, callback, context);
+
+bail:
+	return handler;
+}
+
 nyoci_transaction_t
 nyoci_transaction_init(
 	nyoci_transaction_t handler,
@@ -408,43 +998,50 @@ nyoci_transaction_init(
 	void* context
 ) {
 	if(!handler) {
-#if NYOCI_AVOID_MALLOC
-#if NYOCI_TRANSACTION_POOL_SIZE
-		uint8_t i;
-		for (i = 0; i < NYOCI_TRANSACTION_POOL_SIZE; i++) {
-			handler = &nyoci_transaction_pool[i];
+		nyoci_t const self = nyoci_get_current_instance();
 
-			if (!handler->callback) {
-				break;
-			}
-
-			handler = NULL;
-		}
-		if (handler) {
-			handler->should_dealloc = 1;
+		if (self != NULL) {
+			return nyoci_transaction_create(self, flags, resendCallback, callback, context);
 		}
-#endif
-#else
+#if !NYOCI_AVOID_MALLOC
 		handler = (nyoci_transaction_t)calloc(sizeof(*handler), 1);
+#endif
 		if (handler) {
 			handler->should_dealloc = 1;
 		}
-#endif
 	} else {
 		memset(handler, 0, sizeof(*handler));
 	}
 
 	require(handler!=NULL, bail);
 
-	handler->resendCallback = resendCallback;
-	handler->callback = callback;
-	handler->context = context;
-	handler->flags = (uint8_t)flags;
-	handler->maxAttempts = NYOCI_TRANSACTION_MAX_ATTEMPTS;
+	nyoci_transaction_init_fields_(handler, flags, resendCallback, callback, context);
+
 bail:
 	return handler;
 }
 
+nyoci_status_t
+nyoci_transaction_release(
+	nyoci_t self,
+	nyoci_transaction_t handler
+) {
+	NYOCI_SINGLETON_SELF_HOOK;
+
+	if (handler == NULL) {
+		return NYOCI_STATUS_OK;
+	}
+
+	require_string(!handler->active, bail, "Active transactions must be ended");
+
+	nyoci_transaction_dealloc_(self, handler);
+
+	return NYOCI_STATUS_OK;
+
+bail:
+	return NYOCI_STATUS_INVALID_ARGUMENT;
+}
+
 nyoci_status_t
 nyoci_transaction_tickle(
 	nyoci_t self,
@@ -474,7 +1071,7 @@ nyoci_transaction_begin(
 	DEBUG_PRINTF("nyoci_transaction_begin: %p",handler);
 
 #if NYOCI_TRANSACTIONS_USE_BTREE
-	bt_remove(
+	bt_avl_remove(
 		(void**)&self->transactions,
 		(void*)handler,
 		(bt_compare_func_t)nyoci_transaction_compare,
@@ -485,12 +1082,30 @@ nyoci_transaction_begin(
 	ll_remove((void**)&self->transactions,(void*)handler);
 #endif
 
+#if NYOCI_TRANSACTIONS_USE_TOKEN_HASH
+	// The token is about to change.
+	nyoci_token_table_remove_(self, handler);
+#endif
+
 	if (expiration <= 0) {
 		expiration = (nyoci_cms_t)(COAP_EXCHANGE_LIFETIME*MSEC_PER_SEC);
 	}
 
-	handler->token = nyoci_get_next_msg_id(self);
-	handler->msg_id = handler->token;
+	nyoci_transaction_next_token_(self, handler);
+	// Only a placeholder: the real message id is picked from the
+	// peer's message id space once the first packet is sent. Ids
+	// from the peer spaces can equal ids from the instance counter,
+	// so the remote is cleared until then. Otherwise the placeholder
+	// could share its key with a live transaction towards the last
+	// remote, and take its place in the transaction tree.
+	memset(&handler->sockaddr_remote, 0, sizeof(handler->sockaddr_remote));
+	do {
+		handler->msg_id = nyoci_get_next_msg_id(self);
+	} while (nyoci_transaction_find_via_msg_id(self, handler->msg_id, &handler->sockaddr_remote) != NULL);
+	handler->needs_msg_id = 1;
+	nyoci_transaction_drop_cached_packet_(handler);
+	nyoci_peer_nstart_release(self, handler);
+	handler->transmissions = 0;
 	handler->waiting_for_async_response = false;
 	handler->attemptCount = 0;
 #if NYOCI_CONF_TRANS_ENABLE_OBSERVING
@@ -530,10 +1145,19 @@ nyoci_transaction_begin(
 		expiration
 	);
 
-	require_noerr(ret, bail);
+	require_noerr_action(ret, bail, handler->active = 0);
+
+#if NYOCI_TRANSACTIONS_USE_TOKEN_HASH
+	ret = nyoci_token_table_insert_(self, handler);
+	require_noerr_action(
+		ret,
+		bail,
+		(nyoci_invalidate_timer(self, &handler->timer), handler->active = 0)
+	);
+#endif
 
 #if NYOCI_TRANSACTIONS_USE_BTREE
-	bt_insert(
+	bt_avl_insert(
 		(void**)&self->transactions,
 		handler,
 		(bt_compare_func_t)nyoci_transaction_compare,
@@ -582,7 +1206,7 @@ nyoci_transaction_end(
 
 	if (transaction->active) {
 #if NYOCI_TRANSACTIONS_USE_BTREE
-		bt_remove(
+		bt_avl_remove(
 			(void**)&self->transactions,
 			(void*)transaction,
 			(bt_compare_func_t)nyoci_transaction_compare,
@@ -603,20 +1227,17 @@ lookup_transaction_(const struct coap_header_s* packet)
 {
 	nyoci_t const self = nyoci_get_current_instance();
 	nyoci_transaction_t handler = NULL;
-	coap_msg_id_t token = 0;
+	const uint8_t* token = self->inbound.packet->token;
+	uint8_t token_len = self->inbound.packet->token_len;
 
-	if(self->inbound.packet->token_len == sizeof(coap_msg_id_t)) {
-		memcpy(&token,self->inbound.packet->token,sizeof(token));
-	}
-
-	handler = nyoci_transaction_find_via_msg_id(self, packet->msg_id);
+	handler = nyoci_transaction_find_via_msg_id(self, packet->msg_id, nyoci_plat_get_remote_sockaddr());
 
 	if (NULL == handler) {
 		if (self->inbound.packet->tt < COAP_TRANS_TYPE_ACK) {
-			handler = nyoci_transaction_find_via_token(self,token);
+			handler = nyoci_transaction_find_via_token(self,token,token_len);
 		}
 	} else if (nyoci_inbound_get_packet()->code != COAP_CODE_EMPTY
-		&& token != handler->token
+		&& !nyoci_transaction_token_matches_(handler, token, token_len)
 	) {
 		handler = NULL;
 	}
@@ -657,6 +1278,8 @@ nyoci_outbound_packet_error(
 
 	require(handler != NULL, bail);
 
+	nyoci_peer_nstart_release(self, handler);
+
 	nyoci_response_handler_func callback = handler->callback;
 
 	if ( !(handler->flags & NYOCI_TRANSACTION_ALWAYS_INVALIDATE)
@@ -718,9 +1341,9 @@ nyoci_outbound_packet_error(
 			cms = NYOCI_OBSERVATION_KEEPALIVE_INTERVAL;
 		}
 
-		nyoci_schedule_timer(
+		nyoci_transaction_schedule_timer_(
 			self,
-			&handler->timer,
+			handler,
 			cms
 		);
 	} else
@@ -763,6 +1386,27 @@ nyoci_handle_response() {
 
 	self->current_transaction = handler;
 
+	if ( (handler != NULL)
+	  && (self->inbound.packet->tt >= COAP_TRANS_TYPE_ACK)
+	  && (handler->transmissions != 0)
+	  && !handler->multicast
+	) {
+		// This acknowledges the message we sent, so it tells us
+		// something about the round trip time to this peer.
+		nyoci_peer_rtt_sample(
+			self,
+			&handler->sockaddr_remote,
+			nyoci_plat_timestamp_diff(nyoci_plat_cms_to_timestamp(0), handler->rtt_start),
+			handler->transmissions
+		);
+		handler->transmissions = 0;
+	}
+
+	if ((handler != NULL) && handler->holds_nstart) {
+		// Whatever this is, the peer has heard our request.
+		nyoci_peer_nstart_release(self, handler);
+	}
+
 	if (handler == NULL) {
 		// This is an unknown response. If the packet
 		// is confirmable, send a reset. If not, don't bother.
@@ -844,7 +1488,7 @@ nyoci_handle_response() {
 				DEBUG_PRINTF("Inbound: Preparing to request next block...");
 				handler->waiting_for_async_response = false;
 				handler->next_block2 = self->inbound.block2_value + (1<<4);
-				nyoci_transaction_new_msg_id(self, handler, nyoci_get_next_msg_id(self));
+				nyoci_transaction_new_msg_id(self, handler, nyoci_peer_next_msg_id(self, &handler->sockaddr_remote));
 				nyoci_invalidate_timer(self, &handler->timer);
 				nyoci_schedule_timer(
 					self,
@@ -874,9 +1518,9 @@ nyoci_handle_response() {
 				cms = NYOCI_OBSERVATION_KEEPALIVE_INTERVAL;
 			}
 
-			nyoci_schedule_timer(
+			nyoci_transaction_schedule_timer_(
 				self,
-				&handler->timer,
+				handler,
 				cms
 			);
 
@@ -932,7 +1576,7 @@ nyoci_handle_response() {
 				if(!ret && (self->inbound.block2_value&(1<<3)) && (handler->flags&NYOCI_TRANSACTION_ALWAYS_INVALIDATE)) {
 					DEBUG_PRINTF("Inbound: Preparing to request next block...");
 					handler->next_block2 = self->inbound.block2_value + (1<<4);
-					nyoci_transaction_new_msg_id(self, handler, nyoci_get_next_msg_id(self));
+					nyoci_transaction_new_msg_id(self, handler, nyoci_peer_next_msg_id(self, &handler->sockaddr_remote));
 					nyoci_invalidate_timer(self, &handler->timer);
 					nyoci_schedule_timer(
 						self,
@@ -966,9 +1610,9 @@ nyoci_handle_response() {
 						cms = NYOCI_OBSERVATION_KEEPALIVE_INTERVAL;
 					}
 
-					nyoci_schedule_timer(
+					nyoci_transaction_schedule_timer_(
 						self,
-						&handler->timer,
+						handler,
 						cms
 					);
 				} else
@@ -50,10 +50,15 @@
 // as possible, these macros do all of the work for us.
 #define nyoci_transaction_find_via_msg_id(self,...)		nyoci_transaction_find_via_msg_id(__VA_ARGS__)
 #define nyoci_transaction_find_via_token(self,...)		nyoci_transaction_find_via_token(__VA_ARGS__)
+#define nyoci_transaction_create(self,...)		nyoci_transaction_create(__VA_ARGS__)
+#define nyoci_transaction_release(self,...)		nyoci_transaction_release(__VA_ARGS__)
 #define nyoci_transaction_begin(self,...)		nyoci_transaction_begin(__VA_ARGS__)
 #define nyoci_transaction_end(self,...)		nyoci_transaction_end(__VA_ARGS__)
 #define nyoci_transaction_new_msg_id(self,...)		nyoci_transaction_new_msg_id(__VA_ARGS__)
 #define nyoci_transaction_tickle(self,...)		nyoci_transaction_tickle(__VA_ARGS__)
+#define nyoci_set_token_length(self,...)		nyoci_set_token_length(__VA_ARGS__)
+#define nyoci_transaction_reserve(self,...)		nyoci_transaction_reserve(__VA_ARGS__)
+#define nyoci_transaction_get_slab_stats(self,...)		nyoci_transaction_get_slab_stats(__VA_ARGS__)
 #endif
 
 #define NYOCI_TRANSACTION_MAX_ATTEMPTS	15
@@ -95,10 +100,14 @@ struct nyoci_transaction_s {
 	nyoci_timestamp_t			expiration;
 	struct nyoci_timer_s			timer;
 
-	coap_msg_id_t				token;
+	uint8_t						token[COAP_MAX_TOKEN_SIZE];
+	uint8_t						token_len;
 	coap_msg_id_t				msg_id;
 	nyoci_sockaddr_t				sockaddr_remote;
 
+	//!	See `NYOCI_TRANSACTION_CACHE_PACKET`.
+	struct nyoci_transaction_packet_s* cached_packet;
+
 #if NYOCI_CONF_TRANS_ENABLE_OBSERVING
 	uint32_t					last_observe;
 #endif
@@ -109,13 +118,30 @@ struct nyoci_transaction_s {
 
 	coap_code_t					sent_code;
 
+	//!	When the current message id was first sent, and how many
+	//!	times it has been sent since. Used to measure round trips.
+	nyoci_timestamp_t			rtt_start;
+	uint8_t						transmissions;
+
+	//!	Peer whose NSTART slot this transaction holds or is queued
+	//!	for, and its neighbours in that peer's queue. `parked_next`
+	//!	also links the free transactions of a transaction slab.
+	struct nyoci_peer_s*		peer;
+	struct nyoci_transaction_s*	parked_prev;
+	struct nyoci_transaction_s*	parked_next;
+	nyoci_timestamp_t			parked_since;
+
 	uint8_t						flags;
 	uint8_t						attemptCount:4, maxAttempts:4,
 								waiting_for_async_response:1,
 								should_dealloc:1,
 								active:1,
 								needs_to_close_observe:1,
-								multicast:1;
+								multicast:1,
+								needs_msg_id:1,
+								holds_nstart:1,
+								parked:1,
+								from_slab:1;
 };
 
 typedef struct nyoci_transaction_s* nyoci_transaction_t;
@@ -145,10 +171,26 @@ enum {
 
 	NYOCI_TRANSACTION_BURST = NYOCI_TRANSACTION_BURST_UNICAST|NYOCI_TRANSACTION_BURST_MULTICAST, //!< Burst multiple packets per retransmit
 
+	//! Retransmit the bytes that were sent the first time.
+	/*! Normally `resendCallback` rebuilds the packet for every
+	 *  retransmission. With this flag, the packet and its destination
+	 *  are kept after the first send and retransmissions send them
+	 *  directly. `resendCallback` is still called whenever the message
+	 *  id changes, such as for observe re-registrations and block2
+	 *  continuations. Ignored when `NYOCI_AVOID_MALLOC` is set. */
+	NYOCI_TRANSACTION_CACHE_PACKET = (1 << 6),
+
 	NYOCI_TRANSACTION_DELAY_START = (1 << 8),
 };
 
 //!	Initialize the given transaction object.
+/*!	If `transaction` is NULL, one is taken from the transaction slab
+**	of the current instance, as by nyoci_transaction_create(). Outside
+**	of a callback, where there is no current instance, it is
+**	allocated with malloc() instead (or NULL is returned when
+**	`NYOCI_AVOID_MALLOC` is set). Either way, it is freed once the
+**	transaction has ended, and must be given to
+**	nyoci_transaction_release() if it never gets begun. */
 NYOCI_API_EXTERN nyoci_transaction_t nyoci_transaction_init(
 	nyoci_transaction_t transaction,
 	int	flags,
@@ -157,6 +199,36 @@ NYOCI_API_EXTERN nyoci_transaction_t nyoci_transaction_init(
 	void* context
 );
 
+//!	Creates a transaction from the transaction slab of `self`.
+/*!	Like nyoci_transaction_init() with a NULL `transaction`, but
+**	doesn't depend on there being a current instance, so clients
+**	can use it between calls to nyoci_plat_process() without
+**	touching the allocator once the slab is big enough (see
+**	nyoci_transaction_reserve()). The transaction must be begun on
+**	`self`. It goes back to the slab once it has ended. */
+NYOCI_API_EXTERN nyoci_transaction_t nyoci_transaction_create(
+	nyoci_t self,
+	int	flags,
+	nyoci_inbound_resend_func requestResend,
+	nyoci_response_handler_func responseHandler,
+	void* context
+);
+
+//!	Frees a transaction that isn't active.
+/*!	For transactions from nyoci_transaction_create(), or from
+**	nyoci_transaction_init() with a NULL `transaction`, that were
+**	never begun or whose nyoci_transaction_begin() failed. Active
+**	transactions are freed by nyoci_transaction_end() instead, and
+**	make this return `NYOCI_STATUS_INVALID_ARGUMENT`. Does nothing
+**	to transactions whose memory belongs to the caller. */
+NYOCI_API_EXTERN nyoci_status_t nyoci_transaction_release(
+	nyoci_t self,
+	nyoci_transaction_t transaction
+);
+
+//!	Starts the transaction.
+/*!	If this fails, the transaction is left inactive, and its
+**	callback isn't called. */
 NYOCI_API_EXTERN nyoci_status_t nyoci_transaction_begin(
 	nyoci_t self,
 	nyoci_transaction_t transaction,
@@ -187,6 +259,46 @@ NYOCI_API_EXTERN void nyoci_transaction_new_msg_id(
 	coap_msg_id_t msg_id
 );
 
+//!	Sets the length of the tokens used by transactions begun from now on.
+/*!	`token_len` must be between 1 and 8. The default is
+**	`NYOCI_CONF_TOKEN_LENGTH`. Transactions that are already in
+**	flight keep the token they were given. */
+NYOCI_API_EXTERN nyoci_status_t nyoci_set_token_length(
+	nyoci_t self,
+	uint8_t token_len
+);
+
+struct nyoci_transaction_slab_stats_s {
+	//!	Transactions the slab has memory for.
+	uint32_t		capacity;
+
+	//!	Transactions currently handed out.
+	uint32_t		in_use;
+
+	//!	Largest value `in_use` has had.
+	uint32_t		high_water;
+
+	//!	Number of times the slab had to call malloc() to grow.
+	uint32_t		grows;
+};
+
+//!	Makes sure `count` more transactions can be handed out without
+//!	allocating memory.
+/*!	Useful at startup, so that steady-state traffic makes no calls
+**	to the allocator. Returns `NYOCI_STATUS_MALLOC_FAILURE` if the
+**	memory isn't available, which is always the case beyond
+**	`NYOCI_TRANSACTION_POOL_SIZE` when `NYOCI_AVOID_MALLOC` is set. */
+NYOCI_API_EXTERN nyoci_status_t nyoci_transaction_reserve(
+	nyoci_t self,
+	uint32_t count
+);
+
+//!	Copies the transaction slab counters into `stats`.
+NYOCI_API_EXTERN void nyoci_transaction_get_slab_stats(
+	nyoci_t self,
+	struct nyoci_transaction_slab_stats_s* stats
+);
+
 /*!	@} */
 /*!	@} */
 
@@ -135,6 +135,12 @@ nyoci_init(nyoci_t self) {
 	// Clear the entire structure.
 	memset(self, 0, sizeof(*self));
 
+	self->timer_budget = NYOCI_CONF_TIMER_BUDGET;
+	self->token_len = NYOCI_CONF_TOKEN_LENGTH;
+	self->rto_min = NYOCI_CONF_MIN_RTO;
+	self->rto_max = NYOCI_CONF_MAX_RTO;
+	self->nstart = NYOCI_CONF_NSTART;
+
 	return nyoci_plat_init(self);
 }
 
@@ -149,14 +155,37 @@ nyoci_release(nyoci_t self) {
 		nyoci_transaction_end(self, self->transactions);
 	}
 
+#if NYOCI_TRANSACTIONS_USE_TOKEN_HASH
+	free(self->token_table);
+	self->token_table = NULL;
+	self->token_table_size = 0;
+#endif
+
 	// Delete all timers
+#if NYOCI_TIMERS_USE_HEAP
+	while(self->timer_count) {
+		nyoci_timer_t timer = self->timer_heap[0];
+#else
 	while(self->timers) {
 		nyoci_timer_t timer = self->timers;
+#endif
 		if(timer->cancel)
 			timer->cancel(self, timer->context);
 		nyoci_invalidate_timer(self, timer);
 	}
 
+	// Timers can live inside transactions and observers (such as
+	// an observer's flush timer), so only free those once every
+	// timer is gone.
+	nyoci_internal_transaction_slab_finalize(self);
+	nyoci_internal_observer_finalize(self);
+
+#if NYOCI_TIMERS_USE_HEAP
+	free(self->timer_heap);
+	self->timer_heap = NULL;
+	self->timer_capacity = 0;
+#endif
+
 	nyoci_plat_finalize(self);
 
 #if !NYOCI_SINGLETON
@@ -256,6 +285,17 @@ nyoci_vhost_route(nyoci_request_handler_func* func, void** context) {
 // MARK: -
 // MARK: Other
 
+coap_msg_id_t
+nyoci_msg_id_step(coap_msg_id_t msg_id) {
+#if DEBUG
+	// Sequential in debug mode.
+	return msg_id + 1;
+#else
+	// Somewhat shuffled in non-debug mode.
+	return msg_id*23873 + 41;
+#endif
+}
+
 coap_msg_id_t
 nyoci_get_next_msg_id(nyoci_t self) {
 	NYOCI_SINGLETON_SELF_HOOK;
@@ -264,13 +304,7 @@ nyoci_get_next_msg_id(nyoci_t self) {
 		self->last_msg_id = (uint16_t)NYOCI_FUNC_RANDOM_UINT32();
 	}
 
-#if DEBUG
-	// Sequential in debug mode.
-	self->last_msg_id++;
-#else
-	// Somewhat shuffled in non-debug mode.
-	self->last_msg_id = self->last_msg_id*23873 + 41;
-#endif
+	self->last_msg_id = nyoci_msg_id_step(self->last_msg_id);
 
 	return self->last_msg_id;
 }
@@ -307,6 +341,7 @@ const char* nyoci_status_to_cstr(int x) {
 
 	case NYOCI_STATUS_WAIT_FOR_DNS: return "Wait For DNS"; break;
 	case NYOCI_STATUS_WAIT_FOR_SESSION: return "Wait For Session"; break;
+	case NYOCI_STATUS_WAIT_FOR_PEER: return "Wait For Peer"; break;
 
 	case NYOCI_STATUS_SESSION_ERROR: return "Session Error"; break;
 	case NYOCI_STATUS_SESSION_CLOSED: return "Session Closed"; break;
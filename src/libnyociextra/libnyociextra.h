@@ -37,5 +37,6 @@
 
 #include <libnyociextra/nyoci-node-router.h>
 #include <libnyociextra/nyoci-var-handler.h>
+#include <libnyociextra/nyoci-worker-pool.h>
 
 #endif
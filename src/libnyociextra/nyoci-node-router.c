@@ -248,7 +248,7 @@ nyoci_node_init(
 		require(name, bail);
 		ret->name = name;
 #if NYOCI_NODE_ROUTER_USE_BTREE
-		bt_insert(
+		bt_avl_insert(
 			(void**)&((nyoci_node_t)node)->children,
 			ret,
 			(bt_compare_func_t)nyoci_node_compare,
@@ -287,7 +287,7 @@ nyoci_node_delete(nyoci_node_t node) {
 
 	if (owner) {
 #if NYOCI_NODE_ROUTER_USE_BTREE
-		bt_remove(owner,
+		bt_avl_remove(owner,
 			node,
 			(bt_compare_func_t)nyoci_node_compare,
 			(void*)node->finalize,
@@ -362,3 +362,35 @@ bail:
 	check_string(ret == NYOCI_STATUS_OK, nyoci_status_to_cstr(ret));
 	return ret;
 }
+
+void
+nyoci_var_handler_changed(
+	nyoci_var_handler_t		node,
+	uint8_t					key_index
+) {
+	require(key_index != BAD_KEY_INDEX, bail);
+
+	node->changed[key_index / 8] |= (uint8_t)(1 << (key_index % 8));
+
+bail:
+	return;
+}
+
+nyoci_status_t
+nyoci_var_handler_flush(
+	nyoci_var_handler_t		node,
+	uint8_t					flags
+) {
+	nyoci_status_t ret;
+
+	ret = nyoci_observable_trigger_bitmap(
+		&node->observable,
+		node->changed,
+		BAD_KEY_INDEX,
+		flags
+	);
+
+	memset(node->changed, 0, sizeof(node->changed));
+
+	return ret;
+}
@@ -65,12 +65,33 @@ typedef nyoci_status_t (*nyoci_var_handler_func)(
 struct nyoci_var_handler_s {
 	nyoci_var_handler_func func;
 	struct nyoci_observable_s observable;
+
+	//!	Keys marked by nyoci_var_handler_changed(), one bit each.
+	uint8_t changed[(255 + 7) / 8];
 };
 
 NYOCI_API_EXTERN nyoci_status_t nyoci_var_handler_request_handler(
 	nyoci_var_handler_t		node
 );
 
+//!	Notes that the value of the variable at `key_index` has changed.
+/*!	Observers aren't notified until nyoci_var_handler_flush() is
+**	called, so several changes can be marked and then sent as one
+**	batch. */
+NYOCI_API_EXTERN void nyoci_var_handler_changed(
+	nyoci_var_handler_t		node,
+	uint8_t					key_index
+);
+
+//!	Notifies the observers of every variable marked as changed.
+/*!	Each observer is notified at most once, even when it watches
+**	several of the changed variables (like observers of the variable
+**	listing do). `flags` are passed to nyoci_observable_trigger(). */
+NYOCI_API_EXTERN nyoci_status_t nyoci_var_handler_flush(
+	nyoci_var_handler_t		node,
+	uint8_t					flags
+);
+
 /*!	@} */
 /*!	@} */
 
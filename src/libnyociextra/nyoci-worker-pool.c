@@ -0,0 +1,642 @@
+/*	@file nyoci-worker-pool.c
+**	@author Robert Quattlebaum <darco@deepdarc.com>
+**	@desc Worker thread pool for request handlers
+**
+**	Copyright (C) 2017 Robert Quattlebaum
+**
+**	Permission is hereby granted, free of charge, to any person
+**	obtaining a copy of this software and associated
+**	documentation files (the "Software"), to deal in the
+**	Software without restriction, including without limitation
+**	the rights to use, copy, modify, merge, publish, distribute,
+**	sublicense, and/or sell copies of the Software, and to
+**	permit persons to whom the Software is furnished to do so,
+**	subject to the following conditions:
+**
+**	The above copyright notice and this permission notice shall
+**	be included in all copies or substantial portions of the
+**	Software.
+**
+**	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+**	KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+**	WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+**	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+**	OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+**	OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+**	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+**	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifndef VERBOSE_DEBUG
+#define VERBOSE_DEBUG 0
+#endif
+
+#ifndef DEBUG
+#define DEBUG VERBOSE_DEBUG
+#endif
+
+#include "assert-macros.h"
+
+#include "libnyoci.h"
+#include "nyoci-logging.h"
+#include "nyoci-worker-pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if NYOCI_THREAD_SAFE && HAVE_PTHREAD && !NYOCI_SINGLETON
+#define NYOCI_WORKER_POOL_SUPPORTED		1
+#else
+#define NYOCI_WORKER_POOL_SUPPORTED		0
+#endif
+
+#if NYOCI_WORKER_POOL_SUPPORTED
+#include <unistd.h>
+#include <pthread.h>
+#endif
+
+struct nyoci_worker_job_s {
+	struct nyoci_async_response_s async_response;
+	struct nyoci_command_s	command;
+
+	struct nyoci_worker_job_s* next;
+	struct nyoci_worker_job_s* prev;
+
+	nyoci_t					nyoci;
+	nyoci_worker_handler_t	handler;
+
+	coap_code_t				code;
+	coap_content_type_t		content_type;
+	coap_size_t				content_len;
+
+	bool					has_response;
+	coap_code_t				response_code;
+	coap_content_type_t		response_content_type;
+	coap_size_t				response_content_len;
+	char*					response_content;
+
+	char					path[NYOCI_MAX_URI_LENGTH + 1];
+	char					content[];
+};
+
+// MARK: -
+// MARK: Jobs
+
+static nyoci_worker_job_t
+nyoci_worker_job_create_(nyoci_worker_handler_t handler)
+{
+	nyoci_worker_job_t job;
+	coap_size_t content_len = nyoci_inbound_get_content_len();
+
+	job = calloc(1, sizeof(*job) + content_len + 1);
+	require(job != NULL, bail);
+
+	job->handler = handler;
+	job->code = nyoci_inbound_get_code();
+	job->content_type = nyoci_inbound_get_content_type();
+	job->content_len = content_len;
+	memcpy(job->content, nyoci_inbound_get_content_ptr(), content_len);
+
+	nyoci_inbound_get_path(job->path, NYOCI_GET_PATH_REMAINING|NYOCI_GET_PATH_INCLUDE_QUERY);
+
+	// Only needed for the async path, but it also lets
+	// nyoci_worker_job_get_request() work for inline jobs.
+	job->async_response.request_len = nyoci_inbound_get_packet_length() - content_len;
+	if (job->async_response.request_len <= sizeof(job->async_response.request)) {
+		memcpy(job->async_response.request.bytes, nyoci_inbound_get_packet(), job->async_response.request_len);
+	} else {
+		job->async_response.request_len = 0;
+	}
+
+bail:
+	return job;
+}
+
+static void
+nyoci_worker_job_free_(nyoci_worker_job_t job)
+{
+	free(job->response_content);
+	free(job);
+}
+
+//!	Runs the handler function and makes sure there is a response to send.
+static void
+nyoci_worker_job_run_(nyoci_worker_job_t job)
+{
+	nyoci_status_t status = (*job->handler->func)(job, job->handler->context);
+
+	if (job->has_response) {
+		return;
+	}
+
+	job->response_content_type = COAP_CONTENT_TYPE_UNKNOWN;
+
+	if (status != NYOCI_STATUS_OK) {
+		job->response_code = nyoci_convert_status_to_result_code(status);
+	} else if (job->code == COAP_METHOD_GET) {
+		job->response_code = COAP_RESULT_205_CONTENT;
+	} else if (job->code == COAP_METHOD_POST || job->code == COAP_METHOD_PUT) {
+		job->response_code = COAP_RESULT_204_CHANGED;
+	} else if (job->code == COAP_METHOD_DELETE) {
+		job->response_code = COAP_RESULT_202_DELETED;
+	} else {
+		job->response_code = COAP_RESULT_200;
+	}
+
+	job->has_response = true;
+}
+
+//!	Adds the content type and content of the response to the outbound packet.
+static nyoci_status_t
+nyoci_worker_job_append_response_(nyoci_worker_job_t job)
+{
+	nyoci_status_t ret = NYOCI_STATUS_OK;
+
+	if (job->response_content_type != COAP_CONTENT_TYPE_UNKNOWN) {
+		ret = nyoci_outbound_add_option_uint(COAP_OPTION_CONTENT_TYPE, job->response_content_type);
+		require_noerr(ret, bail);
+	}
+
+	if (job->response_content_len != 0) {
+		ret = nyoci_outbound_append_content(job->response_content, job->response_content_len);
+		require_noerr(ret, bail);
+	}
+
+bail:
+	return ret;
+}
+
+coap_code_t
+nyoci_worker_job_get_code(nyoci_worker_job_t job)
+{
+	return job->code;
+}
+
+const char*
+nyoci_worker_job_get_path(nyoci_worker_job_t job)
+{
+	return job->path;
+}
+
+coap_content_type_t
+nyoci_worker_job_get_content_type(nyoci_worker_job_t job)
+{
+	return job->content_type;
+}
+
+const char*
+nyoci_worker_job_get_content(nyoci_worker_job_t job, coap_size_t* len)
+{
+	if (len != NULL) {
+		*len = job->content_len;
+	}
+	return job->content;
+}
+
+const struct coap_header_s*
+nyoci_worker_job_get_request(nyoci_worker_job_t job, coap_size_t* len)
+{
+	if (len != NULL) {
+		*len = job->async_response.request_len;
+	}
+	return &job->async_response.request.header;
+}
+
+nyoci_status_t
+nyoci_worker_job_set_response(
+	nyoci_worker_job_t job,
+	coap_code_t code,
+	coap_content_type_t content_type,
+	const char* content,
+	coap_size_t len
+) {
+	nyoci_status_t ret = NYOCI_STATUS_OK;
+	char* copy = NULL;
+
+	require_action(len <= NYOCI_MAX_CONTENT_LENGTH, bail, ret = NYOCI_STATUS_MESSAGE_TOO_BIG);
+
+	if (len != 0) {
+		copy = malloc(len);
+		require_action(copy != NULL, bail, ret = NYOCI_STATUS_MALLOC_FAILURE);
+		memcpy(copy, content, len);
+	}
+
+	free(job->response_content);
+
+	job->response_code = code;
+	job->response_content_type = content_type;
+	job->response_content = copy;
+	job->response_content_len = len;
+	job->has_response = true;
+
+bail:
+	return ret;
+}
+
+// MARK: -
+// MARK: Pool
+
+#if NYOCI_WORKER_POOL_SUPPORTED
+
+//!	A worker's own queue. Jobs are taken from the head by the owner
+//!	and stolen from the tail by the other workers.
+struct nyoci_worker_queue_s {
+	pthread_mutex_t			mutex;
+	nyoci_worker_job_t		head;
+	nyoci_worker_job_t		tail;
+};
+
+struct nyoci_worker_s {
+	struct nyoci_worker_pool_s* pool;
+	struct nyoci_worker_queue_s queue;
+	pthread_t				thread;
+	bool					has_thread;
+	int						index;
+};
+
+struct nyoci_worker_pool_s {
+	// Guards `pending` and `is_running`; idle workers sleep on `cond`.
+	pthread_mutex_t			mutex;
+	pthread_cond_t			cond;
+	int						pending;
+	bool					is_running;
+
+	unsigned int			next_worker;
+	int						count;
+	struct nyoci_worker_s	workers[];
+};
+
+static void
+nyoci_worker_queue_push_tail_(struct nyoci_worker_queue_s* queue, nyoci_worker_job_t job)
+{
+	pthread_mutex_lock(&queue->mutex);
+	job->next = NULL;
+	job->prev = queue->tail;
+	if (queue->tail != NULL) {
+		queue->tail->next = job;
+	} else {
+		queue->head = job;
+	}
+	queue->tail = job;
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+static nyoci_worker_job_t
+nyoci_worker_queue_pop_head_(struct nyoci_worker_queue_s* queue)
+{
+	nyoci_worker_job_t job;
+
+	pthread_mutex_lock(&queue->mutex);
+	job = queue->head;
+	if (job != NULL) {
+		queue->head = job->next;
+		if (queue->head != NULL) {
+			queue->head->prev = NULL;
+		} else {
+			queue->tail = NULL;
+		}
+	}
+	pthread_mutex_unlock(&queue->mutex);
+
+	return job;
+}
+
+static nyoci_worker_job_t
+nyoci_worker_queue_steal_tail_(struct nyoci_worker_queue_s* queue)
+{
+	nyoci_worker_job_t job;
+
+	// Skip queues that look empty without taking their lock.
+	if (__atomic_load_n(&queue->tail, __ATOMIC_RELAXED) == NULL) {
+		return NULL;
+	}
+
+	pthread_mutex_lock(&queue->mutex);
+	job = queue->tail;
+	if (job != NULL) {
+		queue->tail = job->prev;
+		if (queue->tail != NULL) {
+			queue->tail->next = NULL;
+		} else {
+			queue->head = NULL;
+		}
+	}
+	pthread_mutex_unlock(&queue->mutex);
+
+	return job;
+}
+
+static nyoci_worker_job_t
+nyoci_worker_next_job_(struct nyoci_worker_s* worker)
+{
+	struct nyoci_worker_pool_s* const pool = worker->pool;
+	nyoci_worker_job_t job = nyoci_worker_queue_pop_head_(&worker->queue);
+	int i;
+
+	for (i = 1; (job == NULL) && (i < pool->count); i++) {
+		job = nyoci_worker_queue_steal_tail_(&pool->workers[(worker->index + i) % pool->count].queue);
+	}
+
+	return job;
+}
+
+//!	Called on the I/O thread once the worker has finished.
+static nyoci_status_t
+nyoci_worker_job_resend_(void* context)
+{
+	nyoci_worker_job_t const job = context;
+	nyoci_status_t ret;
+
+	ret = nyoci_outbound_begin_async_response(job->response_code, &job->async_response);
+	require_noerr(ret, bail);
+
+	ret = nyoci_worker_job_append_response_(job);
+	require_noerr(ret, bail);
+
+	ret = nyoci_outbound_send();
+	require_noerr(ret, bail);
+
+bail:
+	return ret;
+}
+
+static nyoci_status_t
+nyoci_worker_job_ack_handler_(int statuscode, void* context)
+{
+	nyoci_worker_job_t const job = context;
+
+	if (statuscode == NYOCI_STATUS_TRANSACTION_INVALIDATED) {
+		nyoci_finish_async_response(&job->async_response);
+		nyoci_worker_job_free_(job);
+	}
+
+	return NYOCI_STATUS_OK;
+}
+
+//!	Command that sends the finished response from the I/O thread.
+static void
+nyoci_worker_job_complete_(nyoci_t nyoci, void* context)
+{
+	nyoci_worker_job_t const job = context;
+	nyoci_transaction_t transaction;
+	nyoci_status_t status;
+
+	transaction = nyoci_transaction_create(
+		nyoci,
+		NYOCI_TRANSACTION_ALWAYS_INVALIDATE,
+		&nyoci_worker_job_resend_,
+		&nyoci_worker_job_ack_handler_,
+		job
+	);
+	require(transaction != NULL, bail);
+
+	status = nyoci_transaction_begin(
+		nyoci,
+		transaction,
+		(job->async_response.request.header.tt == COAP_TRANS_TYPE_CONFIRMABLE)
+			? (nyoci_cms_t)(COAP_MAX_TRANSMIT_WAIT*MSEC_PER_SEC)
+			: 1
+	);
+
+	if (status != NYOCI_STATUS_OK) {
+		// A transaction that failed to begin never calls the ack
+		// handler, so the job is still ours to free.
+		nyoci_transaction_release(nyoci, transaction);
+		goto bail;
+	}
+
+	return;
+
+bail:
+	nyoci_worker_job_free_(job);
+}
+
+static void*
+nyoci_worker_thread_(void* context)
+{
+	struct nyoci_worker_s* const worker = context;
+	struct nyoci_worker_pool_s* const pool = worker->pool;
+	nyoci_worker_job_t job;
+
+	for (;;) {
+		job = nyoci_worker_next_job_(worker);
+
+		if (job != NULL) {
+			pthread_mutex_lock(&pool->mutex);
+			pool->pending--;
+			pthread_mutex_unlock(&pool->mutex);
+
+			nyoci_worker_job_run_(job);
+
+			nyoci_post_command(
+				job->nyoci,
+				nyoci_command_init(&job->command, &nyoci_worker_job_complete_, job)
+			);
+			continue;
+		}
+
+		pthread_mutex_lock(&pool->mutex);
+		while ((pool->pending == 0) && pool->is_running) {
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+		}
+		if ((pool->pending == 0) && !pool->is_running) {
+			pthread_mutex_unlock(&pool->mutex);
+			break;
+		}
+		pthread_mutex_unlock(&pool->mutex);
+	}
+
+	return NULL;
+}
+
+static void
+nyoci_worker_pool_push_(nyoci_worker_pool_t pool, nyoci_worker_job_t job)
+{
+	unsigned int index = __atomic_fetch_add(&pool->next_worker, 1, __ATOMIC_RELAXED);
+
+	nyoci_worker_queue_push_tail_(&pool->workers[index % pool->count].queue, job);
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->pending++;
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+nyoci_worker_pool_t
+nyoci_worker_pool_create(int thread_count)
+{
+	nyoci_worker_pool_t pool = NULL;
+	int i;
+
+	if (thread_count <= 0) {
+		long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+		thread_count = (cpu_count < 1) ? 1 : (int)cpu_count;
+	}
+
+	pool = calloc(1, sizeof(*pool) + thread_count * sizeof(pool->workers[0]));
+	require(pool != NULL, bail);
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	pool->count = thread_count;
+	pool->is_running = true;
+
+	for (i = 0; i < thread_count; i++) {
+		struct nyoci_worker_s* const worker = &pool->workers[i];
+
+		worker->pool = pool;
+		worker->index = i;
+		pthread_mutex_init(&worker->queue.mutex, NULL);
+	}
+
+	for (i = 0; i < thread_count; i++) {
+		struct nyoci_worker_s* const worker = &pool->workers[i];
+		int error = pthread_create(&worker->thread, NULL, &nyoci_worker_thread_, worker);
+
+		require_string(error == 0, bail, strerror(error));
+
+		worker->has_thread = true;
+	}
+
+	return pool;
+
+bail:
+	nyoci_worker_pool_release(pool);
+	return NULL;
+}
+
+void
+nyoci_worker_pool_release(nyoci_worker_pool_t pool)
+{
+	int i;
+
+	require_quiet(pool != NULL, bail);
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->is_running = false;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->count; i++) {
+		if (pool->workers[i].has_thread) {
+			pthread_join(pool->workers[i].thread, NULL);
+		}
+		pthread_mutex_destroy(&pool->workers[i].queue.mutex);
+	}
+
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool);
+
+bail:
+	return;
+}
+
+int
+nyoci_worker_pool_get_thread_count(nyoci_worker_pool_t pool)
+{
+	return pool->count;
+}
+
+#else // NYOCI_WORKER_POOL_SUPPORTED
+
+nyoci_worker_pool_t
+nyoci_worker_pool_create(int thread_count)
+{
+	// Needs threads. Handlers with a NULL pool are run inline.
+	return NULL;
+}
+
+void
+nyoci_worker_pool_release(nyoci_worker_pool_t pool)
+{
+}
+
+int
+nyoci_worker_pool_get_thread_count(nyoci_worker_pool_t pool)
+{
+	return 0;
+}
+
+#endif // NYOCI_WORKER_POOL_SUPPORTED
+
+// MARK: -
+// MARK: Request Handler
+
+nyoci_worker_handler_t
+nyoci_worker_handler_init(
+	nyoci_worker_handler_t handler,
+	nyoci_worker_pool_t pool,
+	nyoci_worker_func func,
+	void* context,
+	int flags
+) {
+	require(handler != NULL, bail);
+
+	handler->pool = pool;
+	handler->func = func;
+	handler->context = context;
+	handler->flags = flags;
+
+bail:
+	return handler;
+}
+
+nyoci_status_t
+nyoci_worker_handler_request_handler(
+	nyoci_worker_handler_t handler
+) {
+	nyoci_status_t ret = NYOCI_STATUS_OK;
+	nyoci_worker_job_t job = NULL;
+	bool run_inline = (handler->pool == NULL)
+		|| (handler->flags & NYOCI_WORKER_HANDLER_FLAG_INLINE_SAFE);
+
+	if (!run_inline && nyoci_inbound_is_dupe()) {
+		// The original request is still being worked on, or its
+		// response is already on its way. Just stop the retries.
+		if (nyoci_inbound_get_packet()->tt == COAP_TRANS_TYPE_CONFIRMABLE) {
+			ret = nyoci_outbound_begin_response(COAP_CODE_EMPTY);
+			require_noerr(ret, bail);
+
+			ret = nyoci_outbound_send();
+		}
+		goto bail;
+	}
+
+	job = nyoci_worker_job_create_(handler);
+	require_action(job != NULL, bail, ret = NYOCI_STATUS_MALLOC_FAILURE);
+
+	if (run_inline) {
+		nyoci_worker_job_run_(job);
+
+		ret = nyoci_outbound_begin_response(job->response_code);
+		require_noerr(ret, bail);
+
+		ret = nyoci_worker_job_append_response_(job);
+		require_noerr(ret, bail);
+
+		ret = nyoci_outbound_send();
+		goto bail;
+	}
+
+#if NYOCI_WORKER_POOL_SUPPORTED
+	// Sends the empty ACK for CON requests.
+	ret = nyoci_start_async_response(&job->async_response, 0);
+	require_noerr(ret, bail);
+
+	job->nyoci = nyoci_get_current_instance();
+
+	nyoci_worker_pool_push_(handler->pool, job);
+	job = NULL;
+#endif
+
+bail:
+	if (job != NULL) {
+		nyoci_worker_job_free_(job);
+	}
+	return ret;
+}
@@ -0,0 +1,157 @@
+/*!	@file nyoci-worker-pool.h
+**	@author Robert Quattlebaum <darco@deepdarc.com>
+**
+**	Copyright (C) 2017  Robert Quattlebaum
+**
+**	Permission is hereby granted, free of charge, to any person
+**	obtaining a copy of this software and associated
+**	documentation files (the "Software"), to deal in the
+**	Software without restriction, including without limitation
+**	the rights to use, copy, modify, merge, publish, distribute,
+**	sublicense, and/or sell copies of the Software, and to
+**	permit persons to whom the Software is furnished to do so,
+**	subject to the following conditions:
+**
+**	The above copyright notice and this permission notice shall
+**	be included in all copies or substantial portions of the
+**	Software.
+**
+**	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+**	KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+**	WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+**	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+**	OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+**	OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+**	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+**	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __NYOCI_WORKER_POOL_H__
+#define __NYOCI_WORKER_POOL_H__ 1
+
+#include <libnyoci/libnyoci.h>
+
+NYOCI_BEGIN_C_DECLS
+
+/*!	@addtogroup nyoci-extras
+**	@{
+*/
+
+/*!	@defgroup nyoci-worker-pool Worker Pool
+**	@{
+**	@brief Running slow request handlers off of the I/O thread.
+**
+**	A worker handler is a request handler that does not get to use
+**	the `nyoci_inbound_*` and `nyoci_outbound_*` calls. Instead, the
+**	request is captured into a job on the I/O thread (using the
+**	async response machinery, so CON requests are ACKed right away),
+**	the job is run by one of the threads of a worker pool, and the
+**	finished response is handed back to the I/O thread with
+**	nyoci_post_command() to be sent as a separate response.
+**
+**	Handlers that are quick and never block can set
+**	::NYOCI_WORKER_HANDLER_FLAG_INLINE_SAFE to skip the hop: they are
+**	run directly on the I/O thread and answered with a piggybacked
+**	response. A handler with a `NULL` pool is always run inline.
+**
+**	Example:
+**
+**		nyoci_worker_pool_t pool = nyoci_worker_pool_create(4);
+**		struct nyoci_worker_handler_s handler;
+**
+**		nyoci_worker_handler_init(&handler, pool, &my_slow_func, NULL, 0);
+**		nyoci_set_default_request_handler(
+**			nyoci,
+**			(nyoci_request_handler_func)&nyoci_worker_handler_request_handler,
+**			&handler
+**		);
+**
+**	The pool must be released only after every instance that
+**	dispatches to it has stopped processing packets, and the instances
+**	must outlive the jobs they have dispatched.
+*/
+
+struct nyoci_worker_pool_s;
+typedef struct nyoci_worker_pool_s *nyoci_worker_pool_t;
+
+struct nyoci_worker_job_s;
+typedef struct nyoci_worker_job_s *nyoci_worker_job_t;
+
+//!	Fills in the response for `job`, usually by calling nyoci_worker_job_set_response().
+/*!	If an error is returned and no response has been set, the
+**	response code is derived from the error. */
+typedef nyoci_status_t (*nyoci_worker_func)(
+	nyoci_worker_job_t job,
+	void* context
+);
+
+enum {
+	//!	The handler never blocks, so it can run on the I/O thread.
+	NYOCI_WORKER_HANDLER_FLAG_INLINE_SAFE = (1 << 0),
+};
+
+struct nyoci_worker_handler_s {
+	nyoci_worker_pool_t pool;
+	nyoci_worker_func func;
+	void* context;
+	int flags;
+};
+
+typedef struct nyoci_worker_handler_s *nyoci_worker_handler_t;
+
+//!	Creates a pool with `thread_count` threads.
+/*!	A `thread_count` of zero or less uses one thread per CPU.
+**	Returns `NULL` if threads are not available on this platform. */
+NYOCI_API_EXTERN nyoci_worker_pool_t nyoci_worker_pool_create(int thread_count);
+
+//!	Finishes the queued jobs, then stops and frees the pool.
+NYOCI_API_EXTERN void nyoci_worker_pool_release(nyoci_worker_pool_t pool);
+
+//!	Returns the number of threads in the pool.
+NYOCI_API_EXTERN int nyoci_worker_pool_get_thread_count(nyoci_worker_pool_t pool);
+
+NYOCI_API_EXTERN nyoci_worker_handler_t nyoci_worker_handler_init(
+	nyoci_worker_handler_t handler,
+	nyoci_worker_pool_t pool,
+	nyoci_worker_func func,
+	void* context,
+	int flags
+);
+
+//!	Request handler that dispatches to `handler`. Also usable as a node's request handler.
+NYOCI_API_EXTERN nyoci_status_t nyoci_worker_handler_request_handler(
+	nyoci_worker_handler_t handler
+);
+
+//!	Returns the method of the captured request.
+NYOCI_API_EXTERN coap_code_t nyoci_worker_job_get_code(nyoci_worker_job_t job);
+
+//!	Returns the remaining path of the captured request, including the query.
+/*!	When the handler is attached to a node, the path is relative to it. */
+NYOCI_API_EXTERN const char* nyoci_worker_job_get_path(nyoci_worker_job_t job);
+
+NYOCI_API_EXTERN coap_content_type_t nyoci_worker_job_get_content_type(nyoci_worker_job_t job);
+
+//!	Returns the content of the captured request. Guaranteed to be NUL-terminated.
+NYOCI_API_EXTERN const char* nyoci_worker_job_get_content(nyoci_worker_job_t job, coap_size_t* len);
+
+//!	Returns the header and options of the captured request, for use with coap_decode_option().
+NYOCI_API_EXTERN const struct coap_header_s* nyoci_worker_job_get_request(nyoci_worker_job_t job, coap_size_t* len);
+
+//!	Sets the response that will be sent for `job`.
+/*!	Pass `COAP_CONTENT_TYPE_UNKNOWN` to leave out the content type. The
+**	content is copied. */
+NYOCI_API_EXTERN nyoci_status_t nyoci_worker_job_set_response(
+	nyoci_worker_job_t job,
+	coap_code_t code,
+	coap_content_type_t content_type,
+	const char* content,
+	coap_size_t len
+);
+
+/*!	@} */
+/*!	@} */
+
+NYOCI_END_C_DECLS
+
+#endif // __NYOCI_WORKER_POOL_H__
@@ -138,14 +138,19 @@ send_delete_request(
 
 	gRet = ERRORCODE_INPROGRESS;
 
-	ret = nyoci_transaction_init(
-		NULL,
+	ret = nyoci_transaction_create(
+		nyoci,
 		NYOCI_TRANSACTION_ALWAYS_INVALIDATE, // Flags
 		(void*)&resend_delete_request,
 		&delete_response_handler,
 		(void*)url
 	);
-	nyoci_transaction_begin(nyoci, ret, 30*MSEC_PER_SEC);
+	require(ret != NULL, bail);
+
+	if (nyoci_transaction_begin(nyoci, ret, 30*MSEC_PER_SEC) != NYOCI_STATUS_OK) {
+		nyoci_transaction_release(nyoci, ret);
+		ret = NULL;
+	}
 
 bail:
 	return ret;
@@ -180,14 +180,27 @@ send_post_request(
 
 	gRet = ERRORCODE_INPROGRESS;
 
-	ret = nyoci_transaction_init(
-		NULL,
+	ret = nyoci_transaction_create(
+		nyoci,
 		NYOCI_TRANSACTION_ALWAYS_INVALIDATE, // Flags
 		(void*)&resend_post_request,
 		(void*)&post_response_handler,
 		(void*)request
 	);
-	nyoci_transaction_begin(nyoci, ret, 30*MSEC_PER_SEC);
+
+	if ( (ret != NULL)
+	  && (nyoci_transaction_begin(nyoci, ret, 30*MSEC_PER_SEC) != NYOCI_STATUS_OK)
+	) {
+		nyoci_transaction_release(nyoci, ret);
+		ret = NULL;
+	}
+
+	if (ret == NULL) {
+		// The response handler never runs, so `request` is still ours.
+		free(request->content);
+		free(request->url);
+		free(request);
+	}
 
 bail:
 	return ret;
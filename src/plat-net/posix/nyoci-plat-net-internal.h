@@ -38,6 +38,7 @@
 #include "nyoci-plat-tls.h"
 #endif // if NYOCI_DTLS
 
+#include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
@@ -45,6 +46,71 @@
 #define NYOCI_PLAT_NET_POSIX_FAMILY		AF_INET6
 #endif
 
+//!	Use epoll instead of poll() to wait for inbound packets.
+/*!	Sockets are registered with the epoll instance once, when they are
+**	bound, instead of being collected again on every wait. */
+#ifndef NYOCI_PLAT_NET_POSIX_USE_EPOLL
+#define NYOCI_PLAT_NET_POSIX_USE_EPOLL	HAVE_SYS_EPOLL_H
+#endif
+
+//!	Default number of datagrams fetched per receive system call.
+/*!	Values larger than one only have an effect when `recvmmsg()`
+**	is available. Can be changed at runtime using
+**	nyoci_plat_set_recv_batch(). */
+#ifndef NYOCI_PLAT_NET_POSIX_RECV_BATCH_SIZE
+#define NYOCI_PLAT_NET_POSIX_RECV_BATCH_SIZE	8
+#endif
+
+//!	Upper limit for the receive batch size.
+#ifndef NYOCI_PLAT_NET_POSIX_RECV_BATCH_MAX
+#define NYOCI_PLAT_NET_POSIX_RECV_BATCH_MAX		64
+#endif
+
+//!	Default number of datagrams handled per call to nyoci_plat_process().
+#ifndef NYOCI_PLAT_NET_POSIX_RECV_BUDGET
+#define NYOCI_PLAT_NET_POSIX_RECV_BUDGET		64
+#endif
+
+//!	Default number of outbound datagrams coalesced into one `sendmmsg()`.
+/*!	Zero disables outbound batching. Can be changed at runtime using
+**	nyoci_plat_set_send_batch(). */
+#ifndef NYOCI_PLAT_NET_POSIX_SEND_BATCH_SIZE
+#define NYOCI_PLAT_NET_POSIX_SEND_BATCH_SIZE	0
+#endif
+
+//!	Upper limit for the send batch size.
+#ifndef NYOCI_PLAT_NET_POSIX_SEND_BATCH_MAX
+#define NYOCI_PLAT_NET_POSIX_SEND_BATCH_MAX		64
+#endif
+
+//!	Use io_uring for socket I/O instead of epoll or poll().
+/*!	Inbound datagrams are received by multishot `recvmsg` operations
+**	that stay armed on the sockets, using a ring of provided buffers,
+**	and outbound datagrams are queued as asynchronous `sendmsg`
+**	operations. If the running kernel lacks the required features
+**	the epoll (or poll()) backend is used instead. Enabled with
+**	`--enable-io-uring`. */
+#ifndef NYOCI_PLAT_NET_POSIX_USE_IO_URING
+#define NYOCI_PLAT_NET_POSIX_USE_IO_URING	0
+#endif
+
+//!	Number of submission queue entries in the io_uring.
+#ifndef NYOCI_PLAT_NET_POSIX_URING_ENTRIES
+#define NYOCI_PLAT_NET_POSIX_URING_ENTRIES		256
+#endif
+
+//!	Number of buffers provided to the kernel for inbound datagrams.
+/*!	Must be a power of two. */
+#ifndef NYOCI_PLAT_NET_POSIX_URING_RECV_BUFFERS
+#define NYOCI_PLAT_NET_POSIX_URING_RECV_BUFFERS	256
+#endif
+
+//!	Number of outbound datagrams that can be in flight at once.
+/*!	When all of them are in use, packets are sent synchronously. */
+#ifndef NYOCI_PLAT_NET_POSIX_URING_SEND_SLOTS
+#define NYOCI_PLAT_NET_POSIX_URING_SEND_SLOTS	64
+#endif
+
 #if NYOCI_SINGLETON
 #define nyoci_internal_multicast_joinleave(self,...)		nyoci_internal_multicast_joinleave(__VA_ARGS__)
 #endif
@@ -91,7 +157,80 @@
 
 NYOCI_BEGIN_C_DECLS
 
+struct mmsghdr;
+
+//!	Storage for a single received datagram.
+struct nyoci_plat_recv_slot_s {
+	nyoci_sockaddr_t		remote_saddr;
+	struct iovec			iov;
+	char					cmbuf[0x100];
+	char					packet[NYOCI_MAX_PACKET_LENGTH+1];
+};
+
+//!	Storage for a single datagram waiting to be sent.
+struct nyoci_plat_send_slot_s {
+	nyoci_sockaddr_t		remote_saddr;
+	nyoci_sockaddr_t		local_saddr;
+	struct iovec			iov;
+	uint8_t					cmbuf[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+	char					packet[NYOCI_MAX_PACKET_LENGTH+1];
+};
+
+//!	Sockets that can have a receive operation armed in the io_uring.
+enum {
+	NYOCI_PLAT_URING_SOCKET_UDP,
+	NYOCI_PLAT_URING_SOCKET_DTLS,
+	NYOCI_PLAT_URING_SOCKET_COUNT
+};
+
+//!	State of the io_uring I/O engine.
+/*!	The kernel structures are kept as opaque pointers so that this
+**	header does not depend on `<linux/io_uring.h>`. */
+struct nyoci_plat_uring_s {
+	int						fd;			//!< -1 when io_uring is not in use
+
+	void*					sq_ring;
+	size_t					sq_ring_size;
+	void*					cq_ring;
+	size_t					cq_ring_size;
+	void*					sqes;
+	size_t					sqes_size;
+
+	unsigned*				sq_head;
+	unsigned*				sq_tail;
+	unsigned*				sq_array;
+	unsigned				sq_mask;
+	unsigned				sq_entries;
+	unsigned				sq_local_tail;
+	unsigned				to_submit;
+
+	unsigned*				cq_head;
+	unsigned*				cq_tail;
+	unsigned				cq_mask;
+	void*					cqes;
+
+	void*					arena;		//!< Buffers shared with the kernel
+	size_t					arena_size;
+	void*					buf_ring;
+	uint16_t				buf_tail;
+	char*					recv_buffers;
+	size_t					recv_buffer_size;
+	struct msghdr*			recv_msghdr;
+
+	int						wake_fd;	//!< Has a multishot poll armed on it
+	int						armed_fd[NYOCI_PLAT_URING_SOCKET_COUNT];
+	uint16_t				armed_port[NYOCI_PLAT_URING_SOCKET_COUNT];
+	uint32_t				armed_gen[NYOCI_PLAT_URING_SOCKET_COUNT];
+
+	struct nyoci_plat_send_slot_s* send_slots;
+	struct msghdr*			send_msgs;
+	uint16_t				send_free[NYOCI_PLAT_NET_POSIX_URING_SEND_SLOTS];
+	int						send_free_count;
+};
+
 struct nyoci_plat_s {
+	int						epoll_fd;	//!< -1 unless NYOCI_PLAT_NET_POSIX_USE_EPOLL
+	int						wake_fd[2];	//!< Read and write ends, the same eventfd if available
 	int						mcfd_v6;	//!< For multicast
 	int						mcfd_v4;	//!< For multicast
 
@@ -116,9 +255,63 @@ struct nyoci_plat_s {
 #endif
 
 	char					outbound_packet_bytes[NYOCI_MAX_PACKET_LENGTH+1];
+
+	int						recv_batch_size;	//!< Datagrams per receive call
+	int						recv_budget;		//!< Datagrams per nyoci_plat_process()
+	struct nyoci_plat_recv_slot_s* recv_slots;	//!< Only allocated when recv_batch_size > 1
+	struct mmsghdr*			recv_msgs;
+
+	bool					is_processing;		//!< Inside of nyoci_plat_process()
+	int						send_batch_size;	//!< Zero when outbound batching is off
+	int						send_count;			//!< Datagrams waiting in send_slots
+	struct nyoci_plat_send_slot_s* send_slots;
+	struct mmsghdr*			send_msgs;
+
+	struct nyoci_plat_uring_s uring;
+
+	bool					reuse_port;			//!< Bind with SO_REUSEPORT
 };
 
 
+//!	Handles a single datagram that was received on `fd`.
+/*!	`msg` is only used for its control messages. `packet` must have
+**	room for a terminating zero after `packet_len` bytes. */
+NYOCI_INTERNAL_EXTERN nyoci_status_t nyoci_plat_inbound_datagram_process(
+	nyoci_t self,
+	int fd,
+	uint16_t port,
+	const nyoci_sockaddr_t* remote_saddr,
+	struct msghdr* msg,
+	char* packet,
+	size_t packet_len
+);
+
+//!	Consumes pending wakeups, see nyoci_plat_wakeup().
+NYOCI_INTERNAL_EXTERN void nyoci_plat_wakeup_drain(nyoci_t self);
+
+NYOCI_INTERNAL_EXTERN nyoci_status_t nyoci_plat_uring_init(nyoci_t self);
+NYOCI_INTERNAL_EXTERN void nyoci_plat_uring_finalize(nyoci_t self);
+NYOCI_INTERNAL_EXTERN void nyoci_plat_uring_arm_recv(nyoci_t self, int socket_index, int fd);
+NYOCI_INTERNAL_EXTERN void nyoci_plat_uring_arm_wake(nyoci_t self, int fd);
+NYOCI_INTERNAL_EXTERN int nyoci_plat_uring_wait(nyoci_t self, nyoci_cms_t cms);
+NYOCI_INTERNAL_EXTERN int nyoci_plat_uring_process(nyoci_t self, int budget, nyoci_status_t* status);
+NYOCI_INTERNAL_EXTERN void nyoci_plat_uring_submit(nyoci_t self);
+NYOCI_INTERNAL_EXTERN nyoci_status_t nyoci_plat_uring_send(
+	nyoci_t self,
+	int fd,
+	const void *data, size_t len,
+	const nyoci_sockaddr_t* saddr_to,
+	const nyoci_sockaddr_t* saddr_from
+);
+
+NYOCI_INTERNAL_EXTERN void sendtofrom_prepare_msghdr(
+	struct msghdr* msg,
+	struct iovec* iov,
+	void* cmbuf, size_t cmbuf_len,
+	const struct sockaddr * saddr_to, socklen_t socklen_to,
+	const struct sockaddr * saddr_from, socklen_t socklen_from
+);
+
 NYOCI_INTERNAL_EXTERN ssize_t sendtofrom(
 	int fd,
 	const void *data, size_t len, int flags,
@@ -0,0 +1,358 @@
+/*	@file nyoci-plat-net-shard.c
+**	@author Robert Quattlebaum <darco@deepdarc.com>
+**	@desc Sharded servers: several instances on one SO_REUSEPORT port
+**
+**	Copyright (C) 2017 Robert Quattlebaum
+**
+**	Permission is hereby granted, free of charge, to any person
+**	obtaining a copy of this software and associated
+**	documentation files (the "Software"), to deal in the
+**	Software without restriction, including without limitation
+**	the rights to use, copy, modify, merge, publish, distribute,
+**	sublicense, and/or sell copies of the Software, and to
+**	permit persons to whom the Software is furnished to do so,
+**	subject to the following conditions:
+**
+**	The above copyright notice and this permission notice shall
+**	be included in all copies or substantial portions of the
+**	Software.
+**
+**	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+**	KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+**	WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+**	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+**	OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+**	OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+**	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+**	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifndef VERBOSE_DEBUG
+#define VERBOSE_DEBUG 0
+#endif
+
+#ifndef DEBUG
+#define DEBUG VERBOSE_DEBUG
+#endif
+
+#include "assert-macros.h"
+
+#include "libnyoci.h"
+
+#include "nyoci-internal.h"
+#include "nyoci-logging.h"
+
+#if !NYOCI_SINGLETON
+
+#if NYOCI_THREAD_SAFE && HAVE_PTHREAD && defined(SO_REUSEPORT)
+#define NYOCI_SHARD_GROUP_SUPPORTED		1
+#else
+#define NYOCI_SHARD_GROUP_SUPPORTED		0
+#endif
+
+#if NYOCI_SHARD_GROUP_SUPPORTED
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#if HAVE_LINUX_FILTER_H
+#include <linux/filter.h>
+#endif
+
+struct nyoci_shard_s {
+	struct nyoci_shard_group_s* group;
+	nyoci_t					instance;
+	pthread_t				thread;
+	bool					has_thread;
+	int						cpu;
+};
+
+struct nyoci_shard_group_s {
+	int						count;
+	int						flags;
+	bool					is_running;
+	struct nyoci_shard_s	shards[];
+};
+
+static void*
+nyoci_shard_thread_(void* context)
+{
+	struct nyoci_shard_s* const shard = context;
+
+#if HAVE_DECL_PTHREAD_SETAFFINITY_NP
+	if (shard->cpu >= 0) {
+		cpu_set_t cpus;
+
+		CPU_ZERO(&cpus);
+		CPU_SET(shard->cpu, &cpus);
+
+		// Not being able to pin the thread is not fatal.
+		if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+			check_string(false, "Unable to pin shard thread");
+		}
+	}
+#endif
+
+	while (__atomic_load_n(&shard->group->is_running, __ATOMIC_ACQUIRE)) {
+		// Sleeps until the next packet, timer or posted command.
+		nyoci_plat_run_once(shard->instance, -1);
+	}
+
+	return NULL;
+}
+
+//!	Attaches a classic BPF program to the reuseport group of `fd` that
+//!	picks a socket by hashing the source address of each datagram.
+/*!	The kernel numbers the sockets of a reuseport group in the order
+**	they were bound, which is also the order of our shards. */
+static nyoci_status_t
+nyoci_shard_group_attach_steering_(int fd, int count)
+{
+#if defined(SO_ATTACH_REUSEPORT_CBPF) && defined(SKF_NET_OFF)
+	// The program starts out pointing at the UDP payload, so the IP
+	// header has to be reached through SKF_NET_OFF.
+	struct sock_filter code[] = {
+		// A = IP version
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_NET_OFF + 0),
+		BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 4),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 6, 2, 0),
+
+		// IPv4: A = source address
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12),
+		BPF_JUMP(BPF_JMP | BPF_JA, 10, 0, 0),
+
+		// IPv6: A = XOR of the four words of the source address
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 8),
+		BPF_STMT(BPF_MISC | BPF_TAX, 0),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12),
+		BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+		BPF_STMT(BPF_MISC | BPF_TAX, 0),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 16),
+		BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+		BPF_STMT(BPF_MISC | BPF_TAX, 0),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 20),
+		BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+
+		// Fold the upper bits in, then pick a socket.
+		BPF_STMT(BPF_MISC | BPF_TAX, 0),
+		BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+		BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+		BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, (uint32_t)count),
+		BPF_STMT(BPF_RET | BPF_A, 0),
+	};
+	struct sock_fprog prog = {
+		.len = sizeof(code) / sizeof(code[0]),
+		.filter = code,
+	};
+
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) != 0) {
+		DEBUG_PRINTF("SO_ATTACH_REUSEPORT_CBPF: %s", strerror(errno));
+		return NYOCI_STATUS_ERRNO;
+	}
+
+	return NYOCI_STATUS_OK;
+#else
+	return NYOCI_STATUS_NOT_IMPLEMENTED;
+#endif
+}
+
+nyoci_shard_group_t
+nyoci_shard_group_create(
+	int count,
+	const nyoci_sockaddr_t* sockaddr,
+	nyoci_request_handler_func handler,
+	void* context,
+	int flags
+) {
+	nyoci_shard_group_t group = NULL;
+	long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+	nyoci_status_t status;
+	int i;
+
+	require(sockaddr != NULL, bail);
+
+	if (cpu_count < 1) {
+		cpu_count = 1;
+	}
+
+	if (count <= 0) {
+		count = (int)cpu_count;
+	}
+
+	group = calloc(1, sizeof(*group) + count * sizeof(group->shards[0]));
+	require(group != NULL, bail);
+
+	group->count = count;
+	group->flags = flags;
+
+	for (i = 0; i < count; i++) {
+		struct nyoci_shard_s* const shard = &group->shards[i];
+
+		shard->group = group;
+		shard->cpu = (flags & NYOCI_SHARD_GROUP_FLAG_NO_AFFINITY) ? -1 : (int)(i % cpu_count);
+		shard->instance = nyoci_create();
+		require(shard->instance != NULL, bail);
+
+		nyoci_set_default_request_handler(shard->instance, handler, context);
+
+		status = nyoci_plat_set_reuse_port(shard->instance, true);
+		require_noerr(status, bail);
+
+		status = nyoci_plat_bind_to_sockaddr(shard->instance, NYOCI_SESSION_TYPE_UDP, sockaddr);
+		require_noerr(status, bail);
+	}
+
+	if (flags & NYOCI_SHARD_GROUP_FLAG_STEER_BY_REMOTE) {
+		status = nyoci_shard_group_attach_steering_(
+			nyoci_plat_get_fd(group->shards[0].instance),
+			count
+		);
+		require_noerr(status, bail);
+	}
+
+	return group;
+
+bail:
+	nyoci_shard_group_release(group);
+	return NULL;
+}
+
+nyoci_status_t
+nyoci_shard_group_start(nyoci_shard_group_t group)
+{
+	nyoci_status_t ret = NYOCI_STATUS_OK;
+	int i;
+
+	require_action(group != NULL, bail, ret = NYOCI_STATUS_INVALID_ARGUMENT);
+	require_quiet(!group->is_running, bail);
+
+	__atomic_store_n(&group->is_running, true, __ATOMIC_RELEASE);
+
+	for (i = 0; i < group->count; i++) {
+		struct nyoci_shard_s* const shard = &group->shards[i];
+		int error = pthread_create(&shard->thread, NULL, &nyoci_shard_thread_, shard);
+
+		if (error != 0) {
+			errno = error;
+			ret = NYOCI_STATUS_ERRNO;
+			nyoci_shard_group_stop(group);
+			break;
+		}
+
+		shard->has_thread = true;
+	}
+
+bail:
+	return ret;
+}
+
+void
+nyoci_shard_group_stop(nyoci_shard_group_t group)
+{
+	int i;
+
+	require_quiet(group != NULL, bail);
+
+	__atomic_store_n(&group->is_running, false, __ATOMIC_RELEASE);
+
+	for (i = 0; i < group->count; i++) {
+		struct nyoci_shard_s* const shard = &group->shards[i];
+
+		if (shard->has_thread) {
+			nyoci_plat_wakeup(shard->instance);
+			pthread_join(shard->thread, NULL);
+			shard->has_thread = false;
+		}
+	}
+
+bail:
+	return;
+}
+
+void
+nyoci_shard_group_release(nyoci_shard_group_t group)
+{
+	int i;
+
+	require_quiet(group != NULL, bail);
+
+	nyoci_shard_group_stop(group);
+
+	for (i = 0; i < group->count; i++) {
+		if (group->shards[i].instance != NULL) {
+			nyoci_release(group->shards[i].instance);
+		}
+	}
+
+	free(group);
+
+bail:
+	return;
+}
+
+int
+nyoci_shard_group_get_count(nyoci_shard_group_t group)
+{
+	return group->count;
+}
+
+nyoci_t
+nyoci_shard_group_get_instance(nyoci_shard_group_t group, int index)
+{
+	if ((index < 0) || (index >= group->count)) {
+		return NULL;
+	}
+	return group->shards[index].instance;
+}
+
+#else // NYOCI_SHARD_GROUP_SUPPORTED
+
+nyoci_shard_group_t
+nyoci_shard_group_create(
+	int count,
+	const nyoci_sockaddr_t* sockaddr,
+	nyoci_request_handler_func handler,
+	void* context,
+	int flags
+) {
+	// Needs threads and SO_REUSEPORT.
+	return NULL;
+}
+
+nyoci_status_t
+nyoci_shard_group_start(nyoci_shard_group_t group)
+{
+	return NYOCI_STATUS_NOT_IMPLEMENTED;
+}
+
+void
+nyoci_shard_group_stop(nyoci_shard_group_t group)
+{
+}
+
+void
+nyoci_shard_group_release(nyoci_shard_group_t group)
+{
+}
+
+int
+nyoci_shard_group_get_count(nyoci_shard_group_t group)
+{
+	return 0;
+}
+
+nyoci_t
+nyoci_shard_group_get_instance(nyoci_shard_group_t group, int index)
+{
+	return NULL;
+}
+
+#endif // NYOCI_SHARD_GROUP_SUPPORTED
+
+#endif // !NYOCI_SINGLETON
@@ -0,0 +1,719 @@
+/*	@file nyoci-plat-net-uring.c
+**	@author Robert Quattlebaum <darco@deepdarc.com>
+**	@desc io_uring I/O engine for the posix network platform
+**
+**	Copyright (C) 2017 Robert Quattlebaum
+**
+**	Permission is hereby granted, free of charge, to any person
+**	obtaining a copy of this software and associated
+**	documentation files (the "Software"), to deal in the
+**	Software without restriction, including without limitation
+**	the rights to use, copy, modify, merge, publish, distribute,
+**	sublicense, and/or sell copies of the Software, and to
+**	permit persons to whom the Software is furnished to do so,
+**	subject to the following conditions:
+**
+**	The above copyright notice and this permission notice shall
+**	be included in all copies or substantial portions of the
+**	Software.
+**
+**	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY
+**	KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+**	WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+**	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+**	OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+**	OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+**	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+**	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifndef VERBOSE_DEBUG
+#define VERBOSE_DEBUG 0
+#endif
+
+#ifndef DEBUG
+#define DEBUG VERBOSE_DEBUG
+#endif
+
+#include "assert-macros.h"
+
+#include "libnyoci.h"
+
+#include "nyoci-internal.h"
+#include "nyoci-logging.h"
+#include "nyoci-missing.h"
+
+#if NYOCI_PLAT_NET_POSIX_USE_IO_URING
+
+#include <stdio.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+// The io_uring operations are issued with raw system calls, so that
+// we don't depend on liburing.
+
+//!	The kind of operation is kept in the top byte of `user_data`.
+#define URING_KIND_SHIFT		56
+#define URING_KIND_RECV			1ull
+#define URING_KIND_SEND			2ull
+#define URING_KIND_CANCEL		3ull
+#define URING_KIND_WAKE			4ull
+
+//!	Space reserved in each receive buffer for control messages.
+#define URING_RECV_CONTROL_LEN	64
+
+//!	Buffer group used for the provided receive buffers.
+#define URING_RECV_BUFFER_GROUP	0
+
+#define URING_ALIGN(x, a)		(((x) + (a) - 1) & ~((size_t)(a) - 1))
+
+static int
+io_uring_setup_(unsigned entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+io_uring_enter_(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int
+io_uring_register_(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static uint64_t
+uring_recv_user_data_(int socket_index, uint32_t gen)
+{
+	return (URING_KIND_RECV << URING_KIND_SHIFT)
+		| ((uint64_t)socket_index << 32)
+		| gen;
+}
+
+//!	Hands everything in the submission queue to the kernel.
+static void
+uring_submit_(struct nyoci_plat_uring_s* uring)
+{
+	while ((uring->fd >= 0) && (uring->to_submit > 0)) {
+		int ret = io_uring_enter_(uring->fd, uring->to_submit, 0, 0, NULL, 0);
+
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			DEBUG_PRINTF("io_uring_enter: %s", strerror(errno));
+			break;
+		}
+
+		if (ret == 0) {
+			break;
+		}
+
+		uring->to_submit -= (unsigned)MIN((unsigned)ret, uring->to_submit);
+	}
+}
+
+//!	Hands out the next free submission queue entry.
+/*!	If the submission queue is full, whatever is in it is submitted
+**	first. Returns NULL if there is still no room after that. */
+static struct io_uring_sqe*
+uring_get_sqe_(struct nyoci_plat_uring_s* uring)
+{
+	unsigned head = __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+	struct io_uring_sqe* sqe;
+	unsigned index;
+
+	if (uring->sq_local_tail - head >= uring->sq_entries) {
+		uring_submit_(uring);
+		head = __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+
+		if (uring->sq_local_tail - head >= uring->sq_entries) {
+			return NULL;
+		}
+	}
+
+	index = uring->sq_local_tail & uring->sq_mask;
+	sqe = &((struct io_uring_sqe*)uring->sqes)[index];
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+//!	Makes the entry returned by uring_get_sqe_() visible to the kernel.
+static void
+uring_commit_sqe_(struct nyoci_plat_uring_s* uring)
+{
+	unsigned index = uring->sq_local_tail & uring->sq_mask;
+
+	uring->sq_array[index] = index;
+	uring->sq_local_tail++;
+	uring->to_submit++;
+	__atomic_store_n(uring->sq_tail, uring->sq_local_tail, __ATOMIC_RELEASE);
+}
+
+//!	Gives the receive buffer `bid` back to the kernel.
+static void
+uring_recycle_buffer_(struct nyoci_plat_uring_s* uring, uint16_t bid)
+{
+	struct io_uring_buf_ring* br = uring->buf_ring;
+	struct io_uring_buf* buf;
+
+	buf = &br->bufs[uring->buf_tail & (NYOCI_PLAT_NET_POSIX_URING_RECV_BUFFERS - 1)];
+	buf->addr = (uint64_t)(uintptr_t)(uring->recv_buffers + (size_t)bid * uring->recv_buffer_size);
+	buf->len = (uint32_t)uring->recv_buffer_size;
+	buf->bid = bid;
+
+	uring->buf_tail++;
+	__atomic_store_n(&br->tail, uring->buf_tail, __ATOMIC_RELEASE);
+}
+
+//!	Arms a multishot receive on the socket at `socket_index`.
+static void
+uring_arm_recv_(struct nyoci_plat_uring_s* uring, int socket_index)
+{
+	struct io_uring_sqe* sqe;
+
+	if (uring->armed_fd[socket_index] < 0) {
+		return;
+	}
+
+	sqe = uring_get_sqe_(uring);
+	require_string(sqe != NULL, bail, "io_uring submission queue is full");
+
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = uring->armed_fd[socket_index];
+	sqe->addr = (uint64_t)(uintptr_t)uring->recv_msghdr;
+	sqe->len = 1;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_RECV_BUFFER_GROUP;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->user_data = uring_recv_user_data_(socket_index, uring->armed_gen[socket_index]);
+
+	uring_commit_sqe_(uring);
+
+bail:
+	return;
+}
+
+//!	Arms a multishot poll on the wakeup descriptor.
+static void
+uring_arm_wake_(struct nyoci_plat_uring_s* uring)
+{
+	struct io_uring_sqe* sqe;
+
+	if (uring->wake_fd < 0) {
+		return;
+	}
+
+	sqe = uring_get_sqe_(uring);
+	require_string(sqe != NULL, bail, "io_uring submission queue is full");
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = uring->wake_fd;
+	sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->poll32_events = POLLIN;
+	sqe->user_data = URING_KIND_WAKE << URING_KIND_SHIFT;
+
+	uring_commit_sqe_(uring);
+
+bail:
+	return;
+}
+
+void
+nyoci_plat_uring_submit(nyoci_t self)
+{
+	uring_submit_(&self->plat.uring);
+}
+
+void
+nyoci_plat_uring_finalize(nyoci_t self)
+{
+	struct nyoci_plat_uring_s* uring = &self->plat.uring;
+
+	// Closing the ring cancels everything that is still in flight.
+	if (uring->fd >= 0) {
+		close(uring->fd);
+		uring->fd = -1;
+	}
+
+	// The buffers are mapped rather than allocated, so any late access
+	// by the kernel after this point fails instead of hitting the heap.
+	if (uring->arena != NULL) {
+		munmap(uring->arena, uring->arena_size);
+	}
+
+	if (uring->sqes != NULL) {
+		munmap(uring->sqes, uring->sqes_size);
+	}
+
+	if ((uring->cq_ring != NULL) && (uring->cq_ring != uring->sq_ring)) {
+		munmap(uring->cq_ring, uring->cq_ring_size);
+	}
+
+	if (uring->sq_ring != NULL) {
+		munmap(uring->sq_ring, uring->sq_ring_size);
+	}
+
+	memset(uring, 0, sizeof(*uring));
+	uring->fd = -1;
+	uring->wake_fd = -1;
+	uring->armed_fd[NYOCI_PLAT_URING_SOCKET_UDP] = -1;
+	uring->armed_fd[NYOCI_PLAT_URING_SOCKET_DTLS] = -1;
+}
+
+nyoci_status_t
+nyoci_plat_uring_init(nyoci_t self)
+{
+	nyoci_status_t ret = NYOCI_STATUS_FAILURE;
+	struct nyoci_plat_uring_s* uring = &self->plat.uring;
+	struct io_uring_params params;
+	struct io_uring_buf_reg reg;
+	size_t buf_ring_size;
+	size_t send_slots_size;
+	char* arena;
+	int i;
+
+	memset(uring, 0, sizeof(*uring));
+	uring->fd = -1;
+	uring->wake_fd = -1;
+	uring->armed_fd[NYOCI_PLAT_URING_SOCKET_UDP] = -1;
+	uring->armed_fd[NYOCI_PLAT_URING_SOCKET_DTLS] = -1;
+
+	memset(&params, 0, sizeof(params));
+
+	uring->fd = io_uring_setup_(NYOCI_PLAT_NET_POSIX_URING_ENTRIES, &params);
+	require_action_string(uring->fd >= 0, bail, ret = NYOCI_STATUS_ERRNO, strerror(errno));
+
+	// We need to be able to wait with a timeout without consuming
+	// a submission queue entry for it.
+	require_action_string(
+		(params.features & IORING_FEAT_EXT_ARG) != 0,
+		bail,
+		ret = NYOCI_STATUS_NOT_IMPLEMENTED,
+		"io_uring lacks IORING_FEAT_EXT_ARG"
+	);
+
+	uring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	uring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		uring->sq_ring_size = MAX(uring->sq_ring_size, uring->cq_ring_size);
+		uring->cq_ring_size = uring->sq_ring_size;
+	}
+
+	uring->sq_ring = mmap(
+		NULL, uring->sq_ring_size,
+		PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		uring->fd, IORING_OFF_SQ_RING
+	);
+	require_action_string(uring->sq_ring != MAP_FAILED, bail, (uring->sq_ring = NULL, ret = NYOCI_STATUS_ERRNO), strerror(errno));
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		uring->cq_ring = uring->sq_ring;
+	} else {
+		uring->cq_ring = mmap(
+			NULL, uring->cq_ring_size,
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			uring->fd, IORING_OFF_CQ_RING
+		);
+		require_action_string(uring->cq_ring != MAP_FAILED, bail, (uring->cq_ring = NULL, ret = NYOCI_STATUS_ERRNO), strerror(errno));
+	}
+
+	uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	uring->sqes = mmap(
+		NULL, uring->sqes_size,
+		PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		uring->fd, IORING_OFF_SQES
+	);
+	require_action_string(uring->sqes != MAP_FAILED, bail, (uring->sqes = NULL, ret = NYOCI_STATUS_ERRNO), strerror(errno));
+
+	uring->sq_head = (unsigned*)((char*)uring->sq_ring + params.sq_off.head);
+	uring->sq_tail = (unsigned*)((char*)uring->sq_ring + params.sq_off.tail);
+	uring->sq_array = (unsigned*)((char*)uring->sq_ring + params.sq_off.array);
+	uring->sq_mask = *(unsigned*)((char*)uring->sq_ring + params.sq_off.ring_mask);
+	uring->sq_entries = params.sq_entries;
+	uring->sq_local_tail = *uring->sq_tail;
+
+	uring->cq_head = (unsigned*)((char*)uring->cq_ring + params.cq_off.head);
+	uring->cq_tail = (unsigned*)((char*)uring->cq_ring + params.cq_off.tail);
+	uring->cq_mask = *(unsigned*)((char*)uring->cq_ring + params.cq_off.ring_mask);
+	uring->cqes = (char*)uring->cq_ring + params.cq_off.cqes;
+
+	// Everything the kernel reads from or writes into lives in one
+	// page-aligned mapping: the provided buffer ring, the receive
+	// buffers, the receive message template and the send slots.
+	uring->recv_buffer_size = URING_ALIGN(
+		sizeof(struct io_uring_recvmsg_out)
+			+ sizeof(nyoci_sockaddr_t)
+			+ URING_RECV_CONTROL_LEN
+			+ NYOCI_MAX_PACKET_LENGTH + 1,
+		16
+	);
+
+	buf_ring_size = URING_ALIGN(
+		NYOCI_PLAT_NET_POSIX_URING_RECV_BUFFERS * sizeof(struct io_uring_buf),
+		sysconf(_SC_PAGESIZE)
+	);
+
+	send_slots_size = NYOCI_PLAT_NET_POSIX_URING_SEND_SLOTS
+		* (sizeof(struct nyoci_plat_send_slot_s) + sizeof(struct msghdr));
+
+	uring->arena_size = buf_ring_size
+		+ NYOCI_PLAT_NET_POSIX_URING_RECV_BUFFERS * uring->recv_buffer_size
+		+ URING_ALIGN(sizeof(struct msghdr), 16)
+		+ send_slots_size;
+
+	uring->arena = mmap(
+		NULL, uring->arena_size,
+		PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+		-1, 0
+	);
+	require_action_string(uring->arena != MAP_FAILED, bail, (uring->arena = NULL, ret = NYOCI_STATUS_MALLOC_FAILURE), strerror(errno));
+
+	arena = uring->arena;
+	uring->buf_ring = arena;
+	arena += buf_ring_size;
+	uring->recv_buffers = arena;
+	arena += NYOCI_PLAT_NET_POSIX_URING_RECV_BUFFERS * uring->recv_buffer_size;
+	uring->recv_msghdr = (struct msghdr*)arena;
+	arena += URING_ALIGN(sizeof(struct msghdr), 16);
+	uring->send_slots = (struct nyoci_plat_send_slot_s*)arena;
+	arena += NYOCI_PLAT_NET_POSIX_URING_SEND_SLOTS * sizeof(struct nyoci_plat_send_slot_s);
+	uring->send_msgs = (struct msghdr*)arena;
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)uring->buf_ring;
+	reg.ring_entries = NYOCI_PLAT_NET_POSIX_URING_RECV_BUFFERS;
+	reg.bgid = URING_RECV_BUFFER_GROUP;
+
+	require_action_string(
+		io_uring_register_(uring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == 0,
+		bail,
+		ret = NYOCI_STATUS_ERRNO,
+		strerror(errno)
+	);
+
+	for (i = 0; i < NYOCI_PLAT_NET_POSIX_URING_RECV_BUFFERS; i++) {
+		uring_recycle_buffer_(uring, (uint16_t)i);
+	}
+
+	// Only the lengths matter here, the kernel lays the name, the
+	// control messages and the payload out inside the chosen buffer.
+	uring->recv_msghdr->msg_namelen = sizeof(nyoci_sockaddr_t);
+	uring->recv_msghdr->msg_controllen = URING_RECV_CONTROL_LEN;
+
+	for (i = 0; i < NYOCI_PLAT_NET_POSIX_URING_SEND_SLOTS; i++) {
+		uring->send_free[i] = (uint16_t)i;
+	}
+	uring->send_free_count = NYOCI_PLAT_NET_POSIX_URING_SEND_SLOTS;
+
+	ret = NYOCI_STATUS_OK;
+
+bail:
+	if (ret != NYOCI_STATUS_OK) {
+		nyoci_plat_uring_finalize(self);
+	}
+	return ret;
+}
+
+void
+nyoci_plat_uring_arm_recv(nyoci_t self, int socket_index, int fd)
+{
+	struct nyoci_plat_uring_s* uring = &self->plat.uring;
+
+	if (uring->fd < 0) {
+		return;
+	}
+
+	if (uring->armed_fd[socket_index] >= 0) {
+		// Closing the socket does not end an operation that is armed
+		// on it, so it has to be cancelled explicitly. Completions
+		// carrying the old generation are ignored from now on.
+		struct io_uring_sqe* sqe = uring_get_sqe_(uring);
+
+		if (sqe != NULL) {
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->fd = -1;
+			sqe->addr = uring_recv_user_data_(socket_index, uring->armed_gen[socket_index]);
+			sqe->user_data = URING_KIND_CANCEL << URING_KIND_SHIFT;
+			uring_commit_sqe_(uring);
+		}
+	}
+
+	uring->armed_fd[socket_index] = fd;
+	uring->armed_port[socket_index] = 0;
+	uring->armed_gen[socket_index]++;
+
+	if (fd >= 0) {
+		nyoci_sockaddr_t saddr;
+		socklen_t socklen = sizeof(saddr);
+
+		if (getsockname(fd, (struct sockaddr*)&saddr, &socklen) == 0) {
+			uring->armed_port[socket_index] = ntohs(saddr.nyoci_port);
+		}
+	}
+
+	uring_arm_recv_(uring, socket_index);
+
+	nyoci_plat_uring_submit(self);
+}
+
+void
+nyoci_plat_uring_arm_wake(nyoci_t self, int fd)
+{
+	struct nyoci_plat_uring_s* uring = &self->plat.uring;
+
+	if (uring->fd < 0) {
+		return;
+	}
+
+	uring->wake_fd = fd;
+	uring_arm_wake_(uring);
+	uring_submit_(uring);
+}
+
+int
+nyoci_plat_uring_wait(nyoci_t self, nyoci_cms_t cms)
+{
+	struct nyoci_plat_uring_s* uring = &self->plat.uring;
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	int ret;
+
+	if (*uring->cq_head != __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE)) {
+		return 1;
+	}
+
+	if (cms < 0) {
+		cms = 0;
+	}
+
+	memset(&arg, 0, sizeof(arg));
+	arg.sigmask_sz = _NSIG / 8;
+	ts.tv_sec = cms / MSEC_PER_SEC;
+	ts.tv_nsec = (cms % MSEC_PER_SEC) * USEC_PER_MSEC * 1000;
+	arg.ts = (uint64_t)(uintptr_t)&ts;
+
+	// This also submits anything that is still queued, and lets the
+	// kernel run any pending completion work when `cms` is zero.
+	ret = io_uring_enter_(
+		uring->fd,
+		uring->to_submit,
+		(cms > 0) ? 1 : 0,
+		IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+		&arg,
+		sizeof(arg)
+	);
+
+	if (ret >= 0) {
+		uring->to_submit -= (unsigned)MIN((unsigned)ret, uring->to_submit);
+	} else if ((errno == ETIME) || (errno == EINTR) || (errno == EBUSY)) {
+		ret = 0;
+	} else {
+		return -1;
+	}
+
+	return (*uring->cq_head != __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE));
+}
+
+//!	Handles the completion of a multishot receive.
+/*!	Returns the number of datagrams that were handled (zero or one). */
+static int
+uring_handle_recv_(nyoci_t self, const struct io_uring_cqe* cqe, nyoci_status_t* status)
+{
+	struct nyoci_plat_uring_s* uring = &self->plat.uring;
+	const int socket_index = (int)((cqe->user_data >> 32) & 0xFF);
+	const uint32_t gen = (uint32_t)cqe->user_data;
+	const bool is_current = (socket_index < NYOCI_PLAT_URING_SOCKET_COUNT)
+		&& (gen == uring->armed_gen[socket_index])
+		&& (uring->armed_fd[socket_index] >= 0);
+	int ret = 0;
+
+	if ((cqe->res >= 0) && (cqe->flags & IORING_CQE_F_BUFFER)) {
+		const uint16_t bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+		char* buffer = uring->recv_buffers + (size_t)bid * uring->recv_buffer_size;
+		struct io_uring_recvmsg_out* out = (struct io_uring_recvmsg_out*)buffer;
+		char* name = buffer + sizeof(*out);
+		char* control = name + sizeof(nyoci_sockaddr_t);
+		char* payload = control + URING_RECV_CONTROL_LEN;
+
+		if (!is_current) {
+			// Left over from a socket that has since been replaced.
+
+		} else if ((out->flags & MSG_TRUNC)
+			|| (out->payloadlen > NYOCI_MAX_PACKET_LENGTH)
+			|| (out->payloadlen == 0)
+		) {
+			DEBUG_PRINTF("io_uring: Dropping %u byte datagram", out->payloadlen);
+
+		} else {
+			const int fd = uring->armed_fd[socket_index];
+			nyoci_sockaddr_t remote_saddr = { 0 };
+			struct msghdr msg = { 0 };
+			nyoci_status_t packet_status;
+
+			memcpy(&remote_saddr, name, MIN(out->namelen, sizeof(remote_saddr)));
+			msg.msg_control = control;
+			msg.msg_controllen = MIN(out->controllen, URING_RECV_CONTROL_LEN);
+
+			packet_status = nyoci_plat_inbound_datagram_process(
+				self,
+				fd,
+				uring->armed_port[socket_index],
+				&remote_saddr,
+				&msg,
+				payload,
+				out->payloadlen
+			);
+
+			if (*status == NYOCI_STATUS_OK) {
+				*status = packet_status;
+			}
+
+			ret = 1;
+		}
+
+		uring_recycle_buffer_(uring, bid);
+
+	} else if ((cqe->res < 0) && (cqe->res != -ENOBUFS) && (cqe->res != -ECANCELED)) {
+		DEBUG_PRINTF("io_uring recvmsg: %s", strerror(-cqe->res));
+
+		if (is_current && !(cqe->flags & IORING_CQE_F_MORE) && (cqe->res == -EINVAL)) {
+			// The kernel does not support multishot receives. Don't
+			// spin rearming something that will never work.
+			uring->armed_fd[socket_index] = -1;
+		}
+	}
+
+	if (is_current && !(cqe->flags & IORING_CQE_F_MORE)) {
+		// The multishot operation has ended, usually because we ran
+		// out of buffers. Those have been recycled by now, so rearm.
+		uring_arm_recv_(uring, socket_index);
+	}
+
+	return ret;
+}
+
+int
+nyoci_plat_uring_process(nyoci_t self, int budget, nyoci_status_t* status)
+{
+	struct nyoci_plat_uring_s* uring = &self->plat.uring;
+	unsigned head = *uring->cq_head;
+	int count = 0;
+
+	while (count < budget) {
+		const struct io_uring_cqe* cqe;
+		unsigned tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+
+		if (head == tail) {
+			break;
+		}
+
+		cqe = &((const struct io_uring_cqe*)uring->cqes)[head & uring->cq_mask];
+
+		switch (cqe->user_data >> URING_KIND_SHIFT) {
+		case URING_KIND_RECV:
+			count += uring_handle_recv_(self, cqe, status);
+			break;
+
+		case URING_KIND_SEND:
+			if (cqe->res < 0) {
+				// As with any other unreliable transport, retransmissions
+				// will cover for a packet that could not be sent.
+				DEBUG_PRINTF("io_uring sendmsg: %s", strerror(-cqe->res));
+			}
+			uring->send_free[uring->send_free_count++] = (uint16_t)cqe->user_data;
+			break;
+
+		case URING_KIND_WAKE:
+			nyoci_plat_wakeup_drain(self);
+			if (!(cqe->flags & IORING_CQE_F_MORE)) {
+				uring_arm_wake_(uring);
+			}
+			break;
+
+		default:
+			break;
+		}
+
+		head++;
+		__atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	return count;
+}
+
+nyoci_status_t
+nyoci_plat_uring_send(
+	nyoci_t self,
+	int fd,
+	const void *data, size_t len,
+	const nyoci_sockaddr_t* saddr_to,
+	const nyoci_sockaddr_t* saddr_from
+) {
+	struct nyoci_plat_uring_s* uring = &self->plat.uring;
+	nyoci_status_t ret = NYOCI_STATUS_FAILURE;
+	struct nyoci_plat_send_slot_s* slot;
+	struct io_uring_sqe* sqe;
+	uint16_t index;
+
+	require_quiet(uring->fd >= 0, bail);
+	require_action(len <= NYOCI_MAX_PACKET_LENGTH, bail, ret = NYOCI_STATUS_MESSAGE_TOO_BIG);
+
+	// If every slot is in flight, let the caller send synchronously.
+	require_quiet(uring->send_free_count > 0, bail);
+
+	sqe = uring_get_sqe_(uring);
+	require_quiet(sqe != NULL, bail);
+
+	index = uring->send_free[--uring->send_free_count];
+	slot = &uring->send_slots[index];
+
+	slot->remote_saddr = *saddr_to;
+	slot->local_saddr = *saddr_from;
+	memcpy(slot->packet, data, len);
+	slot->iov.iov_base = slot->packet;
+	slot->iov.iov_len = len;
+
+	sendtofrom_prepare_msghdr(
+		&uring->send_msgs[index],
+		&slot->iov,
+		slot->cmbuf, sizeof(slot->cmbuf),
+		(struct sockaddr *)&slot->remote_saddr,
+		sizeof(nyoci_sockaddr_t),
+		(struct sockaddr *)&slot->local_saddr,
+		sizeof(nyoci_sockaddr_t)
+	);
+
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)&uring->send_msgs[index];
+	sqe->len = 1;
+	sqe->user_data = (URING_KIND_SEND << URING_KIND_SHIFT) | index;
+
+	uring_commit_sqe_(uring);
+
+	// Inside of nyoci_plat_run_once() the submission is deferred until
+	// the end of the pass, so that all replies go out in one system call.
+	if (!self->plat.is_processing) {
+		nyoci_plat_uring_submit(self);
+	}
+
+	ret = NYOCI_STATUS_OK;
+
+bail:
+	return ret;
+}
+
+#endif // NYOCI_PLAT_NET_POSIX_USE_IO_URING
@@ -61,6 +61,16 @@
 #include <sys/select.h>
 #include <poll.h>
 
+#if NYOCI_PLAT_NET_POSIX_USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
+#if HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
+#include <fcntl.h>
+
 #ifndef SOCKADDR_HAS_LENGTH_FIELD
 #if defined(__KAME__)
 #define SOCKADDR_HAS_LENGTH_FIELD 1
@@ -216,10 +226,47 @@ nyoci_plat_join_standard_groups(nyoci_t self, int interface)
 	return ret;
 }
 
+//!	Sends everything that is waiting in the outbound queue, in order.
+static void
+nyoci_plat_flush_send_queue_(nyoci_t self)
+{
+#if HAVE_SENDMMSG && !NYOCI_AVOID_MALLOC
+	int sent = 0;
+
+	while (sent < self->plat.send_count) {
+		int ret = sendmmsg(
+			self->plat.fd_udp,
+			self->plat.send_msgs + sent,
+			(unsigned int)(self->plat.send_count - sent),
+			0
+		);
+
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			// Drop the packet that failed and carry on with the
+			// others. Retransmissions will cover for the lost one.
+			DEBUG_PRINTF("sendmmsg: %s", strerror(errno));
+			ret = 1;
+		}
+
+		sent += ret;
+	}
+#endif
+
+	self->plat.send_count = 0;
+}
+
 nyoci_t
 nyoci_plat_init(nyoci_t self) {
 	NYOCI_SINGLETON_SELF_HOOK;
 
+	self->plat.epoll_fd = -1;
+	self->plat.wake_fd[0] = -1;
+	self->plat.wake_fd[1] = -1;
+	self->plat.uring.fd = -1;
 	self->plat.mcfd_v6 = -1;
 	self->plat.mcfd_v4 = -1;
 	self->plat.fd_udp = -1;
@@ -227,6 +274,57 @@ nyoci_plat_init(nyoci_t self) {
 	self->plat.fd_dtls = -1;
 #endif
 
+#if NYOCI_PLAT_NET_POSIX_USE_IO_URING
+	if (nyoci_plat_uring_init(self) != NYOCI_STATUS_OK) {
+		DEBUG_PRINTF("io_uring unavailable, falling back");
+	}
+#endif
+
+#if NYOCI_PLAT_NET_POSIX_USE_EPOLL
+	if (self->plat.uring.fd < 0) {
+		self->plat.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		check_string(self->plat.epoll_fd >= 0, strerror(errno));
+	}
+#endif
+
+#if NYOCI_THREAD_SAFE
+	// Lets other threads interrupt nyoci_plat_wait(), see nyoci_plat_wakeup().
+#if HAVE_SYS_EVENTFD_H
+	self->plat.wake_fd[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	self->plat.wake_fd[1] = self->plat.wake_fd[0];
+#else
+	if (pipe(self->plat.wake_fd) == 0) {
+		fcntl(self->plat.wake_fd[0], F_SETFL, O_NONBLOCK);
+		fcntl(self->plat.wake_fd[1], F_SETFL, O_NONBLOCK);
+		fcntl(self->plat.wake_fd[0], F_SETFD, FD_CLOEXEC);
+		fcntl(self->plat.wake_fd[1], F_SETFD, FD_CLOEXEC);
+	} else {
+		self->plat.wake_fd[0] = -1;
+		self->plat.wake_fd[1] = -1;
+	}
+#endif
+	check_string(self->plat.wake_fd[0] >= 0, strerror(errno));
+
+#if NYOCI_PLAT_NET_POSIX_USE_IO_URING
+	if (self->plat.uring.fd >= 0) {
+		nyoci_plat_uring_arm_wake(self, self->plat.wake_fd[0]);
+	}
+#endif
+
+#if NYOCI_PLAT_NET_POSIX_USE_EPOLL
+	if ((self->plat.epoll_fd >= 0) && (self->plat.wake_fd[0] >= 0)) {
+		struct epoll_event event = { 0 };
+
+		event.events = EPOLLIN;
+		event.data.fd = self->plat.wake_fd[0];
+
+		if (epoll_ctl(self->plat.epoll_fd, EPOLL_CTL_ADD, self->plat.wake_fd[0], &event) != 0) {
+			check_string(false, strerror(errno));
+		}
+	}
+#endif
+#endif // NYOCI_THREAD_SAFE
+
 #if NYOCI_PLAT_NET_POSIX_FAMILY == AF_INET6
 	if (self->plat.mcfd_v6 == -1) {
 		self->plat.mcfd_v6 = socket(AF_INET6, SOCK_DGRAM, 0);
@@ -260,6 +358,15 @@ nyoci_plat_init(nyoci_t self) {
 			);
 		}
 	}
+
+	nyoci_plat_set_recv_batch(
+		self,
+		NYOCI_PLAT_NET_POSIX_RECV_BATCH_SIZE,
+		NYOCI_PLAT_NET_POSIX_RECV_BUDGET
+	);
+
+	nyoci_plat_set_send_batch(self, NYOCI_PLAT_NET_POSIX_SEND_BATCH_SIZE);
+
 	return self;
 }
 
@@ -267,6 +374,10 @@ void
 nyoci_plat_finalize(nyoci_t self) {
 	NYOCI_SINGLETON_SELF_HOOK;
 
+#if NYOCI_PLAT_NET_POSIX_USE_IO_URING
+	nyoci_plat_uring_finalize(self);
+#endif
+
 	if (self->plat.fd_udp >= 0) {
 		close(self->plat.fd_udp);
 	}
@@ -286,6 +397,146 @@ nyoci_plat_finalize(nyoci_t self) {
 	if (self->plat.mcfd_v4 >= 0) {
 		close(self->plat.mcfd_v4);
 	}
+
+	if (self->plat.epoll_fd >= 0) {
+		close(self->plat.epoll_fd);
+		self->plat.epoll_fd = -1;
+	}
+
+	if (self->plat.wake_fd[1] != self->plat.wake_fd[0]) {
+		close(self->plat.wake_fd[1]);
+	}
+
+	if (self->plat.wake_fd[0] >= 0) {
+		close(self->plat.wake_fd[0]);
+	}
+
+	self->plat.wake_fd[0] = -1;
+	self->plat.wake_fd[1] = -1;
+
+#if !NYOCI_AVOID_MALLOC
+	free(self->plat.recv_slots);
+	free(self->plat.recv_msgs);
+	self->plat.recv_slots = NULL;
+	self->plat.recv_msgs = NULL;
+
+	free(self->plat.send_slots);
+	free(self->plat.send_msgs);
+	self->plat.send_slots = NULL;
+	self->plat.send_msgs = NULL;
+	self->plat.send_count = 0;
+#endif
+}
+
+nyoci_status_t
+nyoci_plat_set_recv_batch(nyoci_t self, int batch_size, int budget)
+{
+	NYOCI_SINGLETON_SELF_HOOK;
+	nyoci_status_t ret = NYOCI_STATUS_OK;
+
+	require_action(batch_size > 0, bail, ret = NYOCI_STATUS_INVALID_ARGUMENT);
+	require_action(budget > 0, bail, ret = NYOCI_STATUS_INVALID_ARGUMENT);
+
+	if (batch_size > NYOCI_PLAT_NET_POSIX_RECV_BATCH_MAX) {
+		batch_size = NYOCI_PLAT_NET_POSIX_RECV_BATCH_MAX;
+	}
+
+	self->plat.recv_budget = budget;
+
+#if HAVE_RECVMMSG && !NYOCI_AVOID_MALLOC
+	if (batch_size != self->plat.recv_batch_size) {
+		free(self->plat.recv_slots);
+		free(self->plat.recv_msgs);
+		self->plat.recv_slots = NULL;
+		self->plat.recv_msgs = NULL;
+		self->plat.recv_batch_size = 1;
+
+		if (batch_size > 1) {
+			self->plat.recv_slots = calloc(batch_size, sizeof(*self->plat.recv_slots));
+			self->plat.recv_msgs = calloc(batch_size, sizeof(*self->plat.recv_msgs));
+
+			if (!self->plat.recv_slots || !self->plat.recv_msgs) {
+				free(self->plat.recv_slots);
+				free(self->plat.recv_msgs);
+				self->plat.recv_slots = NULL;
+				self->plat.recv_msgs = NULL;
+				ret = NYOCI_STATUS_MALLOC_FAILURE;
+				goto bail;
+			}
+		}
+
+		self->plat.recv_batch_size = batch_size;
+	}
+#else
+	// Without recvmmsg() we always read one datagram at a time.
+	self->plat.recv_batch_size = 1;
+#endif
+
+bail:
+	return ret;
+}
+
+nyoci_status_t
+nyoci_plat_set_send_batch(nyoci_t self, int batch_size)
+{
+	NYOCI_SINGLETON_SELF_HOOK;
+	nyoci_status_t ret = NYOCI_STATUS_OK;
+
+	require_action(batch_size >= 0, bail, ret = NYOCI_STATUS_INVALID_ARGUMENT);
+
+	if (batch_size > NYOCI_PLAT_NET_POSIX_SEND_BATCH_MAX) {
+		batch_size = NYOCI_PLAT_NET_POSIX_SEND_BATCH_MAX;
+	}
+
+	if (batch_size == 1) {
+		batch_size = 0;
+	}
+
+	// Make sure nothing that is already queued gets lost.
+	nyoci_plat_flush_send_queue_(self);
+
+#if HAVE_SENDMMSG && !NYOCI_AVOID_MALLOC
+	if (batch_size != self->plat.send_batch_size) {
+		free(self->plat.send_slots);
+		free(self->plat.send_msgs);
+		self->plat.send_slots = NULL;
+		self->plat.send_msgs = NULL;
+		self->plat.send_batch_size = 0;
+
+		if (batch_size > 0) {
+			self->plat.send_slots = calloc(batch_size, sizeof(*self->plat.send_slots));
+			self->plat.send_msgs = calloc(batch_size, sizeof(*self->plat.send_msgs));
+
+			if (!self->plat.send_slots || !self->plat.send_msgs) {
+				free(self->plat.send_slots);
+				free(self->plat.send_msgs);
+				self->plat.send_slots = NULL;
+				self->plat.send_msgs = NULL;
+				ret = NYOCI_STATUS_MALLOC_FAILURE;
+				goto bail;
+			}
+		}
+
+		self->plat.send_batch_size = batch_size;
+	}
+#else
+	require_action(batch_size == 0, bail, ret = NYOCI_STATUS_NOT_IMPLEMENTED);
+#endif
+
+bail:
+	return ret;
+}
+
+nyoci_status_t
+nyoci_plat_set_reuse_port(nyoci_t self, bool reuse_port)
+{
+	NYOCI_SINGLETON_SELF_HOOK;
+#ifdef SO_REUSEPORT
+	self->plat.reuse_port = reuse_port;
+	return NYOCI_STATUS_OK;
+#else
+	return reuse_port ? NYOCI_STATUS_NOT_IMPLEMENTED : NYOCI_STATUS_OK;
+#endif
 }
 
 int
@@ -294,6 +545,95 @@ nyoci_plat_get_fd(nyoci_t self) {
 	return self->plat.fd_udp;
 }
 
+int
+nyoci_plat_get_event_fd(nyoci_t self) {
+	NYOCI_SINGLETON_SELF_HOOK;
+	if (self->plat.uring.fd >= 0) {
+		return self->plat.uring.fd;
+	}
+	if (self->plat.epoll_fd >= 0) {
+		return self->plat.epoll_fd;
+	}
+	return self->plat.fd_udp;
+}
+
+void
+nyoci_plat_wakeup(nyoci_t self)
+{
+	NYOCI_SINGLETON_SELF_HOOK;
+	const uint64_t value = 1;
+	ssize_t ret;
+
+	if (self->plat.wake_fd[1] < 0) {
+		return;
+	}
+
+	// An eventfd needs eight bytes, any byte will do for a pipe. If the
+	// pipe is full there are enough wakeups pending already.
+	do {
+		ret = write(
+			self->plat.wake_fd[1],
+			&value,
+			(self->plat.wake_fd[1] == self->plat.wake_fd[0]) ? sizeof(value) : 1
+		);
+	} while ((ret < 0) && (errno == EINTR));
+}
+
+void
+nyoci_plat_wakeup_drain(nyoci_t self)
+{
+	uint64_t buffer[8];
+
+	while (read(self->plat.wake_fd[0], buffer, sizeof(buffer)) > 0) {
+		if (self->plat.wake_fd[1] == self->plat.wake_fd[0]) {
+			// An eventfd is drained by a single read.
+			break;
+		}
+	}
+}
+
+//!	Replaces the socket in `*fd_ptr` with `fd`, keeping the epoll set
+//!	(or the receive armed in the io_uring) in sync.
+static void
+nyoci_plat_replace_fd_(nyoci_t self, int* fd_ptr, int fd)
+{
+#if NYOCI_PLAT_NET_POSIX_USE_IO_URING
+	if (self->plat.uring.fd >= 0) {
+		nyoci_plat_uring_arm_recv(
+			self,
+			(fd_ptr == &self->plat.fd_udp)
+				? NYOCI_PLAT_URING_SOCKET_UDP
+				: NYOCI_PLAT_URING_SOCKET_DTLS,
+			fd
+		);
+	}
+#endif
+
+	if (*fd_ptr >= 0) {
+#if NYOCI_PLAT_NET_POSIX_USE_EPOLL
+		if (self->plat.epoll_fd >= 0) {
+			epoll_ctl(self->plat.epoll_fd, EPOLL_CTL_DEL, *fd_ptr, NULL);
+		}
+#endif
+		close(*fd_ptr);
+	}
+
+	*fd_ptr = fd;
+
+#if NYOCI_PLAT_NET_POSIX_USE_EPOLL
+	if ((fd >= 0) && (self->plat.epoll_fd >= 0)) {
+		struct epoll_event event = { 0 };
+
+		event.events = EPOLLIN;
+		event.data.fd = fd;
+
+		if (epoll_ctl(self->plat.epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+			check_string(false, strerror(errno));
+		}
+	}
+#endif
+}
+
 static uint16_t
 get_port_for_fd(int fd) {
 	nyoci_sockaddr_t saddr;
@@ -391,6 +731,18 @@ nyoci_plat_bind_to_sockaddr(
 	}
 #endif
 
+#ifdef SO_REUSEPORT
+	if (self->plat.reuse_port) {
+		int value = 1;
+		require_action_string(
+			setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &value, sizeof(value)) == 0,
+			bail,
+			ret = NYOCI_STATUS_ERRNO,
+			strerror(errno)
+		);
+	}
+#endif
+
 	require_action_string(
 		bind(fd, (struct sockaddr*)sockaddr, sizeof(*sockaddr)) == 0,
 		bail,
@@ -408,13 +760,14 @@ nyoci_plat_bind_to_sockaddr(
 	// TODO: Fix this!
 	switch(type) {
 	case NYOCI_SESSION_TYPE_UDP:
-		self->plat.fd_udp = fd;
+		nyoci_plat_flush_send_queue_(self);
+		nyoci_plat_replace_fd_(self, &self->plat.fd_udp, fd);
 		break;
 
 #if NYOCI_DTLS
 	case NYOCI_SESSION_TYPE_DTLS:
 		DEBUG_PRINTF("DTLS Port %d", get_port_for_fd(fd));
-		self->plat.fd_dtls = fd;
+		nyoci_plat_replace_fd_(self, &self->plat.fd_dtls, fd);
 		break;
 #endif
 
@@ -492,6 +845,17 @@ nyoci_plat_update_pollfds(
 	}
 #endif // NYOCI_DTLS
 
+	if (self->plat.wake_fd[0] >= 0) {
+		if (ret <= maxfds) {
+			fds->fd = self->plat.wake_fd[0];
+			fds->events = POLLIN;
+			fds->revents = 0;
+			fds++;
+			maxfds--;
+		}
+		ret++;
+	}
+
 bail:
 	return ret;
 }
@@ -538,6 +902,16 @@ nyoci_plat_update_fdsets(
 	}
 #endif
 
+	if (self->plat.wake_fd[0] >= 0) {
+		if (read_fd_set) {
+			FD_SET(self->plat.wake_fd[0], read_fd_set);
+		}
+
+		if (fd_count && (*fd_count <= self->plat.wake_fd[0])) {
+			*fd_count = self->plat.wake_fd[0] + 1;
+		}
+	}
+
 	if (timeout) {
 		nyoci_cms_t tmp = nyoci_get_timeout(self);
 
@@ -550,17 +924,25 @@ nyoci_plat_update_fdsets(
 }
 
 
-ssize_t
-sendtofrom(
-	int fd,
-	const void *data, size_t len, int flags,
+void
+sendtofrom_prepare_msghdr(
+	struct msghdr* msg,
+	struct iovec* iov,
+	void* cmbuf, size_t cmbuf_len,
 	const struct sockaddr * saddr_to, socklen_t socklen_to,
 	const struct sockaddr * saddr_from, socklen_t socklen_from
-)
-{
-	ssize_t ret = -1;
+) {
+	struct cmsghdr *scmsgp;
+
+	memset(msg, 0, sizeof(*msg));
+	msg->msg_name = (void*)saddr_to;
+	msg->msg_namelen = socklen_to;
+	msg->msg_iov = iov;
+	msg->msg_iovlen = 1;
 
-	if (NYOCI_IS_ADDR_MULTICAST(&((nyoci_sockaddr_t*)saddr_from)->nyoci_addr)) {
+	if ((saddr_from != NULL)
+		&& NYOCI_IS_ADDR_MULTICAST(&((nyoci_sockaddr_t*)saddr_from)->nyoci_addr)
+	) {
 		saddr_from = NULL;
 		socklen_from = 0;
 	}
@@ -569,60 +951,69 @@ sendtofrom(
 		|| (saddr_from == NULL)
 		|| (saddr_from->sa_family != saddr_to->sa_family)
 	) {
-		ret = sendto(
-			fd,
-			data,
-			len,
-			0,
-			(struct sockaddr *)saddr_to,
-			socklen_to
-		);
-		check(ret>0);
-	} else {
-		struct iovec iov = { (void *)data, len };
-		uint8_t cmbuf[CMSG_SPACE(sizeof (struct in6_pktinfo))];
-		struct cmsghdr *scmsgp;
-		struct msghdr msg = {
-			.msg_name = (void*)saddr_to,
-			.msg_namelen = socklen_to,
-			.msg_iov = &iov,
-			.msg_iovlen = 1,
-			.msg_control = cmbuf,
-			.msg_controllen = sizeof(cmbuf),
-		};
+		// No source address, let the kernel pick one.
+		return;
+	}
+
+	assert(cmbuf_len >= CMSG_SPACE(sizeof(struct in6_pktinfo)));
+
+	memset(cmbuf, 0, cmbuf_len);
+	msg->msg_control = cmbuf;
+	msg->msg_controllen = cmbuf_len;
 
 #if defined(AF_INET6)
-		if (saddr_to->sa_family == AF_INET6) {
-			struct in6_pktinfo *pktinfo;
-			scmsgp = CMSG_FIRSTHDR(&msg);
-			scmsgp->cmsg_level = IPPROTO_IPV6;
-			scmsgp->cmsg_type = IPV6_PKTINFO;
-			scmsgp->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
-			pktinfo = (struct in6_pktinfo *)(CMSG_DATA(scmsgp));
-
-			pktinfo->ipi6_addr = ((struct sockaddr_in6*)saddr_from)->sin6_addr;
-			pktinfo->ipi6_ifindex = ((struct sockaddr_in6*)saddr_from)->sin6_scope_id;
-		} else
+	if (saddr_to->sa_family == AF_INET6) {
+		struct in6_pktinfo *pktinfo;
+		scmsgp = CMSG_FIRSTHDR(msg);
+		scmsgp->cmsg_level = IPPROTO_IPV6;
+		scmsgp->cmsg_type = IPV6_PKTINFO;
+		scmsgp->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
+		pktinfo = (struct in6_pktinfo *)(CMSG_DATA(scmsgp));
+
+		pktinfo->ipi6_addr = ((struct sockaddr_in6*)saddr_from)->sin6_addr;
+		pktinfo->ipi6_ifindex = ((struct sockaddr_in6*)saddr_from)->sin6_scope_id;
+	} else
 #endif
 
-		if (saddr_to->sa_family == AF_INET) {
-			struct in_pktinfo *pktinfo;
-			scmsgp = CMSG_FIRSTHDR(&msg);
-			scmsgp->cmsg_level = IPPROTO_IP;
-			scmsgp->cmsg_type = IP_PKTINFO;
-			scmsgp->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
-			pktinfo = (struct in_pktinfo *)(CMSG_DATA(scmsgp));
-
-			pktinfo->ipi_spec_dst = ((struct sockaddr_in*)saddr_to)->sin_addr;
-			pktinfo->ipi_addr = ((struct sockaddr_in*)saddr_from)->sin_addr;
-			pktinfo->ipi_ifindex = 0;
-		}
+	if (saddr_to->sa_family == AF_INET) {
+		struct in_pktinfo *pktinfo;
+		scmsgp = CMSG_FIRSTHDR(msg);
+		scmsgp->cmsg_level = IPPROTO_IP;
+		scmsgp->cmsg_type = IP_PKTINFO;
+		scmsgp->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
+		pktinfo = (struct in_pktinfo *)(CMSG_DATA(scmsgp));
+
+		pktinfo->ipi_spec_dst = ((struct sockaddr_in*)saddr_to)->sin_addr;
+		pktinfo->ipi_addr = ((struct sockaddr_in*)saddr_from)->sin_addr;
+		pktinfo->ipi_ifindex = 0;
+	}
+}
 
-		ret = sendmsg(fd, &msg, flags);
+ssize_t
+sendtofrom(
+	int fd,
+	const void *data, size_t len, int flags,
+	const struct sockaddr * saddr_to, socklen_t socklen_to,
+	const struct sockaddr * saddr_from, socklen_t socklen_from
+)
+{
+	ssize_t ret = -1;
+	struct iovec iov = { (void *)data, len };
+	uint8_t cmbuf[CMSG_SPACE(sizeof (struct in6_pktinfo))];
+	struct msghdr msg;
+
+	sendtofrom_prepare_msghdr(
+		&msg,
+		&iov,
+		cmbuf, sizeof(cmbuf),
+		saddr_to, socklen_to,
+		saddr_from, socklen_from
+	);
 
-		check(ret > 0);
-		check_string(ret >= 0, strerror(errno));
-	}
+	ret = sendmsg(fd, &msg, flags);
+
+	check(ret > 0);
+	check_string(ret >= 0, strerror(errno));
 
 	return ret;
 }
@@ -757,6 +1148,57 @@ nyoci_plat_outbound_finish(nyoci_t self,const uint8_t* data_ptr, coap_size_t dat
 		}
 #endif
 
+#if NYOCI_PLAT_NET_POSIX_USE_IO_URING
+		if (self->plat.uring.fd >= 0) {
+			ret = nyoci_plat_uring_send(
+				self,
+				fd,
+				data_ptr,
+				data_len,
+				nyoci_plat_get_remote_sockaddr(),
+				nyoci_plat_get_local_sockaddr()
+			);
+
+			// Otherwise there is no room left in the ring, so fall
+			// through and send the packet synchronously.
+			if (ret != NYOCI_STATUS_FAILURE) {
+				goto bail;
+			}
+		}
+#endif
+
+#if HAVE_SENDMMSG && !NYOCI_AVOID_MALLOC
+		if (self->plat.is_processing && (self->plat.send_slots != NULL)) {
+			struct nyoci_plat_send_slot_s* slot;
+
+			require_action(data_len <= NYOCI_MAX_PACKET_LENGTH, bail, ret = NYOCI_STATUS_MESSAGE_TOO_BIG);
+
+			slot = &self->plat.send_slots[self->plat.send_count];
+			slot->remote_saddr = *nyoci_plat_get_remote_sockaddr();
+			slot->local_saddr = *nyoci_plat_get_local_sockaddr();
+			memcpy(slot->packet, data_ptr, data_len);
+			slot->iov.iov_base = slot->packet;
+			slot->iov.iov_len = data_len;
+
+			sendtofrom_prepare_msghdr(
+				&self->plat.send_msgs[self->plat.send_count].msg_hdr,
+				&slot->iov,
+				slot->cmbuf, sizeof(slot->cmbuf),
+				(struct sockaddr *)&slot->remote_saddr,
+				sizeof(nyoci_sockaddr_t),
+				(struct sockaddr *)&slot->local_saddr,
+				sizeof(nyoci_sockaddr_t)
+			);
+
+			if (++self->plat.send_count >= self->plat.send_batch_size) {
+				nyoci_plat_flush_send_queue_(self);
+			}
+
+			ret = NYOCI_STATUS_OK;
+			goto bail;
+		}
+#endif
+
 		sent_bytes = sendtofrom(
 			fd,
 			data_ptr,
@@ -789,21 +1231,76 @@ bail:
 
 // MARK: -
 
+//!	Maximum number of descriptors reported by one wait.
+#define NYOCI_PLAT_MAX_READY_FDS		8
+
+//!	Waits up to `cms` milliseconds for sockets to become readable.
+/*!	The descriptors that are ready are stored in `fds`. Returns the
+**	number of ready descriptors, or -1 on error. */
+static int
+nyoci_plat_wait_for_fds_(nyoci_t self, nyoci_cms_t cms, int fds[NYOCI_PLAT_MAX_READY_FDS])
+{
+	int ready;
+	int i;
+
+#if NYOCI_PLAT_NET_POSIX_USE_IO_URING
+	if (self->plat.uring.fd >= 0) {
+		// Completions from every socket arrive on the one ring.
+		ready = nyoci_plat_uring_wait(self, cms);
+
+		if (ready > 0) {
+			fds[0] = self->plat.uring.fd;
+		}
+	} else
+#endif
+#if NYOCI_PLAT_NET_POSIX_USE_EPOLL
+	if (self->plat.epoll_fd >= 0) {
+		struct epoll_event events[NYOCI_PLAT_MAX_READY_FDS];
+
+		ready = epoll_wait(self->plat.epoll_fd, events, NYOCI_PLAT_MAX_READY_FDS, cms);
+
+		for (i = 0; i < ready; i++) {
+			fds[i] = events[i].data.fd;
+		}
+	} else
+#endif
+	{
+		struct pollfd polls[NYOCI_PLAT_MAX_READY_FDS];
+		int poll_count;
+
+		poll_count = nyoci_plat_update_pollfds(self, polls, NYOCI_PLAT_MAX_READY_FDS);
+
+		if (poll_count > NYOCI_PLAT_MAX_READY_FDS) {
+			poll_count = NYOCI_PLAT_MAX_READY_FDS;
+		}
+
+		ready = poll(polls, poll_count, cms);
+
+		if (ready > 0) {
+			ready = 0;
+			for (i = 0; i < poll_count; i++) {
+				if (polls[i].revents) {
+					fds[ready++] = polls[i].fd;
+				}
+			}
+		}
+	}
+
+	if ((ready < 0) && (errno == EINTR)) {
+		ready = 0;
+	}
+
+	return ready;
+}
+
 nyoci_status_t
 nyoci_plat_wait(
 	nyoci_t self, nyoci_cms_t cms
 ) {
 	NYOCI_SINGLETON_SELF_HOOK;
 	nyoci_status_t ret = NYOCI_STATUS_OK;
-	struct pollfd polls[4];
+	int fds[NYOCI_PLAT_MAX_READY_FDS];
 	int descriptors_ready;
-	int poll_count;
-
-	poll_count = nyoci_plat_update_pollfds(self, polls, sizeof(polls)/sizeof(*polls));
-
-	if (poll_count > (int)(sizeof(polls)/sizeof(*polls))) {
-		poll_count = sizeof(polls)/sizeof(*polls);
-	}
 
 	if(cms >= 0) {
 		cms = MIN(cms, nyoci_get_timeout(self));
@@ -813,7 +1310,7 @@ nyoci_plat_wait(
 
 	errno = 0;
 
-	descriptors_ready = poll(polls, poll_count, cms);
+	descriptors_ready = nyoci_plat_wait_for_fds_(self, cms, fds);
 
 	// Ensure that poll did not fail with an error.
 	require_action_string(descriptors_ready != -1,
@@ -830,123 +1327,273 @@ bail:
 	return ret;
 }
 
+static void
+nyoci_plat_recv_slot_prepare_(struct nyoci_plat_recv_slot_s* slot, struct msghdr* msg)
+{
+	memset(&slot->remote_saddr, 0, sizeof(slot->remote_saddr));
+	slot->iov.iov_base = slot->packet;
+	slot->iov.iov_len = NYOCI_MAX_PACKET_LENGTH;
+
+	memset(msg, 0, sizeof(*msg));
+	msg->msg_name = &slot->remote_saddr;
+	msg->msg_namelen = sizeof(slot->remote_saddr);
+	msg->msg_iov = &slot->iov;
+	msg->msg_iovlen = 1;
+	msg->msg_control = slot->cmbuf;
+	msg->msg_controllen = sizeof(slot->cmbuf);
+}
+
 nyoci_status_t
-nyoci_plat_process(
-	nyoci_t self
+nyoci_plat_inbound_datagram_process(
+	nyoci_t self,
+	int fd,
+	uint16_t port,
+	const nyoci_sockaddr_t* remote_saddr,
+	struct msghdr* msg,
+	char* packet,
+	size_t packet_len
 ) {
-	NYOCI_SINGLETON_SELF_HOOK;
-	nyoci_status_t ret = 0;
+	nyoci_status_t ret = NYOCI_STATUS_OK;
+	nyoci_sockaddr_t local_saddr = {};
+	struct cmsghdr *cmsg;
+
+	packet[packet_len] = 0;
+
+	for (
+		cmsg = CMSG_FIRSTHDR(msg);
+		cmsg != NULL;
+		cmsg = CMSG_NXTHDR(msg, cmsg)
+	) {
+		if (cmsg->cmsg_level != NYOCI_IPPROTO
+			|| cmsg->cmsg_type != NYOCI_PKTINFO
+		) {
+			continue;
+		}
+
+		// Preinitialize some of the fields.
+		local_saddr = *remote_saddr;
+
+#if NYOCI_PLAT_NET_POSIX_FAMILY==AF_INET6
+		struct in6_pktinfo *pi = (struct in6_pktinfo *)CMSG_DATA(cmsg);
+		local_saddr.nyoci_addr = pi->ipi6_addr;
+		local_saddr.sin6_scope_id = pi->ipi6_ifindex;
+
+#elif NYOCI_PLAT_NET_POSIX_FAMILY==AF_INET
+		struct in_pktinfo *pi = (struct in_pktinfo *)CMSG_DATA(cmsg);
+		local_saddr.nyoci_addr = pi->ipi_addr;
+#endif
+
+		local_saddr.nyoci_port = htons(port);
+
+		self->plat.pktinfo = *pi;
+	}
+
+	nyoci_set_current_instance(self);
+	nyoci_plat_set_remote_sockaddr(remote_saddr);
+	nyoci_plat_set_local_sockaddr(&local_saddr);
 
-	int tmp;
-	struct pollfd polls[4];
-	int poll_count;
+	if (self->plat.fd_udp == fd) {
+		nyoci_plat_set_session_type(NYOCI_SESSION_TYPE_UDP);
 
-	poll_count = nyoci_plat_update_pollfds(self, polls, sizeof(polls)/sizeof(polls[0]));
+		ret = nyoci_inbound_packet_process(self, packet, (coap_size_t)packet_len, 0);
 
-	if (poll_count > (int)(sizeof(polls)/sizeof(*polls))) {
-		poll_count = sizeof(polls)/sizeof(*polls);
+#if NYOCI_DTLS
+	} else if (self->plat.fd_dtls == fd) {
+		nyoci_plat_set_session_type(NYOCI_SESSION_TYPE_DTLS);
+		nyoci_plat_tls_inbound_packet_process(
+			self,
+			packet,
+			(coap_size_t)packet_len
+		);
+#endif
 	}
 
-	errno = 0;
+	self->is_responding = false;
 
-	tmp = poll(polls, poll_count, 0);
+	return ret;
+}
 
-	// Ensure that poll did not fail with an error.
-	require_action_string(
-		errno == 0,
-		bail,
-		ret = NYOCI_STATUS_ERRNO,
-		strerror(errno)
-	);
+//!	Reads and handles up to `budget` datagrams from `fd`.
+/*!	Stops early once the socket has been drained. Returns the
+**	number of datagrams that were read. */
+static int
+nyoci_plat_recv_from_fd_(nyoci_t self, int fd, int budget, nyoci_status_t* status)
+{
+	const uint16_t port = get_port_for_fd(fd);
+	int count = 0;
+	int received;
+	int i;
 
-	if(tmp > 0) {
-		for (tmp = 0; tmp < poll_count; tmp++) {
-			if (!polls[tmp].revents) {
-				continue;
-			} else {
-				char packet[NYOCI_MAX_PACKET_LENGTH+1];
-				nyoci_sockaddr_t remote_saddr = {};
-				nyoci_sockaddr_t local_saddr = {};
-				ssize_t packet_len = 0;
-				char cmbuf[0x100];
-				struct iovec iov = { packet, NYOCI_MAX_PACKET_LENGTH };
-				struct msghdr msg = {
-					.msg_name = &remote_saddr,
-					.msg_namelen = sizeof(remote_saddr),
-					.msg_iov = &iov,
-					.msg_iovlen = 1,
-					.msg_control = cmbuf,
-					.msg_controllen = sizeof(cmbuf),
-				};
-				struct cmsghdr *cmsg;
-
-				packet_len = recvmsg(polls[tmp].fd, &msg, 0);
-
-				require_action(packet_len > 0, bail, ret = NYOCI_STATUS_ERRNO);
-
-				packet[packet_len] = 0;
-
-				for (
-					cmsg = CMSG_FIRSTHDR(&msg);
-					cmsg != NULL;
-					cmsg = CMSG_NXTHDR(&msg, cmsg)
-				) {
-					if (cmsg->cmsg_level != NYOCI_IPPROTO
-						|| cmsg->cmsg_type != NYOCI_PKTINFO
-					) {
-						continue;
-					}
-
-					// Preinitialize some of the fields.
-					local_saddr = remote_saddr;
+	while (count < budget) {
+		int batch = 1;
 
-#if NYOCI_PLAT_NET_POSIX_FAMILY==AF_INET6
-					struct in6_pktinfo *pi = (struct in6_pktinfo *)CMSG_DATA(cmsg);
-					local_saddr.nyoci_addr = pi->ipi6_addr;
-					local_saddr.sin6_scope_id = pi->ipi6_ifindex;
+#if HAVE_RECVMMSG && !NYOCI_AVOID_MALLOC
+		if (self->plat.recv_slots != NULL) {
+			batch = MIN(budget - count, self->plat.recv_batch_size);
 
-#elif NYOCI_PLAT_NET_POSIX_FAMILY==AF_INET
-					struct in_pktinfo *pi = (struct in_pktinfo *)CMSG_DATA(cmsg);
-					local_saddr.nyoci_addr = pi->ipi_addr;
+			for (i = 0; i < batch; i++) {
+				nyoci_plat_recv_slot_prepare_(
+					&self->plat.recv_slots[i],
+					&self->plat.recv_msgs[i].msg_hdr
+				);
+			}
+
+			received = recvmmsg(fd, self->plat.recv_msgs, (unsigned int)batch, MSG_DONTWAIT, NULL);
+
+			for (i = 0; i < received; i++) {
+				nyoci_status_t ret;
+
+				if (self->plat.recv_msgs[i].msg_len == 0) {
+					continue;
+				}
+
+				ret = nyoci_plat_inbound_datagram_process(
+					self,
+					fd,
+					port,
+					&self->plat.recv_slots[i].remote_saddr,
+					&self->plat.recv_msgs[i].msg_hdr,
+					self->plat.recv_slots[i].packet,
+					self->plat.recv_msgs[i].msg_len
+				);
+
+				if (*status == NYOCI_STATUS_OK) {
+					*status = ret;
+				}
+			}
+		} else
 #endif
+		{
+			struct nyoci_plat_recv_slot_s slot;
+			struct msghdr msg;
+			ssize_t packet_len;
 
-					local_saddr.nyoci_port = htons(get_port_for_fd(polls[tmp].fd));
+			nyoci_plat_recv_slot_prepare_(&slot, &msg);
 
-					self->plat.pktinfo = *pi;
+			packet_len = recvmsg(fd, &msg, MSG_DONTWAIT);
+
+			received = (packet_len < 0) ? -1 : 1;
+
+			if (packet_len > 0) {
+				nyoci_status_t ret = nyoci_plat_inbound_datagram_process(
+					self,
+					fd,
+					port,
+					&slot.remote_saddr,
+					&msg,
+					slot.packet,
+					(size_t)packet_len
+				);
+
+				if (*status == NYOCI_STATUS_OK) {
+					*status = ret;
+				}
+			}
+		}
+
+		if (received < 0) {
+			// EAGAIN simply means that the socket has been drained.
+			if ((count == 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+				DEBUG_PRINTF("recvmsg: %s", strerror(errno));
+				if (*status == NYOCI_STATUS_OK) {
+					*status = NYOCI_STATUS_ERRNO;
 				}
+			}
+			break;
+		}
+
+		count += received;
 
-				nyoci_set_current_instance(self);
-				nyoci_plat_set_remote_sockaddr(&remote_saddr);
-				nyoci_plat_set_local_sockaddr(&local_saddr);
+		if (received < batch) {
+			// Short read, nothing more is waiting for us.
+			break;
+		}
+	}
 
-				if (self->plat.fd_udp == polls[tmp].fd) {
-					nyoci_plat_set_session_type(NYOCI_SESSION_TYPE_UDP);
+	return count;
+}
 
-					ret = nyoci_inbound_packet_process(self, packet, (coap_size_t)packet_len, 0);
-					require_noerr(ret, bail);
+nyoci_status_t
+nyoci_plat_run_once(
+	nyoci_t self, nyoci_cms_t cms
+) {
+	NYOCI_SINGLETON_SELF_HOOK;
+	nyoci_status_t ret = NYOCI_STATUS_OK;
+	int fds[NYOCI_PLAT_MAX_READY_FDS];
+	int descriptors_ready;
+	int i;
 
-#if NYOCI_DTLS
-				} else if (self->plat.fd_dtls == polls[tmp].fd) {
-					nyoci_plat_set_session_type(NYOCI_SESSION_TYPE_DTLS);
-					nyoci_plat_tls_inbound_packet_process(
-						self,
-						packet,
-						(coap_size_t)packet_len
-					);
+	if (cms >= 0) {
+		cms = MIN(cms, nyoci_get_timeout(self));
+	} else {
+		cms = nyoci_get_timeout(self);
+	}
+
+	self->plat.is_processing = true;
+
+	errno = 0;
+
+	descriptors_ready = nyoci_plat_wait_for_fds_(self, cms, fds);
+
+	// Ensure that poll did not fail with an error.
+	require_action_string(
+		descriptors_ready >= 0,
+		bail,
+		ret = NYOCI_STATUS_ERRNO,
+		strerror(errno)
+	);
+
+	if (descriptors_ready > 0) {
+		int budget = self->plat.recv_budget;
+
+		for (i = 0; i < descriptors_ready; i++) {
+			nyoci_status_t status = NYOCI_STATUS_OK;
+
+			if (fds[i] == self->plat.wake_fd[0]) {
+				nyoci_plat_wakeup_drain(self);
+				continue;
+			}
+
+#if NYOCI_PLAT_NET_POSIX_USE_IO_URING
+			if (fds[i] == self->plat.uring.fd) {
+				budget -= nyoci_plat_uring_process(self, MAX(budget, 1), &status);
+			} else
 #endif
-				}
+			{
+				// Every ready socket gets read at least once, even
+				// if an earlier socket used up the whole budget.
+				budget -= nyoci_plat_recv_from_fd_(self, fds[i], MAX(budget, 1), &status);
+			}
+
+			if (ret == NYOCI_STATUS_OK) {
+				ret = status;
 			}
 		}
 	}
 
+	nyoci_handle_commands(self);
+
 	nyoci_handle_timers(self);
 
 bail:
+	nyoci_plat_flush_send_queue_(self);
+#if NYOCI_PLAT_NET_POSIX_USE_IO_URING
+	nyoci_plat_uring_submit(self);
+#endif
+	self->plat.is_processing = false;
 	nyoci_set_current_instance(NULL);
 	self->is_responding = false;
 	return ret;
 }
 
+nyoci_status_t
+nyoci_plat_process(
+	nyoci_t self
+) {
+	NYOCI_SINGLETON_SELF_HOOK;
+	return nyoci_plat_run_once(self, 0);
+}
+
 nyoci_status_t
 nyoci_plat_lookup_hostname(const char* hostname, nyoci_sockaddr_t* saddr, int flags)
 {
@@ -44,6 +44,11 @@
 
 #if NYOCI_SINGLETON
 #define nyoci_plat_update_fdsets(self,...)		nyoci_plat_update_fdsets(__VA_ARGS__)
+#define nyoci_plat_set_recv_batch(self,...)		nyoci_plat_set_recv_batch(__VA_ARGS__)
+#define nyoci_plat_set_send_batch(self,...)		nyoci_plat_set_send_batch(__VA_ARGS__)
+#define nyoci_plat_run_once(self,...)		nyoci_plat_run_once(__VA_ARGS__)
+#define nyoci_plat_get_event_fd(self)		nyoci_plat_get_event_fd()
+#define nyoci_plat_set_reuse_port(self,...)		nyoci_plat_set_reuse_port(__VA_ARGS__)
 #endif
 
 #ifndef NYOCI_PLAT_NET_POSIX_FAMILY
@@ -83,6 +88,21 @@ NYOCI_BEGIN_C_DECLS
 **	poll(), or other async mechanisms. */
 NYOCI_API_EXTERN int nyoci_plat_get_fd(nyoci_t self);
 
+//!	Gets a single file descriptor that becomes readable whenever
+//!	any of the sockets of this instance does.
+/*!	When epoll is in use this is the epoll descriptor, which can itself
+**	be added to an outer poll(), select() or epoll set. This makes it
+**	cheap to drive many instances from one event loop. Otherwise this
+**	is the same as nyoci_plat_get_fd(). */
+NYOCI_API_EXTERN int nyoci_plat_get_event_fd(nyoci_t self);
+
+//!	Waits for, and then handles, inbound packets and expired timers.
+/*!	This is equivalent to calling nyoci_plat_wait() followed by
+**	nyoci_plat_process(), but only waits on the sockets once.
+**	`cms` is the maximum time to wait, which is further limited by
+**	the next timer. A negative value waits until the next timer. */
+NYOCI_API_EXTERN nyoci_status_t nyoci_plat_run_once(nyoci_t self, nyoci_cms_t cms);
+
 //! Support for `select()` style asynchronous operation
 NYOCI_API_EXTERN nyoci_status_t nyoci_plat_update_fdsets(
 	nyoci_t self,
@@ -93,6 +113,92 @@ NYOCI_API_EXTERN nyoci_status_t nyoci_plat_update_fdsets(
 	nyoci_cms_t *timeout
 );
 
+//!	Configures how inbound datagrams are drained by nyoci_plat_process().
+/*!	`batch_size` is the number of datagrams fetched with a single system
+**	call (using `recvmmsg()` where available) and `budget` is the number
+**	of datagrams a single call to nyoci_plat_process() will handle before
+**	moving on to the timers. Every ready socket is read at least once per
+**	call, regardless of the budget. */
+NYOCI_API_EXTERN nyoci_status_t nyoci_plat_set_recv_batch(
+	nyoci_t self,
+	int batch_size,
+	int budget
+);
+
+//!	Enables coalescing of outbound UDP datagrams.
+/*!	When `batch_size` is larger than one, packets finished while inside
+**	of nyoci_plat_process() are queued (in order, along with their source
+**	address) and sent with a single `sendmmsg()` call once the queue
+**	fills up or nyoci_plat_process() is about to return. Packets sent
+**	outside of nyoci_plat_process() are always sent immediately. Since
+**	queued packets are sent later, send errors for them are only logged.
+**
+**	Passing zero disables batching. Returns NYOCI_STATUS_NOT_IMPLEMENTED
+**	if `sendmmsg()` is not available on this platform. */
+NYOCI_API_EXTERN nyoci_status_t nyoci_plat_set_send_batch(
+	nyoci_t self,
+	int batch_size
+);
+
+//!	Makes subsequent binds use `SO_REUSEPORT`.
+/*!	This allows several instances to bind to the same port, with the
+**	kernel distributing inbound datagrams between them. Must be called
+**	before nyoci_plat_bind_to_port() or nyoci_plat_bind_to_sockaddr().
+**	Returns NYOCI_STATUS_NOT_IMPLEMENTED if the platform lacks
+**	`SO_REUSEPORT`. */
+NYOCI_API_EXTERN nyoci_status_t nyoci_plat_set_reuse_port(nyoci_t self, bool reuse_port);
+
+#if !NYOCI_SINGLETON
+// MARK: -
+// MARK: Sharded Servers
+
+//!	A set of instances serving the same port, one per thread.
+typedef struct nyoci_shard_group_s* nyoci_shard_group_t;
+
+//!	Steer datagrams to shards by the remote address.
+/*!	Without this flag the kernel picks a shard by hashing the remote
+**	address and port. With it, a classic BPF program makes sure that
+**	every datagram from a given remote address (retransmissions and
+**	duplicates included) always reaches the same shard, even if that
+**	peer uses several ports. */
+#define NYOCI_SHARD_GROUP_FLAG_STEER_BY_REMOTE		(1 << 0)
+
+//!	Don't pin the shard threads to CPUs.
+#define NYOCI_SHARD_GROUP_FLAG_NO_AFFINITY			(1 << 1)
+
+//!	Creates `count` instances bound to the same address using `SO_REUSEPORT`.
+/*!	Every instance gets `handler` and `context` as its default request
+**	handler, so the handler will be called from several threads at once.
+**	If `count` is zero or less, one shard is created per online CPU.
+**	The instances are not serviced until nyoci_shard_group_start() is
+**	called, which gives the caller a chance to configure each of them.
+**	Returns NULL on failure. */
+NYOCI_API_EXTERN nyoci_shard_group_t nyoci_shard_group_create(
+	int count,
+	const nyoci_sockaddr_t* sockaddr,
+	nyoci_request_handler_func handler,
+	void* context,
+	int flags
+);
+
+//!	Starts one thread per shard, each pinned to its own CPU.
+NYOCI_API_EXTERN nyoci_status_t nyoci_shard_group_start(nyoci_shard_group_t group);
+
+//!	Stops and joins the shard threads. The instances are kept.
+NYOCI_API_EXTERN void nyoci_shard_group_stop(nyoci_shard_group_t group);
+
+//!	Stops the shard threads and releases all of the instances.
+NYOCI_API_EXTERN void nyoci_shard_group_release(nyoci_shard_group_t group);
+
+//!	Returns the number of shards in `group`.
+NYOCI_API_EXTERN int nyoci_shard_group_get_count(nyoci_shard_group_t group);
+
+//!	Returns the instance of the shard at `index`.
+/*!	While the group is running, an instance must only be touched from
+**	its own shard thread. */
+NYOCI_API_EXTERN nyoci_t nyoci_shard_group_get_instance(nyoci_shard_group_t group, int index);
+#endif // !NYOCI_SINGLETON
+
 NYOCI_END_C_DECLS
 
 #endif
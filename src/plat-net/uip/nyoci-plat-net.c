@@ -347,6 +347,11 @@ nyoci_plat_wait(
 	return NYOCI_STATUS_OK;
 }
 
+void
+nyoci_plat_wakeup(nyoci_t self) {
+	// nyoci_plat_wait() never blocks, so there is nothing to wake up.
+}
+
 nyoci_status_t
 nyoci_plat_process(nyoci_t self) {
 	NYOCI_SINGLETON_SELF_HOOK;
@@ -371,6 +376,7 @@ nyoci_plat_process(nyoci_t self) {
 		nyoci_inbound_packet_process(self, uip_appdata, uip_datalen(), 0);
 	} else if(uip_poll()) {
 		nyoci_set_current_instance(self);
+		nyoci_handle_commands(self);
 		nyoci_handle_timers(self);
 	}
 
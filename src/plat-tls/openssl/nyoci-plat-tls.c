@@ -286,12 +286,8 @@ lookup_current_ssl_object(nyoci_t self) {
 	struct nyoci_openssl_session_s* session = nyoci_openssl_session_lookup_current(self);
 
 	if (session) {
-		// Splay for improved performance of recent sessions.
-		bt_splay(
-			(void*)&self->plat.ssl.sessions,
-			session
-		);
-
+		// No splaying here: the sessions tree is kept AVL-balanced,
+		// and splaying would invalidate its balance factors.
 		return session->ssl;
 	}
 
@@ -306,7 +302,7 @@ remove_ssl_object(nyoci_t self, SSL* ssl) {
 	item = nyoci_openssl_session_lookup_by_ssl(self, ssl);
 
 	if (item) {
-		if (bt_remove(
+		if (bt_avl_remove(
 			(void**)&self->plat.ssl.sessions,
 			item,
 			(bt_compare_func_t)nyoci_openssl_session_compare,
@@ -431,7 +427,7 @@ add_ssl_object(nyoci_t self, SSL* ssl, const nyoci_sockaddr_t* local, const nyoc
 		new_item->sockaddr_local = *local;
 	}
 
-	bt_insert(
+	bt_avl_insert(
 		(void**)&self->plat.ssl.sessions,
 		new_item,
 		(bt_compare_func_t)nyoci_openssl_session_compare,
@@ -0,0 +1,155 @@
+/*!	@page bench-loopback bench-loopback.c: Loopback throughput benchmark.
+**
+**	This program measures how many confirmable requests per second a
+**	single LibNyoci server instance can answer over the loopback
+**	interface. A plain UDP socket acts as the client, keeping a fixed
+**	number of requests in flight. Both sides run on the same thread,
+**	driven by nyoci_plat_run_once(), so the numbers are best compared
+**	between builds (e.g. with and without `--enable-io-uring`) on the
+**	same machine.
+**
+**	Usage: `bench-loopback [request-count] [window]`
+**
+**	@include bench-loopback.c
+**
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "assert-macros.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <libnyoci/libnyoci.h>
+
+#define DEFAULT_REQUEST_COUNT		(200000)
+#define DEFAULT_WINDOW				(32)
+
+static nyoci_status_t
+request_handler(void* context) {
+	nyoci_outbound_begin_response(COAP_RESULT_205_CONTENT);
+	nyoci_outbound_append_content("ok", NYOCI_CSTR_LEN);
+	return nyoci_outbound_send();
+}
+
+static double
+now_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static const char*
+engine_name(nyoci_t nyoci) {
+	static char link[64];
+	char path[64];
+	ssize_t len;
+
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", nyoci_plat_get_event_fd(nyoci));
+	len = readlink(path, link, sizeof(link) - 1);
+
+	if (len <= 0) {
+		return "unknown";
+	}
+
+	link[len] = 0;
+
+	if (strstr(link, "io_uring") != NULL) {
+		return "io_uring";
+	} else if (strstr(link, "eventpoll") != NULL) {
+		return "epoll";
+	}
+	return "poll";
+}
+
+static void
+send_request(int fd, const nyoci_sockaddr_t* saddr, uint16_t msg_id) {
+	uint8_t packet[4] = {
+		0x40,							// Version 1, CON, no token
+		COAP_METHOD_GET,
+		(uint8_t)(msg_id >> 8),
+		(uint8_t)msg_id,
+	};
+
+	sendto(fd, packet, sizeof(packet), 0, (const struct sockaddr*)saddr, sizeof(*saddr));
+}
+
+int
+main(int argc, char * argv[]) {
+	int request_count = DEFAULT_REQUEST_COUNT;
+	int window = DEFAULT_WINDOW;
+	int sent = 0;
+	int received = 0;
+	uint16_t msg_id = 1;
+	nyoci_sockaddr_t saddr = NYOCI_SOCKADDR_INIT;
+	nyoci_t nyoci;
+	double start, elapsed;
+	int fd;
+
+	if (argc > 1) {
+		request_count = atoi(argv[1]);
+	}
+
+	if (argc > 2) {
+		window = atoi(argv[2]);
+	}
+
+	nyoci = nyoci_create();
+	require(nyoci != NULL, bail);
+
+	nyoci_set_default_request_handler(nyoci, &request_handler, NULL);
+
+	require_noerr(nyoci_plat_bind_to_port(nyoci, NYOCI_SESSION_TYPE_UDP, 0), bail);
+
+	fd = socket(NYOCI_PLAT_NET_POSIX_FAMILY, SOCK_DGRAM, IPPROTO_UDP);
+	require(fd >= 0, bail);
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+
+#if NYOCI_PLAT_NET_POSIX_FAMILY == AF_INET6
+	saddr.nyoci_addr = in6addr_loopback;
+#else
+	saddr.nyoci_addr.s_addr = htonl(INADDR_LOOPBACK);
+#endif
+	saddr.nyoci_port = htons(nyoci_plat_get_port(nyoci));
+
+	start = now_seconds();
+
+	while (received < request_count) {
+		uint8_t response[NYOCI_MAX_PACKET_LENGTH];
+
+		while ((sent < request_count) && (sent - received < window)) {
+			send_request(fd, &saddr, msg_id++);
+			sent++;
+		}
+
+		nyoci_plat_run_once(nyoci, 10);
+
+		while (recv(fd, response, sizeof(response), 0) > 0) {
+			received++;
+		}
+
+		if (now_seconds() - start > 60.0) {
+			fprintf(stderr, "Giving up, only %d of %d responses arrived\n", received, request_count);
+			break;
+		}
+	}
+
+	elapsed = now_seconds() - start;
+
+	printf("engine: %s\n", engine_name(nyoci));
+	printf("requests: %d, window: %d\n", received, window);
+	printf("elapsed: %.3f s, %.0f requests/s\n", elapsed, received / elapsed);
+
+	close(fd);
+	nyoci_release(nyoci);
+
+	return (received == request_count) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+bail:
+	return EXIT_FAILURE;
+}
@@ -150,8 +150,8 @@ thread_main(void* context)
 	while (obj->remaining > 0) {
 		if (obj->transaction == NULL) {
 			printf("%d: Starting transaction #%d\n",obj->index, TRANSACTIONS_PER_THREAD-obj->remaining+1);
-			obj->transaction = nyoci_transaction_init(
-				NULL,
+			obj->transaction = nyoci_transaction_create(
+				instance,
 				NYOCI_TRANSACTION_ALWAYS_INVALIDATE,
 				&test_concurrency_thread_resend,
 				&test_concurrency_thread_response,
@@ -0,0 +1,94 @@
+/*!	@page test-dupe-replay test-dupe-replay.c: Duplicate replay test.
+**
+**	Sends the same confirmable request twice. The second copy must
+**	be answered with the exact bytes of the first response, without
+**	running the request handler again. A request with a new message
+**	id must still reach the handler.
+**
+**	@include test-dupe-replay.c
+**
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "test-loopback.h"
+
+static int gHandlerCalls;
+
+static nyoci_status_t
+request_handler(void* context) {
+	nyoci_status_t status;
+
+	gHandlerCalls++;
+
+	status = nyoci_outbound_begin_response(COAP_RESULT_205_CONTENT);
+	if (status == NYOCI_STATUS_OK) {
+		status = nyoci_outbound_append_content_formatted("%d", gHandlerCalls);
+	}
+	if (status == NYOCI_STATUS_OK) {
+		status = nyoci_outbound_send();
+	}
+	return status;
+}
+
+int
+main(int argc, char * argv[]) {
+	static const uint8_t token[] = { 0xA5, 0x5A };
+	nyoci_sockaddr_t nyoci_addr;
+	nyoci_sockaddr_t remote_addr;
+	struct test_packet_s first, second, third;
+	struct nyoci_dupe_stats_s stats;
+	uint8_t request[32];
+	size_t request_len;
+	nyoci_t nyoci;
+	int fd;
+
+	nyoci = test_create_instance(&nyoci_addr);
+	fd = test_open_socket(&remote_addr);
+
+	nyoci_set_default_request_handler(nyoci, &request_handler, NULL);
+
+	request_len = test_build_get(request, COAP_TRANS_TYPE_CONFIRMABLE, 0x1234, token, sizeof(token), -1);
+
+	test_send(fd, &nyoci_addr, request, request_len);
+	test_require(test_receive(nyoci, fd, &first, 1000));
+	test_require(first.tt == COAP_TRANS_TYPE_ACK);
+	test_require(first.code == COAP_RESULT_205_CONTENT);
+	test_require(first.msg_id == 0x1234);
+	test_require(test_packet_content_is(&first, "1"));
+	test_require(gHandlerCalls == 1);
+
+	// Same message id from the same peer: a retransmission.
+	test_send(fd, &nyoci_addr, request, request_len);
+	test_require(test_receive(nyoci, fd, &second, 1000));
+	test_require(second.msg_id == 0x1234);
+
+	nyoci_get_dupe_stats(nyoci, &stats);
+
+#if NYOCI_CONF_DUPE_RESPONSE_CACHE_SIZE
+	test_require(second.len == first.len);
+	test_require(0 == memcmp(second.data, first.data, first.len));
+	test_require(gHandlerCalls == 1);
+	test_require(stats.replayed == 1);
+	test_require(stats.replay_misses == 0);
+#endif
+
+	// A new message id is a new request.
+	request_len = test_build_get(request, COAP_TRANS_TYPE_CONFIRMABLE, 0x1235, token, sizeof(token), -1);
+
+	test_send(fd, &nyoci_addr, request, request_len);
+	test_require(test_receive(nyoci, fd, &third, 1000));
+	test_require(third.msg_id == 0x1235);
+	test_require(third.content_len == 1);
+	test_require(third.content[0] == '0' + gHandlerCalls);
+#if NYOCI_CONF_DUPE_RESPONSE_CACHE_SIZE
+	test_require(gHandlerCalls == 2);
+#endif
+
+	close(fd);
+	nyoci_release(nyoci);
+
+	return EXIT_SUCCESS;
+}
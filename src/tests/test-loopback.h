@@ -0,0 +1,263 @@
+/*!	@file test-loopback.h
+**	@brief Helpers for tests that talk to LibNyoci over loopback.
+**
+**	A test creates a LibNyoci instance and a plain UDP socket that
+**	plays the other end of the conversation, sending hand-made
+**	packets and decoding what comes back. Everything runs on the
+**	calling thread, driven by nyoci_plat_run_once().
+*/
+
+#ifndef __NYOCI_TEST_LOOPBACK_H__
+#define __NYOCI_TEST_LOOPBACK_H__ 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <libnyoci/libnyoci.h>
+
+#define TEST_MAX_OPTIONS			(16)
+
+//!	Fails the test unless `c` is true.
+#define test_require(c) \
+	do { if (!(c)) { \
+		fprintf(stderr, "%s:%d: Check failed: %s\n", __FILE__, __LINE__, # c); \
+		exit(EXIT_FAILURE); \
+	} } while (0)
+
+struct test_packet_s {
+	uint8_t				data[NYOCI_MAX_PACKET_LENGTH];
+	size_t				len;
+
+	uint8_t				tt;
+	coap_code_t			code;
+	coap_msg_id_t		msg_id;
+	uint8_t				token_len;
+	const uint8_t*		token;
+
+	int					option_count;
+	coap_option_key_t	option_key[TEST_MAX_OPTIONS];
+	const uint8_t*		option_value[TEST_MAX_OPTIONS];
+	coap_size_t			option_len[TEST_MAX_OPTIONS];
+
+	const uint8_t*		content;
+	size_t				content_len;
+};
+
+static inline double
+test_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static inline void
+test_loopback_sockaddr(nyoci_sockaddr_t* saddr, uint16_t port) {
+	nyoci_sockaddr_t const init = NYOCI_SOCKADDR_INIT;
+
+	*saddr = init;
+#if NYOCI_PLAT_NET_POSIX_FAMILY == AF_INET6
+	saddr->nyoci_addr = in6addr_loopback;
+#else
+	saddr->nyoci_addr.s_addr = htonl(INADDR_LOOPBACK);
+#endif
+	saddr->nyoci_port = htons(port);
+}
+
+//!	Creates an instance listening on an ephemeral loopback port.
+static inline nyoci_t
+test_create_instance(nyoci_sockaddr_t* saddr) {
+	nyoci_t nyoci = nyoci_create();
+
+	test_require(nyoci != NULL);
+	test_require(nyoci_plat_bind_to_port(nyoci, NYOCI_SESSION_TYPE_UDP, 0) == NYOCI_STATUS_OK);
+	test_loopback_sockaddr(saddr, nyoci_plat_get_port(nyoci));
+
+	return nyoci;
+}
+
+//!	Opens the non-blocking socket that plays the remote end.
+static inline int
+test_open_socket(nyoci_sockaddr_t* saddr) {
+	socklen_t len = sizeof(*saddr);
+	int fd = socket(NYOCI_PLAT_NET_POSIX_FAMILY, SOCK_DGRAM, IPPROTO_UDP);
+
+	test_require(fd >= 0);
+	test_loopback_sockaddr(saddr, 0);
+	test_require(bind(fd, (struct sockaddr*)saddr, sizeof(*saddr)) == 0);
+	test_require(getsockname(fd, (struct sockaddr*)saddr, &len) == 0);
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+
+	return fd;
+}
+
+//!	Runs `nyoci` for `ms` milliseconds.
+static inline void
+test_pump(nyoci_t nyoci, int ms) {
+	double const end = test_now() + ms / 1000.0;
+
+	do {
+		nyoci_plat_run_once(nyoci, 1);
+	} while (test_now() < end);
+}
+
+static inline void
+test_send(int fd, const nyoci_sockaddr_t* to, const void* packet, size_t len) {
+	test_require(sendto(fd, packet, len, 0, (const struct sockaddr*)to, sizeof(*to)) == (ssize_t)len);
+}
+
+//!	Decodes the packet in `packet->data`.
+static inline bool
+test_packet_parse(struct test_packet_s* packet) {
+	const struct coap_header_s* const header = (const struct coap_header_s*)packet->data;
+	const uint8_t* iter = packet->data + 4 + header->token_len;
+	const uint8_t* const end = packet->data + packet->len;
+	coap_option_key_t key = 0;
+
+	if ((packet->len < 4) || (header->version != 1) || (iter > end)) {
+		return false;
+	}
+
+	packet->tt = header->tt;
+	packet->code = header->code;
+	packet->msg_id = ntohs(header->msg_id);
+	packet->token_len = header->token_len;
+	packet->token = header->token;
+	packet->option_count = 0;
+	packet->content = NULL;
+	packet->content_len = 0;
+
+	while ((iter < end) && (*iter != 0xFF)) {
+		if (packet->option_count == TEST_MAX_OPTIONS) {
+			return false;
+		}
+
+		iter = coap_decode_option(
+			iter,
+			&key,
+			&packet->option_value[packet->option_count],
+			&packet->option_len[packet->option_count]
+		);
+
+		if ((iter == NULL) || (iter > end)) {
+			return false;
+		}
+
+		packet->option_key[packet->option_count++] = key;
+	}
+
+	if (iter < end) {
+		iter++;
+		if (iter == end) {
+			// A payload marker must be followed by a payload.
+			return false;
+		}
+		packet->content = iter;
+		packet->content_len = (size_t)(end - iter);
+	}
+
+	return true;
+}
+
+//!	Runs `nyoci` until a packet arrives on `fd`, for up to `ms`
+//!	milliseconds. Returns false if nothing came.
+static inline bool
+test_receive(nyoci_t nyoci, int fd, struct test_packet_s* packet, int ms) {
+	double const end = test_now() + ms / 1000.0;
+	ssize_t len;
+
+	for (;;) {
+		len = recv(fd, packet->data, sizeof(packet->data), 0);
+
+		if (len > 0) {
+			packet->len = (size_t)len;
+			test_require(test_packet_parse(packet));
+			return true;
+		}
+
+		if (test_now() >= end) {
+			return false;
+		}
+
+		nyoci_plat_run_once(nyoci, 1);
+	}
+}
+
+//!	Returns the index of the first option `key`, or -1.
+static inline int
+test_packet_find_option(const struct test_packet_s* packet, coap_option_key_t key) {
+	int i;
+
+	for (i = 0; i < packet->option_count; i++) {
+		if (packet->option_key[i] == key) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+//!	Returns the value of the uint option `key`, which must be present.
+static inline uint32_t
+test_packet_option_uint(const struct test_packet_s* packet, coap_option_key_t key) {
+	int const i = test_packet_find_option(packet, key);
+
+	test_require(i >= 0);
+
+	return coap_decode_uint32(packet->option_value[i], (uint8_t)packet->option_len[i]);
+}
+
+//!	Returns true if the content of `packet` is the string `cstr`.
+static inline bool
+test_packet_content_is(const struct test_packet_s* packet, const char* cstr) {
+	return (packet->content_len == strlen(cstr))
+		&& (0 == memcmp(packet->content, cstr, packet->content_len));
+}
+
+//!	Builds a GET request, with an Observe option if `observe` >= 0.
+static inline size_t
+test_build_get(
+	uint8_t* packet,
+	coap_transaction_type_t tt,
+	coap_msg_id_t msg_id,
+	const uint8_t* token,
+	uint8_t token_len,
+	int observe
+) {
+	uint8_t* iter = packet;
+
+	*iter++ = (uint8_t)(0x40 | (tt << 4) | token_len);
+	*iter++ = COAP_METHOD_GET;
+	*iter++ = (uint8_t)(msg_id >> 8);
+	*iter++ = (uint8_t)msg_id;
+	memcpy(iter, token, token_len);
+	iter += token_len;
+
+	if (observe == 0) {
+		*iter++ = (COAP_OPTION_OBSERVE << 4);
+	} else if (observe > 0) {
+		*iter++ = (COAP_OPTION_OBSERVE << 4) | 1;
+		*iter++ = (uint8_t)observe;
+	}
+
+	return (size_t)(iter - packet);
+}
+
+//!	Sends an empty ACK for `packet` if it is confirmable.
+static inline void
+test_ack_if_needed(int fd, const nyoci_sockaddr_t* to, const struct test_packet_s* packet) {
+	if (packet->tt == COAP_TRANS_TYPE_CONFIRMABLE) {
+		uint8_t ack[4] = {
+			0x60,
+			0,
+			(uint8_t)(packet->msg_id >> 8),
+			(uint8_t)packet->msg_id,
+		};
+
+		test_send(fd, to, ack, sizeof(ack));
+	}
+}
+
+#endif // __NYOCI_TEST_LOOPBACK_H__
@@ -0,0 +1,131 @@
+/*!	@page test-nstart test-nstart.c: NSTART test.
+**
+**	With NSTART set to one, begins three confirmable requests to
+**	the same peer at once. Only one may be outstanding at a time,
+**	and each piggybacked response must let the next one go out, in
+**	the order they were begun.
+**
+**	@include test-nstart.c
+**
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "test-loopback.h"
+
+#define TRANSACTION_COUNT		(3)
+
+static nyoci_sockaddr_t gServerAddr;
+
+struct request_s {
+	int index;
+	int responses;
+};
+
+static struct request_s gRequests[TRANSACTION_COUNT];
+
+static nyoci_status_t
+resend_request(void* context) {
+	struct request_s* const request = context;
+	nyoci_status_t status;
+
+	status = nyoci_outbound_begin(nyoci_get_current_instance(), COAP_METHOD_GET, COAP_TRANS_TYPE_CONFIRMABLE);
+	if (status == NYOCI_STATUS_OK) {
+		nyoci_plat_set_remote_sockaddr(&gServerAddr);
+		status = nyoci_outbound_append_content_formatted("%d", request->index);
+	}
+	if (status == NYOCI_STATUS_OK) {
+		status = nyoci_outbound_send();
+	}
+	return status;
+}
+
+static nyoci_status_t
+response_handler(int statuscode, void* context) {
+	struct request_s* const request = context;
+
+	test_require(statuscode == COAP_RESULT_205_CONTENT);
+	request->responses++;
+
+	return NYOCI_STATUS_OK;
+}
+
+static void
+send_piggybacked_response(int fd, const nyoci_sockaddr_t* to, const struct test_packet_s* request) {
+	uint8_t packet[4 + 8];
+
+	packet[0] = (uint8_t)(0x40 | (COAP_TRANS_TYPE_ACK << 4) | request->token_len);
+	packet[1] = COAP_RESULT_205_CONTENT;
+	packet[2] = (uint8_t)(request->msg_id >> 8);
+	packet[3] = (uint8_t)request->msg_id;
+	memcpy(packet + 4, request->token, request->token_len);
+
+	test_send(fd, to, packet, 4 + request->token_len);
+}
+
+int
+main(int argc, char * argv[]) {
+	nyoci_sockaddr_t nyoci_addr;
+	struct nyoci_nstart_stats_s stats;
+	struct test_packet_s packet;
+	nyoci_transaction_t transaction;
+	nyoci_t nyoci;
+	int fd;
+	int i;
+
+	nyoci = test_create_instance(&nyoci_addr);
+	fd = test_open_socket(&gServerAddr);
+
+	test_require(nyoci_set_nstart(nyoci, NULL, 1) == NYOCI_STATUS_OK);
+
+	for (i = 0; i < TRANSACTION_COUNT; i++) {
+		gRequests[i].index = i;
+		transaction = nyoci_transaction_create(
+			nyoci,
+			0,
+			&resend_request,
+			&response_handler,
+			&gRequests[i]
+		);
+		test_require(transaction != NULL);
+		test_require(nyoci_transaction_begin(nyoci, transaction, 30*MSEC_PER_SEC) == NYOCI_STATUS_OK);
+	}
+
+	for (i = 0; i < TRANSACTION_COUNT; i++) {
+		char index_str[8];
+
+		snprintf(index_str, sizeof(index_str), "%d", i);
+
+		test_require(test_receive(nyoci, fd, &packet, 1000));
+		test_require(packet.tt == COAP_TRANS_TYPE_CONFIRMABLE);
+		test_require(test_packet_content_is(&packet, index_str));
+
+		// Nothing else may go out while this one is outstanding.
+		{
+			struct test_packet_s extra;
+			test_require(!test_receive(nyoci, fd, &extra, 100));
+		}
+
+		nyoci_get_nstart_stats(nyoci, &stats);
+		test_require(stats.outstanding == 1);
+		test_require(stats.queued == (uint32_t)(TRANSACTION_COUNT - 1 - i));
+
+		send_piggybacked_response(fd, &nyoci_addr, &packet);
+		test_pump(nyoci, 20);
+
+		test_require(gRequests[i].responses == 1);
+	}
+
+	nyoci_get_nstart_stats(nyoci, &stats);
+	test_require(stats.outstanding == 0);
+	test_require(stats.queued == 0);
+	test_require(stats.max_queued == TRANSACTION_COUNT - 1);
+	test_require(stats.parked == TRANSACTION_COUNT - 1);
+
+	close(fd);
+	nyoci_release(nyoci);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,144 @@
+/*!	@page test-observable-batch test-observable-batch.c: Batch trigger test.
+**
+**	Registers observers for a few keys, plus one for the broadcast
+**	key, and checks which of them each call to
+**	nyoci_observable_trigger_set() and nyoci_observable_trigger_bitmap()
+**	notifies: duplicate keys, the broadcast key, empty sets, the bits
+**	at byte edges and bits past the end of the bitmap.
+**
+**	@include test-observable-batch.c
+**
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "test-loopback.h"
+
+#define OBSERVER_COUNT			(5)
+
+//!	The key each observer registers for, by the last byte of its token.
+static const uint16_t gKeys[OBSERVER_COUNT] = {
+	0, 7, 8, 11, NYOCI_OBSERVABLE_BROADCAST_KEY
+};
+
+#define OBS_0			(1 << 0)
+#define OBS_7			(1 << 1)
+#define OBS_8			(1 << 2)
+#define OBS_11			(1 << 3)
+#define OBS_BROADCAST	(1 << 4)
+#define OBS_ALL			((1 << OBSERVER_COUNT) - 1)
+
+static struct nyoci_observable_s gObservable;
+static int gState;
+
+static nyoci_status_t
+request_handler(void* context) {
+	const struct coap_header_s* const header = nyoci_inbound_get_packet();
+	nyoci_status_t status;
+
+	status = nyoci_outbound_begin_response(COAP_RESULT_205_CONTENT);
+	if (status == NYOCI_STATUS_OK) {
+		status = nyoci_observable_update(&gObservable, gKeys[header->token[1]]);
+	}
+	if (status == NYOCI_STATUS_OK) {
+		status = nyoci_outbound_append_content_formatted("state=%d", gState);
+	}
+	if (status == NYOCI_STATUS_OK) {
+		status = nyoci_outbound_send();
+	}
+	return status;
+}
+
+//!	Returns the observers notified since the last call, as a mask.
+static int
+collect_notified(nyoci_t nyoci, int fd, const nyoci_sockaddr_t* nyoci_addr) {
+	struct test_packet_s packet;
+	int notified = 0;
+	int i;
+
+	while (test_receive(nyoci, fd, &packet, 100)) {
+		test_require(packet.token_len == 2);
+		i = packet.token[1];
+		test_require(i < OBSERVER_COUNT);
+
+		// Each observer is notified at most once per trigger.
+		test_require((notified & (1 << i)) == 0);
+		notified |= (1 << i);
+
+		test_ack_if_needed(fd, nyoci_addr, &packet);
+	}
+
+	return notified;
+}
+
+static void
+check_set(nyoci_t nyoci, int fd, const nyoci_sockaddr_t* nyoci_addr, const uint16_t* keys, uint16_t nkeys, int expected) {
+	gState++;
+	test_require(nyoci_observable_trigger_set(&gObservable, keys, nkeys, 0) == NYOCI_STATUS_OK);
+	test_require(collect_notified(nyoci, fd, nyoci_addr) == expected);
+}
+
+static void
+check_bitmap(nyoci_t nyoci, int fd, const nyoci_sockaddr_t* nyoci_addr, uint8_t byte0, uint8_t byte1, uint32_t nbits, int expected) {
+	const uint8_t bitmap[2] = { byte0, byte1 };
+
+	gState++;
+	test_require(nyoci_observable_trigger_bitmap(&gObservable, bitmap, nbits, 0) == NYOCI_STATUS_OK);
+	test_require(collect_notified(nyoci, fd, nyoci_addr) == expected);
+}
+
+int
+main(int argc, char * argv[]) {
+	static const uint16_t dupes[] = { 7, 0, 7, 0 };
+	static const uint16_t broadcast[] = { 8, NYOCI_OBSERVABLE_BROADCAST_KEY };
+	static const uint16_t unknown[] = { 3 };
+	nyoci_sockaddr_t nyoci_addr;
+	nyoci_sockaddr_t remote_addr;
+	struct test_packet_s packet;
+	uint8_t request[32];
+	uint8_t token[2] = { 0xB0, 0 };
+	size_t request_len;
+	nyoci_t nyoci;
+	int fd;
+	int i;
+
+	nyoci = test_create_instance(&nyoci_addr);
+	fd = test_open_socket(&remote_addr);
+
+	nyoci_set_default_request_handler(nyoci, &request_handler, NULL);
+
+	for (i = 0; i < OBSERVER_COUNT; i++) {
+		token[1] = (uint8_t)i;
+		request_len = test_build_get(request, COAP_TRANS_TYPE_NONCONFIRMABLE, (coap_msg_id_t)(1 + i), token, sizeof(token), 0);
+		test_send(fd, &nyoci_addr, request, request_len);
+		test_require(test_receive(nyoci, fd, &packet, 1000));
+	}
+
+	// Key sets.
+	check_set(nyoci, fd, &nyoci_addr, dupes, 4, OBS_0 | OBS_7 | OBS_BROADCAST);
+	check_set(nyoci, fd, &nyoci_addr, broadcast, 2, OBS_ALL);
+	check_set(nyoci, fd, &nyoci_addr, unknown, 1, OBS_BROADCAST);
+	check_set(nyoci, fd, &nyoci_addr, dupes, 0, 0);
+
+	// Bits 0 and 7 of the first byte, and bit 0 of the second.
+	check_bitmap(nyoci, fd, &nyoci_addr, 0x81, 0x01, 16, OBS_0 | OBS_7 | OBS_8 | OBS_BROADCAST);
+	check_bitmap(nyoci, fd, &nyoci_addr, 0x00, 0x01, 9, OBS_8 | OBS_BROADCAST);
+
+	// Bit 8 is past the end of an 8 bit map.
+	check_bitmap(nyoci, fd, &nyoci_addr, 0x00, 0x01, 8, 0);
+
+	// Bit 11 is past the end of an 11 bit map, but not of a 12 bit one.
+	check_bitmap(nyoci, fd, &nyoci_addr, 0x00, 0x08, 11, 0);
+	check_bitmap(nyoci, fd, &nyoci_addr, 0x00, 0x08, 12, OBS_11 | OBS_BROADCAST);
+
+	// No bits at all.
+	check_bitmap(nyoci, fd, &nyoci_addr, 0xFF, 0xFF, 0, 0);
+	check_bitmap(nyoci, fd, &nyoci_addr, 0x00, 0x00, 16, 0);
+
+	close(fd);
+	nyoci_release(nyoci);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,116 @@
+/*!	@page test-observer-conflation test-observer-conflation.c: Notification conflation test.
+**
+**	Sets a minimum interval on an observable and triggers it faster
+**	than that. The first trigger must go out at once, and a burst of
+**	triggers inside the interval must turn into a single notification
+**	carrying the latest state, sent when the interval is up.
+**
+**	@include test-observer-conflation.c
+**
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "test-loopback.h"
+
+#define MIN_INTERVAL			(200)
+#define BURST_COUNT				(5)
+
+static struct nyoci_observable_s gObservable;
+static int gState;
+
+static nyoci_status_t
+request_handler(void* context) {
+	nyoci_status_t status;
+
+	status = nyoci_outbound_begin_response(COAP_RESULT_205_CONTENT);
+	if (status == NYOCI_STATUS_OK) {
+		status = nyoci_observable_update(&gObservable, 0);
+	}
+	if (status == NYOCI_STATUS_OK) {
+		status = nyoci_outbound_append_content_formatted("state=%d", gState);
+	}
+	if (status == NYOCI_STATUS_OK) {
+		status = nyoci_outbound_send();
+	}
+	return status;
+}
+
+static void
+receive_state(nyoci_t nyoci, int fd, const nyoci_sockaddr_t* nyoci_addr, int ms) {
+	struct test_packet_s packet;
+	char content[16];
+
+	snprintf(content, sizeof(content), "state=%d", gState);
+
+	test_require(test_receive(nyoci, fd, &packet, ms));
+	test_require(test_packet_find_option(&packet, COAP_OPTION_OBSERVE) >= 0);
+	test_require(test_packet_content_is(&packet, content));
+
+	test_ack_if_needed(fd, nyoci_addr, &packet);
+}
+
+int
+main(int argc, char * argv[]) {
+	static const uint8_t token[] = { 0x42 };
+	nyoci_sockaddr_t nyoci_addr;
+	nyoci_sockaddr_t remote_addr;
+	struct nyoci_observable_stats_s stats;
+	struct test_packet_s packet;
+	uint8_t request[32];
+	size_t request_len;
+	double sent_at;
+	nyoci_t nyoci;
+	int fd;
+	int i;
+
+	nyoci = test_create_instance(&nyoci_addr);
+	fd = test_open_socket(&remote_addr);
+
+	nyoci_set_default_request_handler(nyoci, &request_handler, NULL);
+	nyoci_observable_set_min_interval(&gObservable, MIN_INTERVAL);
+
+	request_len = test_build_get(request, COAP_TRANS_TYPE_NONCONFIRMABLE, 1, token, sizeof(token), 0);
+	test_send(fd, &nyoci_addr, request, request_len);
+	receive_state(nyoci, fd, &nyoci_addr, 1000);
+
+	// The registration response counts as a notification.
+	test_pump(nyoci, MIN_INTERVAL + 50);
+
+	gState++;
+	test_require(nyoci_observable_trigger(&gObservable, 0, 0) == NYOCI_STATUS_OK);
+	receive_state(nyoci, fd, &nyoci_addr, 50);
+	sent_at = test_now();
+
+	for (i = 0; i < BURST_COUNT; i++) {
+		gState++;
+		test_require(nyoci_observable_trigger(&gObservable, 0, 0) == NYOCI_STATUS_OK);
+		test_pump(nyoci, 5);
+	}
+
+	// Held back until the interval is up...
+	test_require(!test_receive(nyoci, fd, &packet, MIN_INTERVAL / 2));
+
+	// ...then sent once, with the latest state.
+	receive_state(nyoci, fd, &nyoci_addr, MIN_INTERVAL * 2);
+	test_require(test_now() - sent_at >= (MIN_INTERVAL - 10) / 1000.0);
+	test_require(!test_receive(nyoci, fd, &packet, MIN_INTERVAL + 50));
+
+	nyoci_observable_get_stats(&gObservable, &stats);
+	test_require(stats.triggered == 1 + BURST_COUNT);
+	test_require(stats.sent == 2);
+	test_require(stats.deferred == 1);
+	test_require(stats.conflated == BURST_COUNT - 1);
+
+	// Once the interval is up, a trigger goes out right away again.
+	gState++;
+	test_require(nyoci_observable_trigger(&gObservable, 0, 0) == NYOCI_STATUS_OK);
+	receive_state(nyoci, fd, &nyoci_addr, 50);
+
+	close(fd);
+	nyoci_release(nyoci);
+
+	return EXIT_SUCCESS;
+}
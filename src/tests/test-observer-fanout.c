@@ -0,0 +1,178 @@
+/*!	@page test-observer-fanout test-observer-fanout.c: Notification fan-out test.
+**
+**	Two observers with tokens of different lengths watch the same
+**	resource. A trigger renders the notification once and stamps it
+**	for each observer, so each copy must carry its own token and
+**	Observe value while the options around Observe and the payload
+**	come through unchanged.
+**
+**	@include test-observer-fanout.c
+**
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "test-loopback.h"
+
+#define OBSERVER_COUNT			(2)
+#define CONTENT_FORMAT			(40)
+#define MAX_AGE					(60)
+
+static struct nyoci_observable_s gObservable;
+static int gState;
+static int gRenders;
+
+static const uint8_t gTokens[OBSERVER_COUNT][5] = {
+	{ 0x11 },
+	{ 0x21, 0x22, 0x23, 0x24, 0x25 },
+};
+static const uint8_t gTokenLengths[OBSERVER_COUNT] = { 1, 5 };
+
+static nyoci_status_t
+request_handler(void* context) {
+	nyoci_status_t status;
+
+	gRenders++;
+
+	status = nyoci_outbound_begin_response(COAP_RESULT_205_CONTENT);
+	if (status == NYOCI_STATUS_OK) {
+		status = nyoci_outbound_add_option_uint(COAP_OPTION_ETAG, 0x1000 + gState);
+	}
+	if (status == NYOCI_STATUS_OK) {
+		status = nyoci_observable_update(&gObservable, 0);
+	}
+	if (status == NYOCI_STATUS_OK) {
+		status = nyoci_outbound_add_option_uint(COAP_OPTION_CONTENT_TYPE, CONTENT_FORMAT);
+	}
+	if (status == NYOCI_STATUS_OK) {
+		status = nyoci_outbound_add_option_uint(COAP_OPTION_MAX_AGE, MAX_AGE);
+	}
+	if (status == NYOCI_STATUS_OK) {
+		status = nyoci_outbound_append_content_formatted("state=%d", gState);
+	}
+	if (status == NYOCI_STATUS_OK) {
+		status = nyoci_outbound_send();
+	}
+	return status;
+}
+
+static int
+token_to_observer(const struct test_packet_s* packet) {
+	int i;
+
+	for (i = 0; i < OBSERVER_COUNT; i++) {
+		if ( (packet->token_len == gTokenLengths[i])
+		  && (0 == memcmp(packet->token, gTokens[i], packet->token_len))
+		) {
+			return i;
+		}
+	}
+
+	fprintf(stderr, "Unexpected token\n");
+	exit(EXIT_FAILURE);
+}
+
+//!	Checks everything but the token and Observe value.
+static void
+check_notification(const struct test_packet_s* packet) {
+	char content[16];
+
+	snprintf(content, sizeof(content), "state=%d", gState);
+
+	test_require(packet->code == COAP_RESULT_205_CONTENT);
+	test_require(packet->option_count == 4);
+	test_require(packet->option_key[0] == COAP_OPTION_ETAG);
+	test_require(packet->option_key[1] == COAP_OPTION_OBSERVE);
+	test_require(test_packet_option_uint(packet, COAP_OPTION_ETAG) == (uint32_t)(0x1000 + gState));
+	test_require(test_packet_option_uint(packet, COAP_OPTION_CONTENT_TYPE) == CONTENT_FORMAT);
+	test_require(test_packet_option_uint(packet, COAP_OPTION_MAX_AGE) == MAX_AGE);
+	test_require(test_packet_content_is(packet, content));
+}
+
+//!	Triggers and checks the notification each observer gets.
+static void
+trigger_and_check(nyoci_t nyoci, int fd, const nyoci_sockaddr_t* nyoci_addr, uint8_t flags, uint32_t* last_seq) {
+	struct test_packet_s packet;
+	bool seen[OBSERVER_COUNT] = { false };
+	uint32_t seq;
+	int i, n;
+
+	gState++;
+	test_require(nyoci_observable_trigger(&gObservable, 0, flags) == NYOCI_STATUS_OK);
+
+	for (n = 0; n < OBSERVER_COUNT; n++) {
+		test_require(test_receive(nyoci, fd, &packet, 1000));
+
+		i = token_to_observer(&packet);
+		test_require(!seen[i]);
+		seen[i] = true;
+
+		check_notification(&packet);
+
+		seq = test_packet_option_uint(&packet, COAP_OPTION_OBSERVE);
+		test_require(seq > last_seq[i]);
+		last_seq[i] = seq;
+
+		test_ack_if_needed(fd, nyoci_addr, &packet);
+	}
+
+	test_require(!test_receive(nyoci, fd, &packet, 100));
+}
+
+int
+main(int argc, char * argv[]) {
+	nyoci_sockaddr_t nyoci_addr;
+	nyoci_sockaddr_t remote_addr;
+	struct test_packet_s packet;
+	uint32_t last_seq[OBSERVER_COUNT];
+	uint8_t request[32];
+	size_t request_len;
+	nyoci_t nyoci;
+	int fd;
+	int renders;
+	int i;
+
+	nyoci = test_create_instance(&nyoci_addr);
+	fd = test_open_socket(&remote_addr);
+
+	nyoci_set_default_request_handler(nyoci, &request_handler, NULL);
+
+	for (i = 0; i < OBSERVER_COUNT; i++) {
+		request_len = test_build_get(request, COAP_TRANS_TYPE_NONCONFIRMABLE, (coap_msg_id_t)(100 + i), gTokens[i], gTokenLengths[i], 0);
+		test_send(fd, &nyoci_addr, request, request_len);
+
+		test_require(test_receive(nyoci, fd, &packet, 1000));
+		test_require(token_to_observer(&packet) == i);
+		check_notification(&packet);
+
+		last_seq[i] = test_packet_option_uint(&packet, COAP_OPTION_OBSERVE);
+	}
+
+	test_require(nyoci_observable_observer_count(&gObservable, 0) == OBSERVER_COUNT);
+
+	renders = gRenders;
+	trigger_and_check(nyoci, fd, &nyoci_addr, 0, last_seq);
+#if NYOCI_CONF_OBSERVER_FANOUT
+	test_require(gRenders == renders + 1);
+#else
+	test_require(gRenders == renders + OBSERVER_COUNT);
+#endif
+
+	renders = gRenders;
+	trigger_and_check(nyoci, fd, &nyoci_addr, NYOCI_OBS_TRIGGER_FLAG_RENDER_EACH, last_seq);
+	test_require(gRenders == renders + OBSERVER_COUNT);
+
+	// A cached render must not outlive the state it was made from.
+	renders = gRenders;
+	trigger_and_check(nyoci, fd, &nyoci_addr, 0, last_seq);
+#if NYOCI_CONF_OBSERVER_FANOUT
+	test_require(gRenders == renders + 1);
+#endif
+
+	close(fd);
+	nyoci_release(nyoci);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,176 @@
+/*!	@page test-observer-registry test-observer-registry.c: Observer registry test.
+**
+**	Registers more observers than fit in one chunk of the observer
+**	registry, and checks that all of them are counted and notified.
+**	Then removes some, both by deregistering with a plain GET and
+**	with nyoci_observable_clear(), and checks that exactly the rest
+**	are still notified.
+**
+**	@include test-observer-registry.c
+**
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "test-loopback.h"
+
+#define OBSERVER_COUNT			(150)
+#define KEY_COUNT				(3)
+
+static struct nyoci_observable_s gObservable;
+static int gState;
+
+static nyoci_status_t
+request_handler(void* context) {
+	const struct coap_header_s* const header = nyoci_inbound_get_packet();
+	nyoci_status_t status;
+
+	status = nyoci_outbound_begin_response(COAP_RESULT_205_CONTENT);
+	if (status == NYOCI_STATUS_OK) {
+		// The last byte of the token picks the key.
+		status = nyoci_observable_update(&gObservable, header->token[header->token_len - 1] % KEY_COUNT);
+	}
+	if (status == NYOCI_STATUS_OK) {
+		status = nyoci_outbound_append_content_formatted("n=%d", gState);
+	}
+	if (status == NYOCI_STATUS_OK) {
+		status = nyoci_outbound_send();
+	}
+	return status;
+}
+
+static void
+observer_token(int i, uint8_t token[2]) {
+	token[0] = (uint8_t)(i >> 8);
+	token[1] = (uint8_t)i;
+}
+
+static int
+token_to_observer(const struct test_packet_s* packet) {
+	test_require(packet->token_len == 2);
+	return (packet->token[0] << 8) | packet->token[1];
+}
+
+//!	Collects one notification from each observer in `expected`.
+static void
+collect_notifications(nyoci_t nyoci, int fd, const nyoci_sockaddr_t* nyoci_addr, const bool* expected) {
+	struct test_packet_s packet;
+	bool seen[OBSERVER_COUNT] = { false };
+	char content[16];
+	int remaining = 0;
+	int i;
+
+	snprintf(content, sizeof(content), "n=%d", gState);
+
+	for (i = 0; i < OBSERVER_COUNT; i++) {
+		remaining += expected[i];
+	}
+
+	while (remaining > 0) {
+		test_require(test_receive(nyoci, fd, &packet, 2000));
+
+		i = token_to_observer(&packet);
+		test_require(i < OBSERVER_COUNT);
+		test_require(expected[i]);
+		test_require(!seen[i]);
+		test_require(packet.code == COAP_RESULT_205_CONTENT);
+		test_require(test_packet_find_option(&packet, COAP_OPTION_OBSERVE) >= 0);
+		test_require(test_packet_content_is(&packet, content));
+
+		test_ack_if_needed(fd, nyoci_addr, &packet);
+
+		seen[i] = true;
+		remaining--;
+	}
+
+	// ...and nothing else.
+	test_require(!test_receive(nyoci, fd, &packet, 100));
+}
+
+int
+main(int argc, char * argv[]) {
+	nyoci_sockaddr_t nyoci_addr;
+	nyoci_sockaddr_t remote_addr;
+	struct test_packet_s packet;
+	bool expected[OBSERVER_COUNT];
+	uint8_t request[32];
+	uint8_t token[2];
+	coap_msg_id_t msg_id = 1;
+	size_t request_len;
+	nyoci_t nyoci;
+	int fd;
+	int count;
+	int i;
+
+	nyoci = test_create_instance(&nyoci_addr);
+	fd = test_open_socket(&remote_addr);
+
+	nyoci_set_default_request_handler(nyoci, &request_handler, NULL);
+
+	// Register, one chunk and then some.
+	for (i = 0; i < OBSERVER_COUNT; i++) {
+		observer_token(i, token);
+		request_len = test_build_get(request, COAP_TRANS_TYPE_NONCONFIRMABLE, msg_id++, token, sizeof(token), 0);
+		test_send(fd, &nyoci_addr, request, request_len);
+
+		test_require(test_receive(nyoci, fd, &packet, 1000));
+		test_require(token_to_observer(&packet) == i);
+		test_require(test_packet_find_option(&packet, COAP_OPTION_OBSERVE) >= 0);
+
+		expected[i] = true;
+	}
+
+	test_require(nyoci_count_observers(nyoci) == OBSERVER_COUNT);
+	test_require(nyoci_observable_observer_count(&gObservable, NYOCI_OBSERVABLE_BROADCAST_KEY) == OBSERVER_COUNT);
+	test_require(nyoci_observable_observer_count(&gObservable, 0) == OBSERVER_COUNT / KEY_COUNT);
+
+	gState++;
+	test_require(nyoci_observable_trigger(&gObservable, NYOCI_OBSERVABLE_BROADCAST_KEY, 0) == NYOCI_STATUS_OK);
+	collect_notifications(nyoci, fd, &nyoci_addr, expected);
+
+	// Deregister every fifth observer, with a plain GET.
+	for (i = 0; i < OBSERVER_COUNT; i += 5) {
+		observer_token(i, token);
+		request_len = test_build_get(request, COAP_TRANS_TYPE_NONCONFIRMABLE, msg_id++, token, sizeof(token), -1);
+		test_send(fd, &nyoci_addr, request, request_len);
+
+		test_require(test_receive(nyoci, fd, &packet, 1000));
+		test_require(token_to_observer(&packet) == i);
+		test_require(test_packet_find_option(&packet, COAP_OPTION_OBSERVE) < 0);
+
+		expected[i] = false;
+	}
+
+	count = 0;
+	for (i = 0; i < OBSERVER_COUNT; i++) {
+		if (expected[i] && ((i % KEY_COUNT) == 1)) {
+			expected[i] = false;
+			count++;
+		}
+	}
+
+	test_require(nyoci_observable_clear(&gObservable, 1) == count);
+
+	count = 0;
+	for (i = 0; i < OBSERVER_COUNT; i++) {
+		count += expected[i];
+	}
+
+	test_require(nyoci_count_observers(nyoci) == count);
+	test_require(nyoci_observable_observer_count(&gObservable, NYOCI_OBSERVABLE_BROADCAST_KEY) == count);
+	test_require(nyoci_observable_observer_count(&gObservable, 1) == 0);
+
+	gState++;
+	test_require(nyoci_observable_trigger(&gObservable, NYOCI_OBSERVABLE_BROADCAST_KEY, 0) == NYOCI_STATUS_OK);
+	collect_notifications(nyoci, fd, &nyoci_addr, expected);
+
+	test_require(nyoci_observable_clear(&gObservable, NYOCI_OBSERVABLE_BROADCAST_KEY) == count);
+	test_require(nyoci_count_observers(nyoci) == 0);
+
+	close(fd);
+	nyoci_release(nyoci);
+
+	return EXIT_SUCCESS;
+}
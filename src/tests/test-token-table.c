@@ -0,0 +1,174 @@
+/*!	@page test-token-table test-token-table.c: Token index test.
+**
+**	Starts many client transactions at once, ends some of them, and
+**	then answers the rest with separate responses that can only be
+**	matched by token. Ending transactions removes them from the
+**	open-addressing token index, which shifts the entries after them
+**	back, so every survivor has to still be found afterwards.
+**
+**	@include test-token-table.c
+**
+*/
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "test-loopback.h"
+
+#define TRANSACTION_COUNT		(96)
+#define ROUND_COUNT				(3)
+
+static nyoci_sockaddr_t gServerAddr;
+
+struct request_s {
+	int index;
+	nyoci_transaction_t transaction;
+	int responses;
+	int invalidations;
+	bool seen;
+	uint8_t token[8];
+	uint8_t token_len;
+};
+
+static struct request_s gRequests[TRANSACTION_COUNT];
+
+static nyoci_status_t
+resend_request(void* context) {
+	struct request_s* const request = context;
+	nyoci_status_t status;
+
+	status = nyoci_outbound_begin(nyoci_get_current_instance(), COAP_METHOD_GET, COAP_TRANS_TYPE_CONFIRMABLE);
+	if (status == NYOCI_STATUS_OK) {
+		nyoci_plat_set_remote_sockaddr(&gServerAddr);
+		status = nyoci_outbound_append_content_formatted("%d", request->index);
+	}
+	if (status == NYOCI_STATUS_OK) {
+		status = nyoci_outbound_send();
+	}
+	return status;
+}
+
+static nyoci_status_t
+response_handler(int statuscode, void* context) {
+	struct request_s* const request = context;
+
+	if (statuscode == COAP_RESULT_205_CONTENT) {
+		request->responses++;
+	} else if (statuscode == NYOCI_STATUS_TRANSACTION_INVALIDATED) {
+		request->invalidations++;
+	} else {
+		fprintf(stderr, "Unexpected status %d for request %d\n", statuscode, request->index);
+		exit(EXIT_FAILURE);
+	}
+	return NYOCI_STATUS_OK;
+}
+
+static void
+send_separate_response(int fd, const nyoci_sockaddr_t* to, coap_msg_id_t msg_id, const uint8_t* token, uint8_t token_len) {
+	uint8_t packet[4 + 8];
+
+	packet[0] = (uint8_t)(0x40 | (COAP_TRANS_TYPE_NONCONFIRMABLE << 4) | token_len);
+	packet[1] = COAP_RESULT_205_CONTENT;
+	packet[2] = (uint8_t)(msg_id >> 8);
+	packet[3] = (uint8_t)msg_id;
+	memcpy(packet + 4, token, token_len);
+
+	test_send(fd, to, packet, 4 + token_len);
+}
+
+static void
+run_round(nyoci_t nyoci, int fd, int round) {
+	nyoci_sockaddr_t client_addr;
+	struct test_packet_s packet;
+	coap_msg_id_t msg_id = (coap_msg_id_t)(1000 * (round + 1));
+	int seen = 0;
+	int i;
+
+	test_loopback_sockaddr(&client_addr, nyoci_plat_get_port(nyoci));
+	memset(gRequests, 0, sizeof(gRequests));
+
+	for (i = 0; i < TRANSACTION_COUNT; i++) {
+		gRequests[i].index = i;
+		gRequests[i].transaction = nyoci_transaction_create(
+			nyoci,
+			0,
+			&resend_request,
+			&response_handler,
+			&gRequests[i]
+		);
+		test_require(gRequests[i].transaction != NULL);
+		test_require(nyoci_transaction_begin(nyoci, gRequests[i].transaction, 30*MSEC_PER_SEC) == NYOCI_STATUS_OK);
+	}
+
+	// Collect the token of each request.
+	while (seen < TRANSACTION_COUNT) {
+		char index_str[8] = "";
+
+		test_require(test_receive(nyoci, fd, &packet, 2000));
+		test_require(packet.code == COAP_METHOD_GET);
+		test_require(packet.content_len > 0 && packet.content_len < sizeof(index_str));
+		memcpy(index_str, packet.content, packet.content_len);
+
+		i = atoi(index_str);
+		test_require(i >= 0 && i < TRANSACTION_COUNT);
+
+		if (!gRequests[i].seen) {
+			gRequests[i].seen = true;
+			gRequests[i].token_len = packet.token_len;
+			memcpy(gRequests[i].token, packet.token, packet.token_len);
+			seen++;
+		}
+	}
+
+	// End every third one, starting at a different place each round.
+	for (i = round; i < TRANSACTION_COUNT; i += 3) {
+		nyoci_transaction_end(nyoci, gRequests[i].transaction);
+		test_require(gRequests[i].invalidations == 1);
+	}
+
+	// Answer everything, including the ones that were ended.
+	for (i = 0; i < TRANSACTION_COUNT; i++) {
+		send_separate_response(fd, &client_addr, msg_id++, gRequests[i].token, gRequests[i].token_len);
+		test_pump(nyoci, 1);
+	}
+
+	test_pump(nyoci, 100);
+
+	for (i = 0; i < TRANSACTION_COUNT; i++) {
+		if ((i % 3) == round) {
+			test_require(gRequests[i].responses == 0);
+			test_require(gRequests[i].invalidations == 1);
+		} else {
+			test_require(gRequests[i].responses == 1);
+			test_require(gRequests[i].invalidations == 0);
+		}
+	}
+
+	// Drop the resets sent for the ended ones.
+	while (recv(fd, packet.data, sizeof(packet.data), 0) > 0) {
+	}
+}
+
+int
+main(int argc, char * argv[]) {
+	nyoci_sockaddr_t nyoci_addr;
+	nyoci_t nyoci;
+	int fd;
+	int round;
+
+	nyoci = test_create_instance(&nyoci_addr);
+	fd = test_open_socket(&gServerAddr);
+
+	// Let every request go out at once.
+	test_require(nyoci_set_nstart(nyoci, NULL, 0) == NYOCI_STATUS_OK);
+
+	for (round = 0; round < ROUND_COUNT; round++) {
+		run_round(nyoci, fd, round);
+	}
+
+	close(fd);
+	nyoci_release(nyoci);
+
+	return EXIT_SUCCESS;
+}